@@ -0,0 +1,122 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "async.h"
+
+#include <nacs-utils/timer.h>
+
+#include <system_error>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace NaCs {
+namespace Spcm {
+
+NACS_EXPORT() AsyncWaiter::AsyncWaiter(drv_handle hdl)
+    : m_hdl(hdl),
+      m_efd(eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (m_efd < 0)
+        throw std::system_error(errno, std::generic_category(), "eventfd");
+    m_thread = std::thread([this] { run(); });
+}
+
+NACS_EXPORT() AsyncWaiter::~AsyncWaiter()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+    close(m_efd);
+}
+
+NACS_EXPORT() uint64_t AsyncWaiter::submit(std::function<uint32_t()> fn, Callback cb)
+{
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        id = m_next_id++;
+        m_requests.push_back({id, std::move(fn), std::move(cb)});
+    }
+    m_cond.notify_one();
+    return id;
+}
+
+NACS_EXPORT() uint64_t AsyncWaiter::submit_cmd(int32_t cmd, Callback cb)
+{
+    auto hdl = m_hdl;
+    return submit([hdl, cmd] { return spcm_dwSetParam_i32(hdl, SPC_M2CMD, cmd); },
+                  std::move(cb));
+}
+
+NACS_EXPORT() bool AsyncWaiter::poll(Completion &res)
+{
+    uint64_t v;
+    if (read(m_efd, &v, sizeof(v)) != sizeof(v))
+        return false;
+    std::lock_guard<std::mutex> locker(m_lock);
+    res = m_done.front();
+    m_done.pop_front();
+    return true;
+}
+
+NACS_EXPORT() AsyncWaiter::Completion AsyncWaiter::wait()
+{
+    Completion res;
+    while (!poll(res)) {
+        pollfd pfd{m_efd, POLLIN, 0};
+        ::poll(&pfd, 1, -1);
+    }
+    return res;
+}
+
+void AsyncWaiter::run()
+{
+    std::unique_lock<std::mutex> locker(m_lock);
+    while (true) {
+        m_cond.wait(locker, [&] { return m_stop || !m_requests.empty(); });
+        // Finish the submitted waits before stopping.
+        if (m_requests.empty())
+            return;
+        auto req = std::move(m_requests.front());
+        m_requests.pop_front();
+        locker.unlock();
+        auto err = req.fn();
+        Completion res{req.id, err, getTime()};
+        if (req.cb) {
+            req.cb(res);
+            locker.lock();
+            continue;
+        }
+        locker.lock();
+        m_done.push_back(res);
+        uint64_t v = 1;
+        if (write(m_efd, &v, sizeof(v)) != sizeof(v)) {
+            // Cannot happen unless the counter overflows.
+            abort();
+        }
+    }
+}
+
+}
+}
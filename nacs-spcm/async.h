@@ -0,0 +1,106 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_ASYNC_H
+#define _NACS_SPCM_ASYNC_H
+
+#include "spcm.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace NaCs {
+namespace Spcm {
+
+// Runs the blocking driver waits (DMA, trigger, ready) for one card on a service
+// thread so that the caller never blocks on the driver.
+// Completions are either passed to the callback (called on the service thread)
+// or queued and signaled on an eventfd (`fd()`), which can be added to the
+// `poll`/`epoll` loop that manages multiple cards.
+//
+// The waits are issued directly to the driver (bypassing the `Spcm` shadow registers,
+// which are not thread safe). While a wait is pending, the card can still be used
+// from other threads for non-blocking calls, including the commands that end the wait.
+// The destructor waits for the pending wait to finish so `SPC_TIMEOUT`
+// should be set for waits that may never complete.
+class NACS_EXPORT(spcm) AsyncWaiter {
+public:
+    struct Completion {
+        uint64_t id;
+        // The driver error code, `ERR_OK` on success and `ERR_TIMEOUT` on timeout.
+        uint32_t err;
+        // `getTime()` when the wait returned, for measuring the wake-up latency.
+        uint64_t done_time;
+    };
+    using Callback = std::function<void(const Completion&)>;
+
+    // `hdl` may be `NULL` if only `submit()` is used.
+    AsyncWaiter(drv_handle hdl);
+    ~AsyncWaiter();
+
+    // Readable when there are queued completions. Each read returns one completion.
+    int fd() const
+    {
+        return m_efd;
+    }
+    // Run `fn` on the service thread. Returns the ID of the completion.
+    uint64_t submit(std::function<uint32_t()> fn, Callback cb=nullptr);
+    uint64_t submit_cmd(int32_t cmd, Callback cb=nullptr);
+    uint64_t wait_dma(Callback cb=nullptr)
+    {
+        return submit_cmd(M2CMD_DATA_WAITDMA, std::move(cb));
+    }
+    uint64_t wait_trigger(Callback cb=nullptr)
+    {
+        return submit_cmd(M2CMD_CARD_WAITTRIGGER, std::move(cb));
+    }
+    uint64_t wait_ready(Callback cb=nullptr)
+    {
+        return submit_cmd(M2CMD_CARD_WAITREADY, std::move(cb));
+    }
+    // Get a queued completion without blocking. Returns `false` if there isn't any.
+    bool poll(Completion &res);
+    // Block until a completion is queued.
+    Completion wait();
+
+private:
+    struct Request {
+        uint64_t id;
+        std::function<uint32_t()> fn;
+        Callback cb;
+    };
+    void run();
+
+    drv_handle m_hdl;
+    int m_efd;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<Request> m_requests;
+    std::deque<Completion> m_done;
+    uint64_t m_next_id = 0;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+}
+}
+
+#endif
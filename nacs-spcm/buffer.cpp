@@ -0,0 +1,158 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "buffer.h"
+#include "numa.h"
+
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#  define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#  define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#  define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace NaCs {
+namespace Spcm {
+
+static constexpr size_t size_2m = size_t(1) << 21;
+static constexpr size_t size_1g = size_t(1) << 30;
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+// The hugetlbfs pages are reserved from the global pool when mapped
+// but they are faulted in after the mapping is bound to the node,
+// which gets a `SIGBUS` if the node doesn't have enough free pages.
+static void *map_hugetlb(size_t size, size_t page_size, int flags, int node)
+{
+    if (node >= 0 && numa_free_hugepages(node, page_size) < size / page_size)
+        return nullptr;
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | flags, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+// A 2 MiB aligned mapping so that all of it can be backed by transparent huge pages.
+static void *map_aligned(size_t size)
+{
+    auto ptr = mmap(nullptr, size + size_2m, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return nullptr;
+    auto addr = (uintptr_t)ptr;
+    auto aligned = round_up(addr, size_2m);
+    if (aligned > addr)
+        munmap(ptr, aligned - addr);
+    munmap((void*)(aligned + size), addr + size_2m - aligned);
+    return (void*)aligned;
+}
+
+NACS_EXPORT() Buffer::Buffer(size_t size, int node, bool huge, bool lock)
+    : m_size(size)
+{
+    if (huge && size >= size_1g) {
+        m_map_size = round_up(size, size_1g);
+        m_ptr = map_hugetlb(m_map_size, size_1g, MAP_HUGE_1GB, node);
+        m_page = Page::Huge1G;
+    }
+    if (huge && !m_ptr) {
+        m_map_size = round_up(size, size_2m);
+        m_ptr = map_hugetlb(m_map_size, size_2m, MAP_HUGE_2MB, node);
+        m_page = Page::Huge2M;
+    }
+    if (!m_ptr) {
+        m_map_size = round_up(size, huge ? size_2m : (size_t)sysconf(_SC_PAGESIZE));
+        m_ptr = huge ? map_aligned(m_map_size) : mmap(nullptr, m_map_size,
+                                                     PROT_READ | PROT_WRITE,
+                                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (!m_ptr || m_ptr == MAP_FAILED) {
+            m_ptr = nullptr;
+            throw std::bad_alloc();
+        }
+        m_page = Page::Normal;
+        if (huge && madvise(m_ptr, m_map_size, MADV_HUGEPAGE) == 0) {
+            m_page = Page::Transparent;
+        }
+    }
+    bind_to_node(m_ptr, m_map_size, node);
+    // Pre-fault. `mlock` would also do this but it may fail.
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < m_map_size; i += page_size)
+        ((volatile char*)m_ptr)[i] = 0;
+    if (lock) {
+        m_locked = mlock(m_ptr, m_map_size) == 0;
+    }
+}
+
+NACS_EXPORT() Buffer &Buffer::operator=(Buffer &&other)
+{
+    release();
+    m_ptr = other.m_ptr;
+    m_size = other.m_size;
+    m_map_size = other.m_map_size;
+    m_page = other.m_page;
+    m_locked = other.m_locked;
+    other.m_ptr = nullptr;
+    other.m_size = 0;
+    other.m_map_size = 0;
+    return *this;
+}
+
+NACS_EXPORT() Buffer::~Buffer()
+{
+    release();
+}
+
+void Buffer::release()
+{
+    if (!m_ptr)
+        return;
+    if (m_locked)
+        munlock(m_ptr, m_map_size);
+    munmap(m_ptr, m_map_size);
+    m_ptr = nullptr;
+}
+
+NACS_EXPORT() const char *page_name(Buffer::Page page)
+{
+    switch (page) {
+    case Buffer::Page::Normal:
+        return "normal";
+    case Buffer::Page::Transparent:
+        return "transparent huge";
+    case Buffer::Page::Huge2M:
+        return "2 MiB";
+    case Buffer::Page::Huge1G:
+        return "1 GiB";
+    default:
+        return "unknown";
+    }
+}
+
+}
+}
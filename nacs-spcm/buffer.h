@@ -0,0 +1,98 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_BUFFER_H
+#define _NACS_SPCM_BUFFER_H
+
+#include <nacs-utils/utils.h>
+
+#include <utility>
+
+namespace NaCs {
+namespace Spcm {
+
+// Memory for the DMA rings and the parameter arrays.
+// The generator streams through multi-GB buffers, so with 4 KiB pages
+// it takes a TLB miss every few thousand samples.
+// When `huge` is `true`, the allocation tries in order:
+// 1 GiB hugetlbfs pages (for buffers of at least 1 GiB), 2 MiB hugetlbfs pages
+// (only if `node` has enough free pages of the size),
+// and transparent huge pages (`madvise(MADV_HUGEPAGE)` on a 2 MiB aligned mapping),
+// falling back to normal pages.
+// The memory is bound to the NUMA `node` (unless it is `-1`), pre-faulted,
+// and locked if `lock` is `true` (best effort, e.g. within `RLIMIT_MEMLOCK`)
+// so that no page fault happens while streaming.
+class NACS_EXPORT(spcm) Buffer {
+public:
+    enum class Page : uint8_t {
+        Normal,
+        Transparent,
+        Huge2M,
+        Huge1G,
+    };
+
+    Buffer() = default;
+    Buffer(size_t size, int node=-1, bool huge=true, bool lock=true);
+    Buffer(const Buffer&) = delete;
+    Buffer &operator=(const Buffer&) = delete;
+    Buffer(Buffer &&other)
+    {
+        *this = std::move(other);
+    }
+    Buffer &operator=(Buffer &&other);
+    ~Buffer();
+
+    void *data() const
+    {
+        return m_ptr;
+    }
+    template<typename T>
+    T *get() const
+    {
+        return (T*)m_ptr;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    Page page() const
+    {
+        return m_page;
+    }
+    bool locked() const
+    {
+        return m_locked;
+    }
+
+private:
+    void release();
+
+    void *m_ptr = nullptr;
+    size_t m_size = 0;
+    // The size of the mapping, rounded up to the page size.
+    size_t m_map_size = 0;
+    Page m_page = Page::Normal;
+    bool m_locked = false;
+};
+
+const char *page_name(Buffer::Page page);
+
+}
+}
+
+#endif
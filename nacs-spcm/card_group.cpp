@@ -0,0 +1,376 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "card_group.h"
+#include "numa.h"
+
+#include <nacs-utils/timer.h>
+
+#include <chrono>
+
+namespace NaCs {
+namespace Spcm {
+
+NACS_EXPORT() CardGroup::CardGroup(const std::vector<std::string> &names,
+                                   const char *sync_name, const Config &config)
+    : m_config(config)
+{
+    if (config.notify_size % 4096 != 0 || config.buff_size % config.notify_size != 0)
+        Spcm::throw_error("CardGroup: invalid buffer size", ERR_REG, 0, 0);
+    for (auto &name: names) {
+        m_cards.emplace_back(new CardState);
+        m_cards.back()->card.reset(new Spcm(name.c_str()));
+        // So that re-arming only writes the registers that changed.
+        m_cards.back()->card->enable_shadow();
+        if (config.numa_local) {
+            m_cards.back()->node = card_numa_node(name);
+        }
+    }
+    if (sync_name) {
+        m_sync.reset(new Spcm(sync_name, false));
+    }
+}
+
+NACS_EXPORT() CardGroup::~CardGroup()
+{
+    join_prepare();
+    try {
+        stop();
+    }
+    catch (...) {
+    }
+}
+
+size_t CardGroup::bytes_per_sample() const
+{
+    return __builtin_popcount(uint32_t(m_config.chn_mask)) * sizeof(int16_t);
+}
+
+void CardGroup::setup(size_t idx)
+{
+    auto &state = *m_cards[idx];
+    auto &card = *state.card;
+    bool trigger = !m_sync || idx == 0;
+    auto batch = card.batch();
+    batch.ch_enable(m_config.chn_mask)
+        .set(SPC_CARDMODE, SPC_REP_FIFO_SINGLE)
+        .set(SPC_LOOPS, 0)
+        .set(SPC_SAMPLERATE, int64_t(m_config.sample_rate))
+        .set(SPC_TIMEOUT, m_config.timeout)
+        .set(SPC_TRIG_ORMASK, trigger ? m_config.trigger_mask : 0)
+        .set(SPC_TRIG_ANDMASK, 0);
+    for (unsigned chn = 0; chn < 4; chn++) {
+        if (m_config.chn_mask & (1 << chn)) {
+            batch.enable_out(chn, true);
+        }
+    }
+    batch.commit();
+    // Cache the sample rate as rounded by the driver.
+    // The next `setup()` can then skip it as long as the rate is exact.
+    int64_t rate;
+    card.get_param(SPC_SAMPLERATE, &rate);
+    if (state.lead)
+        state.mem_size = card.mem_size();
+    if (card.def_transfer(SPCM_BUF_DATA, SPCM_DIR_PCTOCARD, uint32_t(state.notify_size),
+                          state.buff.data(), 0, m_config.buff_size)) {
+        card.throw_error();
+    }
+}
+
+void CardGroup::render(size_t idx)
+{
+    auto &state = *m_cards[idx];
+    if (state.node >= 0)
+        pin_to_node(state.node);
+    try {
+        m_next_gen(idx, 0, state.next_buff.get<int16_t>(),
+                   state.next_prefill / bytes_per_sample());
+    }
+    catch (...) {
+        state.prep_error = std::current_exception();
+    }
+}
+
+void CardGroup::prefill(size_t idx)
+{
+    auto &state = *m_cards[idx];
+    auto &card = *state.card;
+    card.set_param(SPC_DATA_AVAIL_CARD_LEN, int64_t(state.prefilled));
+    card.cmd(M2CMD_DATA_STARTDMA | M2CMD_DATA_WAITDMA);
+    card.check_error();
+}
+
+void CardGroup::run(size_t idx, std::promise<void> &started)
+{
+    auto &state = *m_cards[idx];
+    auto &card = *state.card;
+    if (m_config.rt_priority > 0) {
+        state.rt = enter_realtime(m_config.rt_priority, state.cpu);
+    }
+    else if (state.cpu >= 0) {
+        state.rt.pinned = pin_to_cpu(state.cpu);
+    }
+    if (state.cpu < 0 && state.node >= 0)
+        pin_to_node(state.node);
+    started.set_value();
+    auto notify_size = state.notify_size;
+    auto sample_size = bytes_per_sample();
+    auto lead = state.lead.get();
+    uint64_t written = state.prefilled;
+    uint64_t offset = state.prefilled / sample_size;
+    // The registers are accessed directly instead of through `card`
+    // since `stop()` might be using the card (and its shadow registers)
+    // on another thread. None of them are cached anyway.
+    auto hdl = card.handle();
+    try {
+        while (!m_stop.load(std::memory_order_relaxed)) {
+            int64 avail;
+            spcm_dwGetParam_i64(hdl, SPC_DATA_AVAIL_USER_LEN, &avail);
+            size_t queued = 0;
+            if (lead) {
+                int32 promille;
+                spcm_dwGetParam_i32(hdl, SPC_FILLSIZEPROMILLE, &promille);
+                queued = (m_config.buff_size - size_t(avail) +
+                          size_t(state.mem_size * uint64_t(promille) / 1000));
+                lead->update_rate(written - std::min<uint64_t>(written, queued), getTime());
+                auto wait = lead->wait_time(queued);
+                if (wait > 0) {
+                    wait = std::min(wait, m_config.timeout * 1e-3);
+                    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+                    continue;
+                }
+            }
+            if (avail < int64_t(notify_size)) {
+                auto err = spcm_dwSetParam_i32(hdl, SPC_M2CMD, M2CMD_DATA_WAITDMA);
+                if (err == ERR_TIMEOUT) {
+                    card.clear_error();
+                }
+                else if (err && !m_stop.load(std::memory_order_relaxed)) {
+                    card.throw_error();
+                }
+                continue;
+            }
+            int64 pos;
+            spcm_dwGetParam_i64(hdl, SPC_DATA_AVAIL_USER_POS, &pos);
+            // `pos` is always a multiple of `notify_size` and so is `buff_size`
+            // so a chunk never wraps around.
+            auto nsamples = notify_size / sample_size;
+            auto t0 = getTime();
+            m_gen(idx, offset, state.buff.get<int16_t>() + pos / sizeof(int16_t), nsamples);
+            offset += nsamples;
+            spcm_dwSetParam_i64(hdl, SPC_DATA_AVAIL_CARD_LEN, int64(notify_size));
+            written += notify_size;
+            if (lead) {
+                lead->chunk_done(queued, double(getElapse(t0)) * 1e-9);
+            }
+        }
+    }
+    catch (...) {
+        state.error = std::current_exception();
+    }
+}
+
+void CardGroup::assign_cpus()
+{
+    auto ncards = m_cards.size();
+    std::vector<int> isolated;
+    if (m_config.rt_priority > 0 && m_config.cpus.size() < ncards)
+        isolated = isolated_cpus();
+    // Isolated CPUs on the node of each card first, then any of the remaining ones.
+    auto take_isolated = [&] (int node) {
+        for (auto it = isolated.begin(); it != isolated.end(); ++it) {
+            if (node < 0 || numa_cpu_node(*it) == node) {
+                auto cpu = *it;
+                isolated.erase(it);
+                return cpu;
+            }
+        }
+        return -1;
+    };
+    for (size_t i = 0; i < ncards; i++) {
+        auto &state = *m_cards[i];
+        state.cpu = i < m_config.cpus.size() ? m_config.cpus[i] : take_isolated(state.node);
+    }
+    for (auto &state: m_cards) {
+        if (state->cpu < 0) {
+            state->cpu = take_isolated(-1);
+        }
+    }
+}
+
+std::exception_ptr CardGroup::join_prepare()
+{
+    std::exception_ptr error;
+    for (auto &state: m_cards) {
+        if (!state->prep_thread.joinable())
+            continue;
+        state->prep_thread.join();
+        if (state->prep_error && !error) {
+            error = state->prep_error;
+        }
+    }
+    return error;
+}
+
+NACS_EXPORT() void CardGroup::prepare(Generator gen)
+{
+    join_prepare();
+    m_prepared = false;
+    m_next_gen = std::move(gen);
+    auto rate = double(m_config.sample_rate) * double(bytes_per_sample());
+    auto buff_size = m_config.buff_size;
+    for (size_t i = 0; i < m_cards.size(); i++) {
+        auto &state = *m_cards[i];
+        // The current shot might still be using `buff`.
+        if (!state.next_buff.data())
+            state.next_buff = Buffer(buff_size, state.node);
+        state.next_notify = LeadController::pick_notify_size(rate, m_config.target_latency,
+                                                             buff_size, m_config.notify_size);
+        state.next_lead.reset();
+        size_t prefill = buff_size;
+        if (m_config.target_latency > 0) {
+            state.next_lead.reset(new LeadController(rate, state.next_notify, buff_size,
+                                                     m_config.target_latency,
+                                                     m_config.safety_margin));
+            prefill = state.next_lead->lead();
+        }
+        if (m_config.prefill_size) {
+            auto notify = state.next_notify;
+            prefill = std::min(prefill, (m_config.prefill_size + notify - 1) / notify * notify);
+        }
+        state.next_prefill = prefill;
+        state.prep_error = nullptr;
+        state.prep_thread = std::thread([this, i] { render(i); });
+    }
+    m_prepared = true;
+}
+
+NACS_EXPORT() void CardGroup::start(Generator gen)
+{
+    prepare(std::move(gen));
+    arm();
+}
+
+NACS_EXPORT() void CardGroup::arm()
+{
+    if (!m_prepared)
+        Spcm::throw_error("CardGroup: arm without prepare", ERR_SEQUENCE, 0, 0);
+    if (auto error = join_prepare()) {
+        m_prepared = false;
+        std::rethrow_exception(error);
+    }
+    // The preparation is kept if the previous shot ended with an error.
+    stop();
+    m_prepared = false;
+    m_gen = std::move(m_next_gen);
+    for (auto &state: m_cards) {
+        std::swap(state->buff, state->next_buff);
+        state->notify_size = state->next_notify;
+        state->prefilled = state->next_prefill;
+        state->lead = std::move(state->next_lead);
+    }
+    m_stop.store(false, std::memory_order_relaxed);
+    if (m_sync) {
+        // The first card provides the clock and the trigger for the others.
+        auto ncards = m_cards.size();
+        m_sync->batch()
+            .set(SPC_SYNC_ENABLEMASK, int32_t((1 << ncards) - 1))
+            .set(SPC_SYNC_CLKMASK, 1)
+            .commit();
+    }
+    size_t ntouched = 0;
+    try {
+        for (; ntouched < m_cards.size(); ntouched++) {
+            setup(ntouched);
+            prefill(ntouched);
+        }
+        if (m_sync) {
+            m_sync->cmd(M2CMD_CARD_START | M2CMD_CARD_ENABLETRIGGER);
+            m_sync->check_error();
+        }
+        else {
+            for (auto &state: m_cards) {
+                state->card->cmd(M2CMD_CARD_START | M2CMD_CARD_ENABLETRIGGER);
+                state->card->check_error();
+            }
+        }
+    }
+    catch (...) {
+        // Don't leave the cards that were already set up with their DMA running.
+        stop_cards(std::min(ntouched + 1, m_cards.size()));
+        throw;
+    }
+    m_running = true;
+    assign_cpus();
+    for (size_t i = 0; i < m_cards.size(); i++) {
+        auto &state = *m_cards[i];
+        state.error = nullptr;
+        state.rt = RTStatus();
+        std::promise<void> started;
+        auto future = started.get_future();
+        state.thread = std::thread([this, i, &started] { run(i, started); });
+        // So that `rt_status()` is ready when this returns.
+        future.wait();
+    }
+}
+
+// Raw writes since the generator threads may still be using the cards.
+void CardGroup::stop_cards(size_t ncards)
+{
+    auto stop_cmd = M2CMD_CARD_STOP | M2CMD_DATA_STOPDMA;
+    if (m_sync)
+        spcm_dwSetParam_i32(m_sync->handle(), SPC_M2CMD, stop_cmd);
+    for (size_t i = 0; i < ncards; i++) {
+        spcm_dwSetParam_i32(m_cards[i]->card->handle(), SPC_M2CMD, stop_cmd);
+    }
+}
+
+NACS_EXPORT() void CardGroup::stop()
+{
+    if (!m_running)
+        return;
+    m_running = false;
+    m_stop.store(true, std::memory_order_relaxed);
+    // Ends the pending DMA waits on the generator threads.
+    stop_cards(m_cards.size());
+    std::exception_ptr error;
+    for (auto &state: m_cards) {
+        state->thread.join();
+        if (state->error && !error) {
+            error = state->error;
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+NACS_EXPORT() void CardGroup::force_trigger()
+{
+    if (m_sync) {
+        m_sync->force_trigger();
+    }
+    else {
+        for (auto &state: m_cards) {
+            spcm_dwSetParam_i32(state->card->handle(), SPC_M2CMD, M2CMD_CARD_FORCETRIGGER);
+        }
+    }
+}
+
+}
+}
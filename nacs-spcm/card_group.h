@@ -0,0 +1,197 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_CARD_GROUP_H
+#define _NACS_SPCM_CARD_GROUP_H
+
+#include "buffer.h"
+#include "lead_control.h"
+#include "realtime.h"
+#include "spcm.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace NaCs {
+namespace Spcm {
+
+// Cards streaming in FIFO mode on a common clock and trigger,
+// each fed by its own generator thread.
+//
+// With a Star-Hub (`sync_name`, e.g. `"sync0"`), the first card is the clock master,
+// the trigger is taken from it and all the cards are started by the hub.
+// Otherwise every card is started separately and armed on `trigger_mask`,
+// which must then be a trigger shared by all the cards.
+//
+// The DMA buffer of each card is allocated with huge pages on the NUMA node
+// of the card and, unless `cpus` is given, its generator thread runs on the CPUs
+// of that node so that the memory allocated by the generator on first use
+// is local as well.
+//
+// The generator threads are all given the same timeline: the data for the samples
+// `[offset, offset + nsamples)` after the trigger, so that the output of the cards
+// stays sample-aligned as long as none of them underruns.
+class NACS_EXPORT(spcm) CardGroup {
+public:
+    // Fills `buff` with `nsamples` samples for all enabled channels of card `card`
+    // (interleaved as expected by the card), starting at sample `offset`.
+    // Called on the generator thread of the card.
+    using Generator = std::function<void(size_t card, uint64_t offset,
+                                         int16_t *buff, size_t nsamples)>;
+    struct Config {
+        uint64_t sample_rate = 625000000;
+        int32_t chn_mask = CHANNEL0;
+        // Size of the DMA buffer of each card. Must be a multiple of `notify_size`.
+        size_t buff_size = 64 * 1024 * 1024;
+        // Size of each chunk passed to the generator, a multiple of 4096.
+        size_t notify_size = 1024 * 1024;
+        uint32_t trigger_mask = SPC_TMASK_EXT0;
+        // CPU to pin the generator thread of each card on.
+        // Pinned to the NUMA node of the card if empty.
+        std::vector<int> cpus;
+        bool numa_local = true;
+        // `SCHED_FIFO` priority of the generator threads, `0` for normal scheduling.
+        // In the real-time mode, the threads without a CPU in `cpus` are pinned
+        // to the free isolated CPUs (`isolcpus`) if there are any,
+        // preferring the ones on the node of the card, the memory is locked
+        // and the thread stacks are pre-faulted.
+        // All of these are best effort, see `rt_status()`.
+        int rt_priority = 0;
+        // In ms, for the waits on the generator threads.
+        int32_t timeout = 1000;
+        // Target update latency in seconds, see `LeadController`.
+        // With `0`, the generators keep the whole DMA buffer filled.
+        // Otherwise the notify size is reduced to match (up to `notify_size`)
+        // and the generators only write as far ahead of the output as the controller
+        // allows, including the data already in the on-board memory of the card.
+        double target_latency = 0;
+        // Time covered by the lead on top of the generation time, in seconds.
+        double safety_margin = 0.002;
+        // Data rendered and transferred to the card before the trigger is armed,
+        // in bytes, rounded up to the notify size. `0` for the whole buffer
+        // (or the initial lead with `target_latency`).
+        // A smaller prefill shortens `arm()` and the generator threads fill the rest
+        // of the buffer after the start, which must be done before the trigger
+        // to avoid an underrun.
+        size_t prefill_size = 0;
+    };
+
+    CardGroup(const std::vector<std::string> &names, const char *sync_name,
+              const Config &config);
+    ~CardGroup();
+
+    size_t size() const
+    {
+        return m_cards.size();
+    }
+    Spcm &card(size_t i)
+    {
+        return *m_cards[i]->card;
+    }
+    // `-1` if unknown or if `numa_local` is `false`.
+    int numa_node(size_t i) const
+    {
+        return m_cards[i]->node;
+    }
+    // The real-time settings that took effect on the generator thread of card `i`
+    // after `start()`.
+    const RTStatus &rt_status(size_t i) const
+    {
+        return m_cards[i]->rt;
+    }
+    // The lead and the achieved update latency of card `i`.
+    // Empty unless `target_latency` is set.
+    LeadController::Stats lead_stats(size_t i) const
+    {
+        auto &lead = m_cards[i]->lead;
+        return lead ? lead->stats() : LeadController::Stats();
+    }
+
+    // Renders the prefill of the next shot with `gen` in the background,
+    // while the current shot, if any, keeps running.
+    // Discards the previous preparation if it wasn't armed.
+    void prepare(Generator gen);
+    // Stops the current shot, configures the cards, transfers the prefill
+    // rendered by `prepare()` and arms the common trigger.
+    // Only the register writes and the DMA of the prefill are left between
+    // the end of the previous shot and the cards waiting for the trigger.
+    // Only the setup registers that changed are written (see `Spcm::enable_shadow()`).
+    // If any card fails, the ones already set up are stopped before rethrowing.
+    // The generator threads then keep the buffers filled until `stop()`.
+    // Rethrows the first error from the rendering of the prefill.
+    void arm();
+    // `prepare(gen)` followed by `arm()`.
+    void start(Generator gen);
+    // Stops the cards and the generator threads.
+    // Rethrows the first error from the generator threads, e.g. an underrun.
+    void stop();
+    void force_trigger();
+
+private:
+    struct CardState {
+        std::unique_ptr<Spcm> card;
+        Buffer buff;
+        int node = -1;
+        // The CPU to pin the generator thread on or `-1`.
+        int cpu = -1;
+        RTStatus rt;
+        size_t notify_size = 0;
+        // Bytes in the prefill.
+        size_t prefilled = 0;
+        // On-board memory of the card, which is part of the lead.
+        uint64_t mem_size = 0;
+        std::unique_ptr<LeadController> lead;
+        // The next shot from `prepare()`, swapped in by `arm()`.
+        Buffer next_buff;
+        size_t next_notify = 0;
+        size_t next_prefill = 0;
+        std::unique_ptr<LeadController> next_lead;
+        std::thread prep_thread;
+        std::exception_ptr prep_error;
+        std::thread thread;
+        std::exception_ptr error;
+    };
+    void setup(size_t idx);
+    void render(size_t idx);
+    void prefill(size_t idx);
+    // Stops the hub and the first `ncards` cards.
+    void stop_cards(size_t ncards);
+    std::exception_ptr join_prepare();
+    void run(size_t idx, std::promise<void> &started);
+    void assign_cpus();
+    size_t bytes_per_sample() const;
+
+    const Config m_config;
+    std::vector<std::unique_ptr<CardState>> m_cards;
+    std::unique_ptr<Spcm> m_sync;
+    Generator m_gen;
+    Generator m_next_gen;
+    std::atomic<bool> m_stop{false};
+    bool m_running = false;
+    bool m_prepared = false;
+};
+
+}
+}
+
+#endif
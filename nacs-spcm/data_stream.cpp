@@ -18,8 +18,435 @@
 
 #include "data_stream_p.h"
 
+#include <nacs-utils/processor.h>
+#include <nacs-utils/timer.h>
+
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace NaCs {
 namespace Spcm {
 
+template<typename Gen>
+static NACS_INLINE void _calc_wave_fixed_block(float *output, size_t nsteps, int nchns,
+                                               channel_param_fixed *params)
+{
+    for (size_t i = 0; i < nsteps; i++) {
+        Gen::calc_wave_fixed(&output[i * step_size], nchns, params);
+        for (int c = 0; c < nchns; c++) {
+            // The phase advances by `2 * freq` (in unit of pi) per step.
+            auto phase = params[c].phase + 2 * params[c].freq;
+            params[c].phase = phase - 2 * std::nearbyint(phase / 2);
+        }
+    }
+}
+
+template<typename Gen>
+static NACS_INLINE void _calc_wave_block(float *output, size_t nsteps, int nchns,
+                                         const channel_param *params, size_t param_idx)
+{
+    for (size_t i = 0; i < nsteps; i++) {
+        Gen::calc_wave(&output[i * step_size], nchns, params, param_idx + i);
+    }
+}
+
+template<typename Gen, int N>
+static NACS_INLINE void _calc_wave_fixed_spec_block(float *output, size_t nsteps,
+                                                    channel_param_fixed *params)
+{
+    for (size_t i = 0; i < nsteps; i++) {
+        Gen::template calc_wave_fixed_spec<N>(&output[i * step_size], params);
+        for (int c = 0; c < N; c++) {
+            auto phase = params[c].phase + 2 * params[c].freq;
+            params[c].phase = phase - 2 * std::nearbyint(phase / 2);
+        }
+    }
+}
+
+template<typename Gen, int N, bool has_dfreq, bool has_damp>
+static NACS_INLINE void _calc_wave_spec_block(float *output, size_t nsteps,
+                                              const channel_param *params, size_t param_idx)
+{
+    for (size_t i = 0; i < nsteps; i++) {
+        Gen::template calc_wave_spec<N,has_dfreq,has_damp>(&output[i * step_size], params,
+                                                           param_idx + i);
+    }
+}
+
+template<typename Impl, int... Ns>
+static constexpr KernelTable make_kernel_table(KernelISA isa,
+                                               std::integer_sequence<int,Ns...>)
+{
+    return {isa, Impl::calc_wave_fixed, Impl::calc_wave, Impl::template quantize<false>,
+            Impl::template quantize<true>,
+            {Impl::template calc_wave_fixed_spec<Ns + 1>...},
+            {{{Impl::template calc_wave_spec<Ns + 1,false,false>,
+               Impl::template calc_wave_spec<Ns + 1,false,true>},
+              {Impl::template calc_wave_spec<Ns + 1,true,false>,
+               Impl::template calc_wave_spec<Ns + 1,true,true>}}...}};
+}
+
+// The block loops above don't have a target attribute so the kernels cannot be inlined
+// into them directly. Marking the wrapper with both the target and `flatten`
+// inlines everything into a function compiled for the target.
+#define DEF_KERNELS(name, Gen, ISA, ...)                                \
+    struct name##_impl {                                                \
+        static void __attribute__((__VA_ARGS__))                        \
+        calc_wave_fixed(float *output, size_t nsteps, int nchns,        \
+                        channel_param_fixed *params)                    \
+        {                                                               \
+            _calc_wave_fixed_block<Gen>(output, nsteps, nchns, params); \
+        }                                                               \
+        static void __attribute__((__VA_ARGS__))                        \
+        calc_wave(float *output, size_t nsteps, int nchns,              \
+                  const channel_param *params, size_t param_idx)        \
+        {                                                               \
+            _calc_wave_block<Gen>(output, nsteps, nchns, params, param_idx); \
+        }                                                               \
+        template<bool nt>                                               \
+        static void __attribute__((__VA_ARGS__))                        \
+        quantize(int16_t *output, const float *input, size_t nsteps,    \
+                 float scale, int nbits, MarkerStream &markers,         \
+                 output_stats &stats, dither_state *dither)             \
+        {                                                               \
+            Gen::template quantize<nt>(output, input, nsteps, scale, nbits, \
+                                       markers, stats, dither);         \
+        }                                                               \
+        template<int N>                                                 \
+        static void __attribute__((__VA_ARGS__))                        \
+        calc_wave_fixed_spec(float *output, size_t nsteps, int,         \
+                             channel_param_fixed *params)               \
+        {                                                               \
+            _calc_wave_fixed_spec_block<Gen,N>(output, nsteps, params); \
+        }                                                               \
+        template<int N, bool has_dfreq, bool has_damp>                  \
+        static void __attribute__((__VA_ARGS__))                        \
+        calc_wave_spec(float *output, size_t nsteps, int,               \
+                       const channel_param *params, size_t param_idx)   \
+        {                                                               \
+            _calc_wave_spec_block<Gen,N,has_dfreq,has_damp>(            \
+                output, nsteps, params, param_idx);                     \
+        }                                                               \
+    };                                                                  \
+    static constexpr KernelTable name##_kernels = make_kernel_table<name##_impl>( \
+        KernelISA::ISA, std::make_integer_sequence<int,KernelTable::max_spec_chns>())
+
+DEF_KERNELS(scalar, ScalarGen, Scalar, flatten);
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+DEF_KERNELS(sse2, SSE2Gen, SSE2, target("sse2"), flatten);
+DEF_KERNELS(avx, AVXGen, AVX, target("avx"), flatten);
+DEF_KERNELS(avx2, AVX2Gen, AVX2, target("avx2,fma"), flatten);
+DEF_KERNELS(avx512, AVX512Gen, AVX512, target("avx512f,avx512dq"), flatten);
+#endif
+
+#undef DEF_KERNELS
+
+NACS_EXPORT() const KernelTable &get_kernels(KernelISA isa)
+{
+    switch (isa) {
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    case KernelISA::SSE2:
+        return sse2_kernels;
+    case KernelISA::AVX:
+        return avx_kernels;
+    case KernelISA::AVX2:
+        return avx2_kernels;
+    case KernelISA::AVX512:
+        return avx512_kernels;
+#endif
+    default:
+        return scalar_kernels;
+    }
+}
+
+NACS_EXPORT() size_t nt_store_threshold()
+{
+    static const size_t threshold = [] {
+        long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+        size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        if (size <= 0)
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        if (size <= 0)
+            return size_t(4 * 1024 * 1024);
+        return size_t(size) / 2;
+    }();
+    return threshold;
+}
+
+NACS_EXPORT() KernelTable::quantize_t KernelTable::get_quantize(size_t nbytes) const
+{
+    return nbytes > nt_store_threshold() ? quantize_nt : quantize;
+}
+
+NACS_EXPORT() const char *kernel_isa_name(KernelISA isa)
+{
+    switch (isa) {
+    case KernelISA::Scalar:
+        return "scalar";
+    case KernelISA::SSE2:
+        return "sse2";
+    case KernelISA::AVX:
+        return "avx";
+    case KernelISA::AVX2:
+        return "avx2";
+    case KernelISA::AVX512:
+        return "avx512";
+    default:
+        return "unknown";
+    }
+}
+
+NACS_EXPORT() bool kernel_isa_supported(KernelISA isa)
+{
+    if (isa == KernelISA::Scalar)
+        return true;
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    auto &host = CPUInfo::get_host();
+    switch (isa) {
+    case KernelISA::SSE2:
+        return true;
+    case KernelISA::AVX:
+        return host.test_feature(X86::Feature::avx);
+    case KernelISA::AVX2:
+        return host.test_feature(X86::Feature::avx2) && host.test_feature(X86::Feature::fma);
+    case KernelISA::AVX512:
+        return (host.test_feature(X86::Feature::avx512f) &&
+                host.test_feature(X86::Feature::avx512dq));
+    default:
+        break;
+    }
+#endif
+    return false;
+}
+
+static std::string read_cpu_model()
+{
+    std::ifstream stm("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(stm, line)) {
+        if (line.compare(0, 10, "model name") != 0)
+            continue;
+        auto pos = line.find(':');
+        if (pos == std::string::npos)
+            break;
+        pos = line.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos)
+            break;
+        return line.substr(pos);
+    }
+    return "unknown";
+}
+
+static const char *step_type_name(StepType type)
+{
+    return type == StepType::Fixed ? "fixed" : "ramp";
+}
+
+NACS_EXPORT() KernelTuner::KernelTuner(std::string cache_path)
+    : m_cache_path(std::move(cache_path)),
+      m_cpu_model(read_cpu_model())
+{
+    load_cache();
+}
+
+NACS_EXPORT() std::string KernelTuner::default_cache_path()
+{
+    if (auto path = getenv("NACS_SPCM_KERNEL_CACHE"))
+        return path;
+    if (auto dir = getenv("XDG_CACHE_HOME"))
+        return std::string(dir) + "/nacs-spcm/kernels";
+    if (auto home = getenv("HOME"))
+        return std::string(home) + "/.cache/nacs-spcm/kernels";
+    return "";
+}
+
+NACS_EXPORT() KernelTuner &KernelTuner::global()
+{
+    static KernelTuner tuner;
+    return tuner;
+}
+
+NACS_EXPORT() void KernelTuner::tune(const std::vector<int> &nchns,
+                                     const std::vector<StepType> &types)
+{
+    for (auto nchn: nchns) {
+        if (nchn <= 0) {
+            throw std::invalid_argument("Invalid channel count");
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_lock);
+    bool changed = false;
+    for (auto nchn: nchns) {
+        for (auto type: types) {
+            Key key{nchn, type};
+            if (m_results.count(key))
+                continue;
+            m_results[key] = measure(nchn, type);
+            changed = true;
+        }
+    }
+    if (changed) {
+        save_cache();
+    }
+}
+
+NACS_EXPORT() KernelISA KernelTuner::select(int nchns, StepType type)
+{
+    if (nchns <= 0)
+        throw std::invalid_argument("Invalid channel count");
+    std::lock_guard<std::mutex> lock(m_lock);
+    Key key{nchns, type};
+    auto it = m_results.find(key);
+    if (it != m_results.end())
+        return it->second;
+    auto isa = measure(nchns, type);
+    m_results[key] = isa;
+    save_cache();
+    return isa;
+}
+
+KernelISA KernelTuner::measure(int nchns, StepType type) const
+{
+    // 2048 samples per call, which fits in the L1 cache.
+    constexpr size_t nsteps = 64;
+    constexpr int nrounds = 3;
+    constexpr uint64_t round_time = 1000000;
+    float output[nsteps * step_size] __attribute__((aligned(64)));
+
+    std::minstd_rand rng;
+    std::uniform_real_distribution<float> dis(0, 2);
+    std::vector<float> values(nchns * nsteps * 5);
+    for (auto &v: values)
+        v = dis(rng);
+    std::vector<channel_param> params(nchns);
+    std::vector<channel_param_fixed> params_fixed(nchns);
+    for (int c = 0; c < nchns; c++) {
+        auto p = &values[c * nsteps * 5];
+        params[c] = {p, p + nsteps, p + nsteps * 2, p + nsteps * 3, p + nsteps * 4};
+        params_fixed[c] = {p[0], p[nsteps], p[nsteps * 3]};
+    }
+
+    double best[num_kernel_isa];
+    for (auto &t: best)
+        t = INFINITY;
+    for (int r = 0; r < nrounds; r++) {
+        for (int i = 0; i < num_kernel_isa; i++) {
+            auto isa = KernelISA(i);
+            if (!kernel_isa_supported(isa))
+                continue;
+            auto &kernels = get_kernels(isa);
+            // Time the kernels that the stream would use.
+            auto calc_wave_fixed = kernels.get_calc_wave_fixed(nchns);
+            auto calc_wave = kernels.get_calc_wave(nchns);
+            uint64_t n = 0;
+            uint64_t t;
+            auto t0 = getTime();
+            do {
+                if (type == StepType::Fixed) {
+                    calc_wave_fixed(output, nsteps, nchns, params_fixed.data());
+                }
+                else {
+                    calc_wave(output, nsteps, nchns, params.data(), 0);
+                }
+                n++;
+            } while ((t = getElapse(t0)) < round_time);
+            best[i] = std::min(best[i], double(t) / double(n));
+        }
+    }
+    int res = 0;
+    for (int i = 1; i < num_kernel_isa; i++) {
+        if (best[i] < best[res]) {
+            res = i;
+        }
+    }
+    return KernelISA(res);
+}
+
+// The cache file has one line for each result in the format
+// `<CPU model>\t<step type>\t<channel count>\t<ISA>`.
+void KernelTuner::load_cache()
+{
+    if (m_cache_path.empty())
+        return;
+    std::ifstream stm(m_cache_path);
+    std::string line;
+    while (std::getline(stm, line)) {
+        auto pos3 = line.rfind('\t');
+        auto pos2 = pos3 == std::string::npos ? pos3 : line.rfind('\t', pos3 - 1);
+        auto pos1 = pos2 == std::string::npos ? pos2 : line.rfind('\t', pos2 - 1);
+        if (pos1 == std::string::npos || pos1 == 0)
+            continue;
+        if (line.compare(0, pos1, m_cpu_model) != 0 || pos1 != m_cpu_model.size()) {
+            m_other_lines.push_back(line);
+            continue;
+        }
+        auto type_name = line.substr(pos1 + 1, pos2 - pos1 - 1);
+        StepType type;
+        if (type_name == step_type_name(StepType::Fixed)) {
+            type = StepType::Fixed;
+        }
+        else if (type_name == step_type_name(StepType::Ramp)) {
+            type = StepType::Ramp;
+        }
+        else {
+            continue;
+        }
+        int nchns = atoi(line.c_str() + pos2 + 1);
+        if (nchns <= 0)
+            continue;
+        auto isa_name = line.substr(pos3 + 1);
+        for (int i = 0; i < num_kernel_isa; i++) {
+            auto isa = KernelISA(i);
+            // Ignore the results for instruction sets we cannot use,
+            // e.g. from a VM that hides some of the CPU features.
+            if (isa_name == kernel_isa_name(isa) && kernel_isa_supported(isa)) {
+                m_results[{nchns, type}] = isa;
+                break;
+            }
+        }
+    }
+}
+
+void KernelTuner::save_cache() const
+{
+    if (m_cache_path.empty())
+        return;
+    // Create the parent directories.
+    for (auto pos = m_cache_path.find('/', 1); pos != std::string::npos;
+         pos = m_cache_path.find('/', pos + 1)) {
+        mkdir(m_cache_path.substr(0, pos).c_str(), 0755);
+    }
+    // Write to a temporary file and rename it so that
+    // other processes never see a partially written file.
+    auto tmp_path = m_cache_path + "." + std::to_string(getpid());
+    {
+        std::ofstream stm(tmp_path);
+        for (auto &line: m_other_lines)
+            stm << line << "\n";
+        for (auto &res: m_results) {
+            stm << m_cpu_model << "\t" << step_type_name(res.first.second) << "\t"
+                << res.first.first << "\t" << kernel_isa_name(res.second) << "\n";
+        }
+        if (!stm) {
+            unlink(tmp_path.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_path.c_str(), m_cache_path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+    }
+}
+
 }
 }
@@ -19,9 +19,76 @@
 #ifndef _NACS_SPCM_DATA_STREAM_H
 #define _NACS_SPCM_DATA_STREAM_H
 
+#include <nacs-utils/utils.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace NaCs {
 namespace Spcm {
 
+// Instruction sets with an implementation of the waveform generation kernels.
+enum class KernelISA : uint8_t {
+    Scalar,
+    SSE2,
+    AVX,
+    AVX2,
+    AVX512,
+};
+constexpr int num_kernel_isa = 5;
+
+const char *kernel_isa_name(KernelISA isa);
+bool kernel_isa_supported(KernelISA isa);
+
+// Whether the parameters of the channels change between the steps.
+enum class StepType : uint8_t {
+    // Constant frequency and amplitude.
+    Fixed,
+    // Linear frequency and amplitude ramps, with parameters for every step.
+    Ramp,
+};
+
+// Picks the fastest kernel for each channel count and step type.
+// Wider vectors are not always faster (e.g. the AVX512 instructions can lower the
+// clock frequency of the core enough to lose to AVX2 for small channel counts)
+// so every supported implementation is timed on this machine for a few ms,
+// alternating between the implementations to even out the frequency changes.
+// The results are cached in memory and in `cache_path` keyed by the CPU model
+// so that later runs on the same machine don't need to time the kernels again.
+// The file cache is optional and is disabled if `cache_path` is empty.
+class KernelTuner {
+public:
+    KernelTuner(std::string cache_path=default_cache_path());
+    // Time the kernels for all the combinations of the channel counts and step types
+    // that are not already cached, e.g. during startup.
+    // Both throw `std::invalid_argument` if a channel count is not positive.
+    void tune(const std::vector<int> &nchns, const std::vector<StepType> &types);
+    KernelISA select(int nchns, StepType type);
+    const std::string &cpu_model() const
+    {
+        return m_cpu_model;
+    }
+
+    // `$NACS_SPCM_KERNEL_CACHE` or `kernels` in the `nacs-spcm` user cache directory.
+    static std::string default_cache_path();
+    static KernelTuner &global();
+
+private:
+    using Key = std::pair<int,StepType>;
+    KernelISA measure(int nchns, StepType type) const;
+    void load_cache();
+    void save_cache() const;
+
+    std::mutex m_lock;
+    const std::string m_cache_path;
+    const std::string m_cpu_model;
+    std::map<Key,KernelISA> m_results;
+    // Lines of the cache file for other CPU models.
+    std::vector<std::string> m_other_lines;
+};
 
 }
 }
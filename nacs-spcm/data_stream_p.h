@@ -23,6 +23,12 @@
 
 #include <nacs-utils/utils.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
 #if NACS_CPU_X86 || NACS_CPU_X86_64
 #  include <immintrin.h>
 #elif NACS_CPU_AARCH64
@@ -39,6 +45,91 @@ constexpr int step_size = 32;
 
 }
 
+// Phase is in unit of pi
+// Frequency of 1 means one full cycle per 32 samples (i.e. per step).
+struct channel_param_fixed {
+    float phase;
+    float freq;
+    float amp;
+};
+
+// Parameters of a channel for each step.
+struct channel_param {
+    const float *phase;
+    const float *freq;
+    const float *dfreq;
+    const float *amp;
+    const float *damp;
+};
+
+// Amplitude calibration for a channel, e.g. to compensate the frequency dependent
+// diffraction efficiency and the nonlinearity of an AOD/AOM.
+// This is applied by the generator when loading the amplitude parameters
+// so that changing the calibration doesn't require rewriting the parameter arrays.
+//
+// The output amplitude is `gain(freq) * amp_curve(amp)` where
+// * `gain` is linearly interpolated from `nfreq` equally spaced points
+//   with the first one at `freq0` and `freq_scale` points per unit of frequency
+//   (same unit as the frequency parameter).
+// * `amp_curve` is linearly interpolated from `namp` equally spaced points
+//   with the first one at `0` and `amp_scale` points per unit of amplitude.
+// Input outside of the range is clamped. A table with less than `2` points is ignored.
+// Both tables are only accessed once per channel per step and they should be kept small
+// (e.g. no more than a few hundred points per channel) so that they stay in the L1 cache.
+//
+// Within a step, the calibrated amplitude is computed at the start and the end of the step
+// and interpolated linearly, just like the uncalibrated amplitude.
+struct channel_calib {
+    float freq0 = 0;
+    float freq_scale = 0;
+    int nfreq = 0;
+    const float *gain = nullptr;
+    float amp_scale = 0;
+    int namp = 0;
+    const float *amp_curve = nullptr;
+
+    // Clamp `x` to `[0, hi]` without branches.
+    static NACS_INLINE float clamp_idx(float x, float hi)
+    {
+#if NACS_CPU_X86_64
+        // GCC does not reliably if-convert the comparisons (including `std::min`/`std::max`)
+        // and the resulting branches are frequently mispredicted for random input.
+        auto v = _mm_max_ss(_mm_set_ss(x), _mm_setzero_ps());
+        return _mm_cvtss_f32(_mm_min_ss(v, _mm_set_ss(hi)));
+#else
+        x = 0 < x ? x : 0;
+        return hi < x ? hi : x;
+#endif
+    }
+    // `idx` is the position in unit of table index.
+    static NACS_INLINE float interp(const float *table, int n, float idx)
+    {
+        idx = clamp_idx(idx, float(n - 1));
+        int i = std::min(int(idx), n - 2);
+        auto r = idx - float(i);
+        return table[i] + (table[i + 1] - table[i]) * r;
+    }
+    NACS_INLINE float operator()(float freq, float amp) const
+    {
+        if (nfreq >= 2)
+            amp *= interp(gain, nfreq, (freq - freq0) * freq_scale);
+        if (namp >= 2)
+            amp = interp(amp_curve, namp, amp * amp_scale);
+        return amp;
+    }
+    // Compute the calibrated `amp` and `damp` for a step.
+    // The phase of the step is `phase + freq * t + dfreq * t^2 / 2`
+    // and the amplitude is `amp + damp * t` for `t` in `[0, 2)`
+    // so the end of the step has frequency `freq + 2 * dfreq` and amplitude `amp + 2 * damp`.
+    NACS_INLINE void apply(float freq, float dfreq, float &amp, float &damp) const
+    {
+        auto amp0 = (*this)(freq, amp);
+        auto amp1 = (*this)(freq + 2 * dfreq, amp + 2 * damp);
+        amp = amp0;
+        damp = (amp1 - amp0) * 0.5f;
+    }
+};
+
 template<typename T>
 static NACS_INLINE void accum_nonzero(T &out, T in, float s)
 {
@@ -56,6 +147,246 @@ static NACS_INLINE void accum_nonzero(T &out, T in, float s)
     out += in * s;
 }
 
+// Interpolation filter state for a channel synthesized at `1 / R` of the full sample rate.
+// For channels that only contain slowly varying or low frequency content,
+// we can compute `step_size` samples at the reduced rate (into `input`)
+// and then upsample them into `step_size * R` samples at the full rate,
+// saving a factor of `R` in the number of sine evaluations.
+//
+// The filter is a Kaiser windowed sinc with `ntaps` taps per phase.
+// It is centered on a low rate sample so the phase `0` passes the input through
+// and the upsampled output is delayed by exactly `delay` full rate samples.
+// For signals below `0.2` of the reduced sample rate the interpolation error is
+// ~1e-6 of the amplitude, well below the 16bit resolution of the output.
+//
+// The upsampling is done by expanding the input with a zero order hold
+// (i.e. repeating each low rate sample `R` times) so that the full rate output `m`
+// is `sum(coeffs[k][m % R] * held[m - k * R] for k in 0:ntaps)`.
+// With the coefficients for each tap replicated to the maximum vector width,
+// every vector of output uses the same coefficient vectors and unaligned loads of
+// the held input, which is much easier to vectorize than the usual polyphase form.
+template<int R>
+struct Upsampler {
+    static_assert(R == 2 || R == 4 || R == 8, "");
+    static constexpr int ntaps = 16;
+    static constexpr int delay = ntaps / 2 * R;
+    // History needed for the filter, rounded up to a multiple of 64 bytes
+    // so that the current block stays aligned.
+    static constexpr int nhist = ntaps * R;
+
+    Upsampler()
+    {
+        constexpr int n = ntaps * R;
+        constexpr double beta = 12;
+        // Modified Bessel function of the first kind for the Kaiser window.
+        auto i0 = [] (double x) {
+            double sum = 1;
+            double term = 1;
+            for (int k = 1; k < 50; k++) {
+                term *= (x / 2 / k) * (x / 2 / k);
+                sum += term;
+            }
+            return sum;
+        };
+        double h[n];
+        for (int j = 0; j < n; j++) {
+            double t = double(j - delay) / R;
+            double sinc = t == 0 ? 1 : std::sin(M_PI * t) / (M_PI * t);
+            double a = 2 * double(j) / n - 1;
+            h[j] = sinc * i0(beta * std::sqrt(1 - a * a)) / i0(beta);
+        }
+        // Normalize the gain of each phase to `1`.
+        for (int p = 0; p < R; p++) {
+            double sum = 0;
+            for (int k = 0; k < ntaps; k++)
+                sum += h[k * R + p];
+            for (int k = 0; k < ntaps; k++) {
+                h[k * R + p] /= sum;
+            }
+        }
+        for (int k = 0; k < ntaps; k++) {
+            for (int l = 0; l < 16; l++) {
+                coeffs[k][l] = float(h[k * R + l % R]);
+            }
+        }
+        reset();
+    }
+    void reset()
+    {
+        memset(buff, 0, sizeof(buff));
+    }
+    // Expand the `input` into the current block.
+    NACS_INLINE void hold()
+    {
+        for (int i = 0; i < step_size; i++) {
+            for (int j = 0; j < R; j++) {
+                buff[nhist + i * R + j] = input[i];
+            }
+        }
+    }
+    // Pointer to the first held sample of the current block.
+    NACS_INLINE const float *held() const
+    {
+        return &buff[nhist];
+    }
+    // Move the end of the current block to the history.
+    NACS_INLINE void shift()
+    {
+        memcpy(buff, &buff[step_size * R], nhist * sizeof(float));
+    }
+
+    float coeffs[ntaps][16] __attribute__((aligned(64)));
+    float input[step_size] __attribute__((aligned(64)));
+    float buff[nhist + step_size * R] __attribute__((aligned(64)));
+};
+
+// Marker (digital output) bits for `len` consecutive samples.
+// When the multi-purpose lines are configured (with `x0_mode` etc.) to output
+// a sample bit of a channel, the card uses the top bit(s) of each sample
+// as synchronous digital outputs and the remaining low bits as the analog sample.
+// `bits` is OR'ed into the quantized samples and should only contain the marker bits.
+struct marker_run {
+    uint32_t len;
+    uint16_t bits;
+};
+
+// Expand the run-length encoded marker bits into `step_size` samples at a time
+// for the output kernel. Samples after the end of the last run have no marker bits set.
+// Since the marker bits rarely change within a step, the buffer is only rewritten
+// when a step crosses a run boundary or the bits change.
+class MarkerStream {
+public:
+    MarkerStream(const marker_run *runs, size_t nruns)
+        : m_runs(runs),
+          m_nruns(nruns),
+          m_idx(0),
+          m_left(nruns ? runs[0].len : 0)
+    {
+        fill(0);
+        if (nruns && m_left == 0) {
+            advance();
+        }
+    }
+    // Marker bits for the next `step_size` samples.
+    NACS_INLINE const int16_t *next()
+    {
+        if (m_idx >= m_nruns) {
+            fill(0);
+            return m_bits;
+        }
+        if (likely(m_left >= step_size)) {
+            fill(int16_t(m_runs[m_idx].bits));
+            m_left -= step_size;
+            if (m_left == 0)
+                advance();
+            return m_bits;
+        }
+        // The step crosses run boundaries, fill each segment separately.
+        for (int i = 0; i < step_size;) {
+            if (m_idx >= m_nruns) {
+                for (; i < step_size; i++)
+                    m_bits[i] = 0;
+                break;
+            }
+            auto n = std::min(m_left, uint32_t(step_size - i));
+            auto bits = int16_t(m_runs[m_idx].bits);
+            for (uint32_t j = 0; j < n; j++)
+                m_bits[i + j] = bits;
+            i += int(n);
+            m_left -= n;
+            if (m_left == 0) {
+                advance();
+            }
+        }
+        m_uniform = false;
+        return m_bits;
+    }
+
+private:
+    NACS_INLINE void fill(int16_t bits)
+    {
+        if (m_uniform && m_bits[0] == bits)
+            return;
+        for (int i = 0; i < step_size; i++)
+            m_bits[i] = bits;
+        m_uniform = true;
+    }
+    void advance()
+    {
+        do {
+            m_idx++;
+        } while (m_idx < m_nruns && m_runs[m_idx].len == 0);
+        m_left = m_idx < m_nruns ? m_runs[m_idx].len : 0;
+    }
+
+    const marker_run *m_runs;
+    size_t m_nruns;
+    size_t m_idx;
+    uint32_t m_left;
+    bool m_uniform = false;
+    int16_t m_bits[step_size] __attribute__((aligned(64)));
+};
+
+// Peak magnitude and number of clipped samples of the output before saturation,
+// both in unit of the output LSB, collected by the output kernel alongside the stores.
+// The kernel only does vertical max/add into one accumulator per SIMD lane
+// and the lanes are reduced in `collect()`.
+// This should be called at least once every `2^32` samples per lane (e.g. once per block
+// of output) so that the lane counters do not overflow.
+struct output_stats {
+    float peak = 0;
+    uint64_t nclip = 0;
+
+    void reset()
+    {
+        peak = 0;
+        nclip = 0;
+        memset(peak_lanes, 0, sizeof(peak_lanes));
+        memset(clip_lanes, 0, sizeof(clip_lanes));
+    }
+    // Fold the lanes into `peak` and `nclip`.
+    void collect()
+    {
+        for (int i = 0; i < 16; i++) {
+            peak = std::max(peak, peak_lanes[i]);
+            nclip += clip_lanes[i];
+            peak_lanes[i] = 0;
+            clip_lanes[i] = 0;
+        }
+    }
+
+    float peak_lanes[16] __attribute__((aligned(64))) = {};
+    uint32_t clip_lanes[16] __attribute__((aligned(64))) = {};
+};
+
+// State of the random number generators for the optional TPDF dither in the output kernel.
+// Each sample gets the sum of two independent uniform random numbers of `1` LSB width
+// (the two 16bit halves of a 32bit xorshift output), i.e. a triangular distribution
+// within `(-1, 1)` LSB, which decorrelates the quantization error from the signal
+// and removes the spurs for tones with commensurate frequencies.
+// There's an independent generator for each sample within a step so that the kernel
+// doesn't have a serial dependency between the vectors and all implementations
+// produce the same output.
+struct dither_state {
+    dither_state(uint64_t seed=0)
+    {
+        reseed(seed);
+    }
+    void reseed(uint64_t seed)
+    {
+        // Splitmix64 to initialize the (non-zero) states.
+        for (int i = 0; i < step_size; i++) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z = z ^ (z >> 31);
+            lanes[i] = uint32_t(z) | 1;
+        }
+    }
+
+    uint32_t lanes[step_size] __attribute__((aligned(64)));
+};
+
 namespace scalar {
 
 // Calculate `sin(pi * d) / pi`
@@ -89,6 +420,37 @@ static NACS_INLINE float sinpif_pi(float d)
     return (s * d) * u + d;
 }
 
+// Calculate `sin(pi * d) / pi` and `cos(pi * d) / pi` sharing the range reduction.
+// The output is scaled the same way as `sinpif_pi` so that the cos output
+// can be used directly as the I channel of a I/Q pair.
+// For both functions, an odd `q` flips the sign of the output
+// so we can share the sign computation as well.
+static NACS_INLINE void sincospif_pi(float d, float &sinv, float &cosv)
+{
+    int q = round<int>(d);
+    d = d - (float)q;
+    auto s = d * d;
+
+    // Fit of `cos(pi * d) / pi` on [-0.5, 0.5] as a polynomial of `s`.
+    // Evaluated in single precision, the maximum error compared to `cos(pi * d) / pi`
+    // in double precision is ~7.2e-8 (~6e-8 with FMA) near the ends of the range,
+    // much smaller than the error of the sin polynomial.
+    auto c = 0.06992709f * s - 0.42394833f;
+    c = c * s + 1.2918323f;
+    c = c * s - 1.5707933f;
+    c = c * s + 0.31830987f;
+
+    if (q & 1) {
+        d = -d;
+        c = -c;
+    }
+
+    auto u = -0.17818783f * s + 0.8098674f;
+    u = u * s - 1.6448531f;
+    sinv = (s * d) * u + d;
+    cosv = c;
+}
+
 static constexpr float tidx_2[] = {
     0.0, 0.001953125, 0.0078125, 0.017578125, 0.03125, 0.048828125, 0.0703125, 0.095703125,
     0.125, 0.158203125, 0.1953125, 0.236328125, 0.28125, 0.330078125, 0.3828125, 0.439453125,
@@ -110,6 +472,96 @@ static NACS_INLINE float calc_single_chn(int i, float phase, float freq, float a
     return sinpif_pi(phase) * amp;
 }
 
+// Same as `calc_single_chn` but accumulate both the cos (I) and the sin (Q) outputs.
+static NACS_INLINE void calc_single_chn_iq(int i, float &out_i, float &out_q,
+                                           float phase, float freq, float amp,
+                                           float dfreq=0, float damp=0)
+{
+    assume(0 <= i && i < step_size);
+    auto tscale = 0.0625f * (float)i;
+    auto tscale_2 = tidx_2[i];
+    phase += tscale * freq;
+    accum_nonzero(phase, tscale_2, dfreq);
+    accum_nonzero(amp, tscale, damp);
+    float sinv, cosv;
+    sincospif_pi(phase, sinv, cosv);
+    out_i += cosv * amp;
+    out_q += sinv * amp;
+}
+
+// Add the upsampled current block of `up` to `step_size * R` samples of `output`.
+// The loop over the taps needs to be fully unrolled to get good performance
+// (in particular, for the coefficient loads to be hoisted out of the loop)
+// which GCC doesn't do by default at `-O2`.
+template<int R>
+static NACS_INLINE void upsample_accum(float *output, const Upsampler<R> &up)
+{
+    auto held = up.held();
+    for (int m = 0; m < step_size * R; m++) {
+        float o = output[m];
+#pragma GCC unroll 16
+        for (int k = 0; k < Upsampler<R>::ntaps; k++)
+            o += up.coeffs[k][m % R] * held[m - k * R];
+        output[m] = o;
+    }
+}
+
+// Advance the xorshift generator and return the TPDF dither in unit of LSB.
+static NACS_INLINE float tpdf_dither(uint32_t &state)
+{
+    auto x = state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state = x;
+    // The `+ 1` in the offset makes the distribution symmetric around `0`.
+    return float(int((x & 0xffff) + (x >> 16))) * (1.0f / 65536) + (1.0f / 65536 - 1);
+}
+
+// Convert `nsteps * step_size` samples to the 16bit output format.
+// With `nbits` marker bits, the sample is scaled by `scale`, rounded and saturated
+// to a `16 - nbits` bits signed integer and the marker bits from `markers`
+// are OR'ed in the top bits.
+// If `dither` is not `NULL`, TPDF dither is added after the scaling.
+// The peak and the clipped samples (without dither) are recorded in `stats`.
+// The statistics are kept
+// in registers within the block so the block should be reasonably long
+// (e.g. a few kB of output) to avoid a dependency chain through memory between steps.
+// With `nt`, the SIMD versions write the output with non-temporal (streaming) stores
+// that bypass the cache. This is faster when the output won't be read again
+// before it's evicted anyway (e.g. chunks larger than the cache written to the DMA ring)
+// and leaves the cache to the parameters. They end with an `sfence` to make the streaming
+// stores visible to the DMA engine before the caller hands the output to the card.
+// The scalar version always uses normal stores.
+template<bool nt=false>
+static NACS_INLINE void quantize(int16_t *output, const float *input, size_t nsteps,
+                                 float scale, int nbits, MarkerStream &markers,
+                                 output_stats &stats, dither_state *dither)
+{
+    auto hi = float((1 << (15 - nbits)) - 1);
+    auto lo = -float(1 << (15 - nbits));
+    auto mask = int(0xffff >> nbits);
+    auto peak = stats.peak_lanes[0];
+    auto nclip = stats.clip_lanes[0];
+    for (size_t n = 0; n < nsteps; n++, output += step_size, input += step_size) {
+        auto bits = markers.next();
+        for (int i = 0; i < step_size; i++) {
+            auto v = input[i] * scale;
+            auto a = std::abs(v);
+            peak = a > peak ? a : peak;
+            nclip += uint32_t((v > hi) | (v < lo));
+            if (dither)
+                v += tpdf_dither(dither->lanes[i]);
+            // Same NaN handling as the SIMD min/max.
+            v = v > lo ? v : lo;
+            v = v < hi ? v : hi;
+            output[i] = int16_t((int(std::lrint(v)) & mask) | bits[i]);
+        }
+    }
+    stats.peak_lanes[0] = peak;
+    stats.clip_lanes[0] = nclip;
+}
+
 } // namespace scalar
 
 #if NACS_CPU_X86 || NACS_CPU_X86_64
@@ -146,6 +598,29 @@ __m128 sinpif_pi(__m128 d)
     return (s * d) * u + d;
 }
 
+static NACS_INLINE __attribute__((target("sse2")))
+void sincospif_pi(__m128 d, __m128 &sinv, __m128 &cosv)
+{
+    __m128i q = _mm_cvtps_epi32(d);
+    d = d - _mm_cvtepi32_ps(q);
+
+    __m128 s = d * d;
+
+    auto c = 0.06992709f * s - 0.42394833f;
+    c = c * s + 1.2918323f;
+    c = c * s - 1.5707933f;
+    c = c * s + 0.31830987f;
+
+    auto neg = _mm_cmpeq_epi32(q & _mm_set1_epi32(1), _mm_set1_epi32(1));
+    auto sign = neg & _mm_set1_epi32(0x80000000);
+    d = __m128(sign ^ __m128i(d));
+    cosv = __m128(sign ^ __m128i(c));
+
+    auto u = -0.17818783f * s + 0.8098674f;
+    u = u * s - 1.6448531f;
+    sinv = (s * d) * u + d;
+}
+
 static constexpr __m128 tidx[] = {
     set_ps<__m128>(0.0, 0.0625, 0.125, 0.1875), set_ps<__m128>(0.25, 0.3125, 0.375, 0.4375),
     set_ps<__m128>(0.5, 0.5625, 0.625, 0.6875), set_ps<__m128>(0.75, 0.8125, 0.875, 0.9375),
@@ -179,6 +654,106 @@ __m128 calc_single_chn(int i, float _phase, float freq, float _amp,
     return sinpif_pi(phase) * amp;
 }
 
+static NACS_INLINE __attribute__((target("sse2")))
+void calc_single_chn_iq(int i, __m128 &out_i, __m128 &out_q, float _phase, float freq,
+                        float _amp, float dfreq=0, float damp=0)
+{
+    assume(0 <= i && i < step_size && i % 4 == 0);
+    auto tscale = tidx[i / 4];
+    auto tscale_2 = tidx_2[i / 4];
+    auto phase = _phase + tscale * freq;
+    accum_nonzero(phase, tscale_2, dfreq);
+    auto amp = _mm_set1_ps(_amp);
+    accum_nonzero(amp, tscale, damp);
+    __m128 sinv, cosv;
+    sincospif_pi(phase, sinv, cosv);
+    out_i += cosv * amp;
+    out_q += sinv * amp;
+}
+
+template<int R>
+static NACS_INLINE __attribute__((target("sse2")))
+void upsample_accum(float *output, const Upsampler<R> &up)
+{
+    auto held = up.held();
+    for (int m = 0; m < step_size * R; m += 4) {
+        auto o = _mm_load_ps(&output[m]);
+#pragma GCC unroll 16
+        for (int k = 0; k < Upsampler<R>::ntaps; k++)
+            o += _mm_loadu_ps(&up.coeffs[k][m % R]) * _mm_loadu_ps(&held[m - k * R]);
+        _mm_store_ps(&output[m], o);
+    }
+}
+
+static NACS_INLINE __attribute__((target("sse2")))
+__m128 tpdf_dither(__m128i &state)
+{
+    auto x = state;
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    state = x;
+    auto sum = _mm_add_epi32(_mm_and_si128(x, _mm_set1_epi32(0xffff)), _mm_srli_epi32(x, 16));
+    return _mm_cvtepi32_ps(sum) * _mm_set1_ps(1.0f / 65536) + _mm_set1_ps(1.0f / 65536 - 1);
+}
+
+template<bool nt=false>
+static NACS_INLINE __attribute__((target("sse2")))
+void quantize(int16_t *output, const float *input, size_t nsteps, float scale,
+              int nbits, MarkerStream &markers, output_stats &stats,
+              dither_state *dither)
+{
+    auto vscale = _mm_set1_ps(scale);
+    auto hi = _mm_set1_ps(float((1 << (15 - nbits)) - 1));
+    auto lo = _mm_set1_ps(-float(1 << (15 - nbits)));
+    auto mask = _mm_set1_epi16(int16_t(0xffff >> nbits));
+    auto sign = _mm_set1_ps(-0.0f);
+    auto peak = _mm_load_ps(stats.peak_lanes);
+    auto nclip = _mm_load_si128((const __m128i*)stats.clip_lanes);
+    __m128i dstate[step_size / 4];
+    for (int i = 0; i < step_size / 4; i++)
+        dstate[i] = dither ? _mm_load_si128((const __m128i*)&dither->lanes[i * 4]) :
+            _mm_setzero_si128();
+    for (size_t n = 0; n < nsteps; n++, output += step_size, input += step_size) {
+        auto bits = markers.next();
+        for (int i = 0; i < step_size; i += 8) {
+            auto v0 = _mm_load_ps(&input[i]) * vscale;
+            auto v1 = _mm_load_ps(&input[i + 4]) * vscale;
+            peak = _mm_max_ps(peak, _mm_max_ps(_mm_andnot_ps(sign, v0),
+                                               _mm_andnot_ps(sign, v1)));
+            // The comparison results are `-1` for the clipped samples.
+            nclip = _mm_sub_epi32(nclip, _mm_castps_si128(_mm_or_ps(_mm_cmpgt_ps(v0, hi),
+                                                                    _mm_cmplt_ps(v0, lo))));
+            nclip = _mm_sub_epi32(nclip, _mm_castps_si128(_mm_or_ps(_mm_cmpgt_ps(v1, hi),
+                                                                    _mm_cmplt_ps(v1, lo))));
+            if (dither) {
+                v0 = v0 + tpdf_dither(dstate[i / 4]);
+                v1 = v1 + tpdf_dither(dstate[i / 4 + 1]);
+            }
+            v0 = _mm_min_ps(_mm_max_ps(v0, lo), hi);
+            v1 = _mm_min_ps(_mm_max_ps(v1, lo), hi);
+            auto q = _mm_packs_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1));
+            q = _mm_or_si128(_mm_and_si128(q, mask),
+                             _mm_load_si128((const __m128i*)&bits[i]));
+            if (nt) {
+                _mm_stream_si128((__m128i*)&output[i], q);
+            }
+            else {
+                _mm_store_si128((__m128i*)&output[i], q);
+            }
+        }
+    }
+    if (nt)
+        _mm_sfence();
+    _mm_store_ps(stats.peak_lanes, peak);
+    _mm_store_si128((__m128i*)stats.clip_lanes, nclip);
+    if (dither) {
+        for (int i = 0; i < step_size / 4; i++) {
+            _mm_store_si128((__m128i*)&dither->lanes[i * 4], dstate[i]);
+        }
+    }
+}
+
 } // namespace sse2
 
 namespace avx {
@@ -205,6 +780,35 @@ __m256 sinpif_pi(__m256 d)
     return (s * d) * u + d;
 }
 
+static NACS_INLINE __attribute__((target("avx")))
+void sincospif_pi(__m256 d, __m256 &sinv, __m256 &cosv)
+{
+    __m256i q = _mm256_cvtps_epi32(d);
+    d = d - _mm256_cvtepi32_ps(q);
+
+    __m256 s = d * d;
+
+    auto c = 0.06992709f * s - 0.42394833f;
+    c = c * s + 1.2918323f;
+    c = c * s - 1.5707933f;
+    c = c * s + 0.31830987f;
+
+    auto tmp = q & _mm256_set1_epi32(1);
+    __m128i tmp2[2] = {_mm256_castsi256_si128(tmp),
+                       _mm256_extractf128_si256(tmp, 1)};
+    tmp2[0] = _mm_cmpeq_epi32(tmp2[0], _mm_set1_epi32(1));
+    tmp2[1] = _mm_cmpeq_epi32(tmp2[1], _mm_set1_epi32(1));
+    auto neg = _mm256_castsi128_si256(tmp2[0]);
+    neg = _mm256_insertf128_si256(neg, tmp2[1], 1);
+    auto sign = neg & _mm256_set1_epi32(0x80000000);
+    d = __m256(sign ^ __m256i(d));
+    cosv = __m256(sign ^ __m256i(c));
+
+    auto u = -0.17818783f * s + 0.8098674f;
+    u = u * s - 1.6448531f;
+    sinv = (s * d) * u + d;
+}
+
 static constexpr __m256 tidx[] = {
     set_ps<__m256>(0.0, 0.0625, 0.125, 0.1875, 0.25, 0.3125, 0.375, 0.4375),
     set_ps<__m256>(0.5, 0.5625, 0.625, 0.6875, 0.75, 0.8125, 0.875, 0.9375),
@@ -238,6 +842,97 @@ __m256 calc_single_chn(int i, float _phase, float freq, float _amp,
     return sinpif_pi(phase) * amp;
 }
 
+static NACS_INLINE __attribute__((target("avx")))
+void calc_single_chn_iq(int i, __m256 &out_i, __m256 &out_q, float _phase, float freq,
+                        float _amp, float dfreq=0, float damp=0)
+{
+    assume(0 <= i && i < step_size && i % 8 == 0);
+    auto tscale = tidx[i / 8];
+    auto tscale_2 = tidx_2[i / 8];
+    auto phase = _phase + tscale * freq;
+    accum_nonzero(phase, tscale_2, dfreq);
+    auto amp = _mm256_set1_ps(_amp);
+    accum_nonzero(amp, tscale, damp);
+    __m256 sinv, cosv;
+    sincospif_pi(phase, sinv, cosv);
+    out_i += cosv * amp;
+    out_q += sinv * amp;
+}
+
+template<int R>
+static NACS_INLINE __attribute__((target("avx")))
+void upsample_accum(float *output, const Upsampler<R> &up)
+{
+    auto held = up.held();
+    for (int m = 0; m < step_size * R; m += 8) {
+        auto o = _mm256_load_ps(&output[m]);
+#pragma GCC unroll 16
+        for (int k = 0; k < Upsampler<R>::ntaps; k++)
+            o += _mm256_loadu_ps(&up.coeffs[k][m % R]) * _mm256_loadu_ps(&held[m - k * R]);
+        _mm256_store_ps(&output[m], o);
+    }
+}
+
+template<bool nt=false>
+static NACS_INLINE __attribute__((target("avx")))
+void quantize(int16_t *output, const float *input, size_t nsteps, float scale,
+              int nbits, MarkerStream &markers, output_stats &stats,
+              dither_state *dither)
+{
+    auto vscale = _mm256_set1_ps(scale);
+    auto hi = _mm256_set1_ps(float((1 << (15 - nbits)) - 1));
+    auto lo = _mm256_set1_ps(-float(1 << (15 - nbits)));
+    auto mask = _mm_set1_epi16(int16_t(0xffff >> nbits));
+    auto sign = _mm256_set1_ps(-0.0f);
+    auto peak = _mm256_load_ps(stats.peak_lanes);
+    auto nclip0 = _mm_load_si128((const __m128i*)stats.clip_lanes);
+    auto nclip1 = _mm_load_si128((const __m128i*)&stats.clip_lanes[4]);
+    __m128i dstate[step_size / 4];
+    for (int i = 0; i < step_size / 4; i++)
+        dstate[i] = dither ? _mm_load_si128((const __m128i*)&dither->lanes[i * 4]) :
+            _mm_setzero_si128();
+    for (size_t n = 0; n < nsteps; n++, output += step_size, input += step_size) {
+        auto bits = markers.next();
+        // No 256bit integer operations without AVX2.
+        for (int i = 0; i < step_size; i += 8) {
+            auto v = _mm256_load_ps(&input[i]) * vscale;
+            peak = _mm256_max_ps(peak, _mm256_andnot_ps(sign, v));
+            auto clip = _mm256_or_ps(_mm256_cmp_ps(v, hi, _CMP_GT_OQ),
+                                     _mm256_cmp_ps(v, lo, _CMP_LT_OQ));
+            nclip0 = _mm_sub_epi32(nclip0, _mm_castps_si128(_mm256_castps256_ps128(clip)));
+            nclip1 = _mm_sub_epi32(nclip1, _mm_castps_si128(_mm256_extractf128_ps(clip, 1)));
+            if (dither) {
+                // The generator uses integer operations, which are only available
+                // for 128bit vectors.
+                auto d = _mm256_castps128_ps256(sse2::tpdf_dither(dstate[i / 4]));
+                v = v + _mm256_insertf128_ps(d, sse2::tpdf_dither(dstate[i / 4 + 1]), 1);
+            }
+            v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+            auto vi = _mm256_cvtps_epi32(v);
+            auto q = _mm_packs_epi32(_mm256_castsi256_si128(vi),
+                                     _mm256_extractf128_si256(vi, 1));
+            q = _mm_or_si128(_mm_and_si128(q, mask),
+                             _mm_load_si128((const __m128i*)&bits[i]));
+            if (nt) {
+                _mm_stream_si128((__m128i*)&output[i], q);
+            }
+            else {
+                _mm_store_si128((__m128i*)&output[i], q);
+            }
+        }
+    }
+    if (nt)
+        _mm_sfence();
+    _mm256_store_ps(stats.peak_lanes, peak);
+    _mm_store_si128((__m128i*)stats.clip_lanes, nclip0);
+    _mm_store_si128((__m128i*)&stats.clip_lanes[4], nclip1);
+    if (dither) {
+        for (int i = 0; i < step_size / 4; i++) {
+            _mm_store_si128((__m128i*)&dither->lanes[i * 4], dstate[i]);
+        }
+    }
+}
+
 } // namespace avx
 
 namespace avx2 {
@@ -258,6 +953,29 @@ __m256 sinpif_pi(__m256 d)
     return (s * d) * u + d;
 }
 
+static NACS_INLINE __attribute__((target("avx2,fma")))
+void sincospif_pi(__m256 d, __m256 &sinv, __m256 &cosv)
+{
+    __m256i q = _mm256_cvtps_epi32(d);
+    d = d - _mm256_cvtepi32_ps(q);
+
+    __m256 s = d * d;
+
+    auto c = 0.06992709f * s - 0.42394833f;
+    c = c * s + 1.2918323f;
+    c = c * s - 1.5707933f;
+    c = c * s + 0.31830987f;
+
+    auto neg = _mm256_cmpeq_epi32(q & _mm256_set1_epi32(1), _mm256_set1_epi32(1));
+    auto sign = neg & _mm256_set1_epi32(0x80000000);
+    d = __m256(sign ^ __m256i(d));
+    cosv = __m256(sign ^ __m256i(c));
+
+    auto u = -0.17818783f * s + 0.8098674f;
+    u = u * s - 1.6448531f;
+    sinv = (s * d) * u + d;
+}
+
 static constexpr __m256 tidx[] = {
     set_ps<__m256>(0.0, 0.0625, 0.125, 0.1875, 0.25, 0.3125, 0.375, 0.4375),
     set_ps<__m256>(0.5, 0.5625, 0.625, 0.6875, 0.75, 0.8125, 0.875, 0.9375),
@@ -291,6 +1009,111 @@ __m256 calc_single_chn(int i, float _phase, float freq, float _amp,
     return sinpif_pi(phase) * amp;
 }
 
+static NACS_INLINE __attribute__((target("avx2,fma")))
+void calc_single_chn_iq(int i, __m256 &out_i, __m256 &out_q, float _phase, float freq,
+                        float _amp, float dfreq=0, float damp=0)
+{
+    assume(0 <= i && i < step_size && i % 8 == 0);
+    auto tscale = tidx[i / 8];
+    auto tscale_2 = tidx_2[i / 8];
+    auto phase = _phase + tscale * freq;
+    accum_nonzero(phase, tscale_2, dfreq);
+    auto amp = _mm256_set1_ps(_amp);
+    accum_nonzero(amp, tscale, damp);
+    __m256 sinv, cosv;
+    sincospif_pi(phase, sinv, cosv);
+    out_i += cosv * amp;
+    out_q += sinv * amp;
+}
+
+template<int R>
+static NACS_INLINE __attribute__((target("avx2,fma")))
+void upsample_accum(float *output, const Upsampler<R> &up)
+{
+    auto held = up.held();
+    for (int m = 0; m < step_size * R; m += 8) {
+        auto o = _mm256_load_ps(&output[m]);
+#pragma GCC unroll 16
+        for (int k = 0; k < Upsampler<R>::ntaps; k++)
+            o += _mm256_loadu_ps(&up.coeffs[k][m % R]) * _mm256_loadu_ps(&held[m - k * R]);
+        _mm256_store_ps(&output[m], o);
+    }
+}
+
+static NACS_INLINE __attribute__((target("avx2,fma")))
+__m256 tpdf_dither(__m256i &state)
+{
+    auto x = state;
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    state = x;
+    auto sum = _mm256_add_epi32(_mm256_and_si256(x, _mm256_set1_epi32(0xffff)),
+                                _mm256_srli_epi32(x, 16));
+    return (_mm256_cvtepi32_ps(sum) * _mm256_set1_ps(1.0f / 65536) +
+            _mm256_set1_ps(1.0f / 65536 - 1));
+}
+
+template<bool nt=false>
+static NACS_INLINE __attribute__((target("avx2,fma")))
+void quantize(int16_t *output, const float *input, size_t nsteps, float scale,
+              int nbits, MarkerStream &markers, output_stats &stats,
+              dither_state *dither)
+{
+    auto vscale = _mm256_set1_ps(scale);
+    auto hi = _mm256_set1_ps(float((1 << (15 - nbits)) - 1));
+    auto lo = _mm256_set1_ps(-float(1 << (15 - nbits)));
+    auto mask = _mm256_set1_epi16(int16_t(0xffff >> nbits));
+    auto sign = _mm256_set1_ps(-0.0f);
+    auto peak = _mm256_load_ps(stats.peak_lanes);
+    auto nclip = _mm256_load_si256((const __m256i*)stats.clip_lanes);
+    __m256i dstate[step_size / 8];
+    for (int i = 0; i < step_size / 8; i++)
+        dstate[i] = dither ? _mm256_load_si256((const __m256i*)&dither->lanes[i * 8]) :
+            _mm256_setzero_si256();
+    for (size_t n = 0; n < nsteps; n++, output += step_size, input += step_size) {
+        auto bits = markers.next();
+        for (int i = 0; i < step_size; i += 16) {
+            auto v0 = _mm256_load_ps(&input[i]) * vscale;
+            auto v1 = _mm256_load_ps(&input[i + 8]) * vscale;
+            peak = _mm256_max_ps(peak, _mm256_max_ps(_mm256_andnot_ps(sign, v0),
+                                                     _mm256_andnot_ps(sign, v1)));
+            auto clip0 = _mm256_or_ps(_mm256_cmp_ps(v0, hi, _CMP_GT_OQ),
+                                      _mm256_cmp_ps(v0, lo, _CMP_LT_OQ));
+            auto clip1 = _mm256_or_ps(_mm256_cmp_ps(v1, hi, _CMP_GT_OQ),
+                                      _mm256_cmp_ps(v1, lo, _CMP_LT_OQ));
+            nclip = _mm256_sub_epi32(nclip, _mm256_castps_si256(clip0));
+            nclip = _mm256_sub_epi32(nclip, _mm256_castps_si256(clip1));
+            if (dither) {
+                v0 = v0 + tpdf_dither(dstate[i / 8]);
+                v1 = v1 + tpdf_dither(dstate[i / 8 + 1]);
+            }
+            v0 = _mm256_min_ps(_mm256_max_ps(v0, lo), hi);
+            v1 = _mm256_min_ps(_mm256_max_ps(v1, lo), hi);
+            // The pack works within each 128bit lane.
+            auto q = _mm256_packs_epi32(_mm256_cvtps_epi32(v0), _mm256_cvtps_epi32(v1));
+            q = _mm256_permute4x64_epi64(q, 0xd8);
+            q = _mm256_or_si256(_mm256_and_si256(q, mask),
+                                _mm256_load_si256((const __m256i*)&bits[i]));
+            if (nt) {
+                _mm256_stream_si256((__m256i*)&output[i], q);
+            }
+            else {
+                _mm256_store_si256((__m256i*)&output[i], q);
+            }
+        }
+    }
+    if (nt)
+        _mm_sfence();
+    _mm256_store_ps(stats.peak_lanes, peak);
+    _mm256_store_si256((__m256i*)stats.clip_lanes, nclip);
+    if (dither) {
+        for (int i = 0; i < step_size / 8; i++) {
+            _mm256_store_si256((__m256i*)&dither->lanes[i * 8], dstate[i]);
+        }
+    }
+}
+
 } // namespace avx2
 
 namespace avx512 {
@@ -312,6 +1135,30 @@ __m512 sinpif_pi(__m512 d)
     return (s * d) * u + d;
 }
 
+static NACS_INLINE __attribute__((target("avx512f,avx512dq")))
+void sincospif_pi(__m512 d, __m512 &sinv, __m512 &cosv)
+{
+    __m512i q = _mm512_cvtps_epi32(d);
+    d = d - _mm512_cvtepi32_ps(q);
+
+    __m512 s = d * d;
+
+    auto c = 0.06992709f * s - 0.42394833f;
+    c = c * s + 1.2918323f;
+    c = c * s - 1.5707933f;
+    c = c * s + 0.31830987f;
+
+    auto neg = _mm512_test_epi32_mask(q, _mm512_set1_epi32(1));
+    d = (__m512)_mm512_mask_xor_epi32((__m512i)d, neg, (__m512i)d,
+                                      _mm512_set1_epi32(0x80000000));
+    cosv = (__m512)_mm512_mask_xor_epi32((__m512i)c, neg, (__m512i)c,
+                                         _mm512_set1_epi32(0x80000000));
+
+    auto u = -0.17818783f * s + 0.8098674f;
+    u = u * s - 1.6448531f;
+    sinv = (s * d) * u + d;
+}
+
 static constexpr __m512 tidx[] = {
     set_ps<__m512>(0.0, 0.0625, 0.125, 0.1875, 0.25, 0.3125, 0.375, 0.4375,
                    0.5, 0.5625, 0.625, 0.6875, 0.75, 0.8125, 0.875, 0.9375),
@@ -345,9 +1192,1022 @@ __m512 calc_single_chn(int i, float _phase, float freq, float _amp,
     return sinpif_pi(phase) * amp;
 }
 
+static NACS_INLINE __attribute__((target("avx512f,avx512dq")))
+void calc_single_chn_iq(int i, __m512 &out_i, __m512 &out_q, float _phase, float freq,
+                        float _amp, float dfreq=0, float damp=0)
+{
+    assume(0 <= i && i < step_size && i % 16 == 0);
+    auto tscale = tidx[i / 16];
+    auto tscale_2 = tidx_2[i / 16];
+    auto phase = _phase + tscale * freq;
+    accum_nonzero(phase, tscale_2, dfreq);
+    auto amp = _mm512_set1_ps(_amp);
+    accum_nonzero(amp, tscale, damp);
+    __m512 sinv, cosv;
+    sincospif_pi(phase, sinv, cosv);
+    out_i += cosv * amp;
+    out_q += sinv * amp;
+}
+
+template<int R>
+static NACS_INLINE __attribute__((target("avx512f,avx512dq")))
+void upsample_accum(float *output, const Upsampler<R> &up)
+{
+    auto held = up.held();
+    for (int m = 0; m < step_size * R; m += 16) {
+        auto o = _mm512_load_ps(&output[m]);
+#pragma GCC unroll 16
+        for (int k = 0; k < Upsampler<R>::ntaps; k++)
+            o += _mm512_loadu_ps(&up.coeffs[k][m % R]) * _mm512_loadu_ps(&held[m - k * R]);
+        _mm512_store_ps(&output[m], o);
+    }
+}
+
+static NACS_INLINE __attribute__((target("avx512f,avx512dq")))
+__m512 tpdf_dither(__m512i &state)
+{
+    auto x = state;
+    x = _mm512_xor_si512(x, _mm512_slli_epi32(x, 13));
+    x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 17));
+    x = _mm512_xor_si512(x, _mm512_slli_epi32(x, 5));
+    state = x;
+    auto sum = _mm512_add_epi32(_mm512_and_si512(x, _mm512_set1_epi32(0xffff)),
+                                _mm512_srli_epi32(x, 16));
+    return (_mm512_cvtepi32_ps(sum) * _mm512_set1_ps(1.0f / 65536) +
+            _mm512_set1_ps(1.0f / 65536 - 1));
+}
+
+template<bool nt=false>
+static NACS_INLINE __attribute__((target("avx512f,avx512dq")))
+void quantize(int16_t *output, const float *input, size_t nsteps, float scale,
+              int nbits, MarkerStream &markers, output_stats &stats,
+              dither_state *dither)
+{
+    static_assert(step_size == 32, "");
+    auto vscale = _mm512_set1_ps(scale);
+    auto hi = _mm512_set1_ps(float((1 << (15 - nbits)) - 1));
+    auto lo = _mm512_set1_ps(-float(1 << (15 - nbits)));
+    auto mask = _mm512_set1_epi32(int(0xffff >> nbits) * 0x10001);
+    auto one = _mm512_set1_epi32(1);
+    auto peak = _mm512_load_ps(stats.peak_lanes);
+    auto nclip = _mm512_load_si512(stats.clip_lanes);
+    __m512i dstate[2];
+    for (int i = 0; i < 2; i++)
+        dstate[i] = dither ? _mm512_load_si512(&dither->lanes[i * 16]) :
+            _mm512_setzero_si512();
+    for (size_t n = 0; n < nsteps; n++, output += step_size, input += step_size) {
+        auto bits = markers.next();
+        auto v0 = _mm512_load_ps(&input[0]) * vscale;
+        auto v1 = _mm512_load_ps(&input[16]) * vscale;
+        peak = _mm512_max_ps(peak, _mm512_max_ps(_mm512_abs_ps(v0), _mm512_abs_ps(v1)));
+        auto clip0 = __mmask16(_mm512_cmp_ps_mask(v0, hi, _CMP_GT_OQ) |
+                                _mm512_cmp_ps_mask(v0, lo, _CMP_LT_OQ));
+        auto clip1 = __mmask16(_mm512_cmp_ps_mask(v1, hi, _CMP_GT_OQ) |
+                                _mm512_cmp_ps_mask(v1, lo, _CMP_LT_OQ));
+        nclip = _mm512_mask_add_epi32(nclip, clip0, nclip, one);
+        nclip = _mm512_mask_add_epi32(nclip, clip1, nclip, one);
+        if (dither) {
+            v0 = v0 + tpdf_dither(dstate[0]);
+            v1 = v1 + tpdf_dither(dstate[1]);
+        }
+        v0 = _mm512_min_ps(_mm512_max_ps(v0, lo), hi);
+        v1 = _mm512_min_ps(_mm512_max_ps(v1, lo), hi);
+        auto q = _mm512_castsi256_si512(_mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(v0)));
+        q = _mm512_inserti64x4(q, _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(v1)), 1);
+        q = _mm512_or_si512(_mm512_and_si512(q, mask), _mm512_load_si512(bits));
+        if (nt) {
+            _mm512_stream_si512((__m512i*)output, q);
+        }
+        else {
+            _mm512_store_si512(output, q);
+        }
+    }
+    if (nt)
+        _mm_sfence();
+    _mm512_store_ps(stats.peak_lanes, peak);
+    _mm512_store_si512(stats.clip_lanes, nclip);
+    if (dither) {
+        for (int i = 0; i < 2; i++) {
+            _mm512_store_si512(&dither->lanes[i * 16], dstate[i]);
+        }
+    }
+}
+
 } // namespace avx512
 #endif
 
+#define OUT_ATTR __restrict__ __attribute__((aligned(64)))
+#define PARAM_ATTR __restrict__
+
+// The generators wrap the kernels for each instruction set with a common interface
+// so that the code using them can be written as templates on the implementation.
+// Since the functions with target attributes cannot be inlined into ones without them,
+// the caller needs to be compiled for the same target (e.g. with `flatten`)
+// for the kernels to be inlined.
+struct ScalarGen {
+    static NACS_INLINE void calc_wave_fixed(float *OUT_ATTR output, int nchns,
+                                            const channel_param_fixed *PARAM_ATTR params)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i++) {
+            float o = 0;
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += scalar::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            output[i] = o;
+        }
+    }
+    static NACS_INLINE void calc_wave(float *OUT_ATTR output, int nchns,
+                                      const channel_param *PARAM_ATTR params,
+                                      size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i++) {
+            float o = 0;
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += scalar::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                             p.amp[param_idx], p.dfreq[param_idx],
+                                             p.damp[param_idx]);
+            }
+            output[i] = o;
+        }
+    }
+    // Same as `calc_wave_fixed` and `calc_wave` with the channel loop fully unrolled
+    // for `N` channels and the terms for the zero `dfreq` and `damp` removed.
+    template<int N>
+    static NACS_INLINE void calc_wave_fixed_spec(float *OUT_ATTR output,
+                                                 const channel_param_fixed *PARAM_ATTR params)
+    {
+        for (int i = 0; i < step_size; i++) {
+            float o = 0;
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += scalar::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            output[i] = o;
+        }
+    }
+    template<int N, bool has_dfreq, bool has_damp>
+    static NACS_INLINE void calc_wave_spec(float *OUT_ATTR output,
+                                           const channel_param *PARAM_ATTR params,
+                                           size_t param_idx)
+    {
+        for (int i = 0; i < step_size; i++) {
+            float o = 0;
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += scalar::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                             p.amp[param_idx],
+                                             has_dfreq ? p.dfreq[param_idx] : 0,
+                                             has_damp ? p.damp[param_idx] : 0);
+            }
+            output[i] = o;
+        }
+    }
+    static NACS_INLINE void calc_wave_iq(float *OUT_ATTR output_i, float *OUT_ATTR output_q,
+                                         int nchns, const channel_param *PARAM_ATTR params,
+                                         size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i++) {
+            float oi = 0;
+            float oq = 0;
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                scalar::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx], p.dfreq[param_idx],
+                                           p.damp[param_idx]);
+            }
+            output_i[i] = oi;
+            output_q[i] = oq;
+        }
+    }
+    static NACS_INLINE void calc_wave_iq_interleave(float *OUT_ATTR output, int nchns,
+                                                    const channel_param *PARAM_ATTR params,
+                                                    size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i++) {
+            float oi = 0;
+            float oq = 0;
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                scalar::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx], p.dfreq[param_idx],
+                                           p.damp[param_idx]);
+            }
+            output[i * 2] = oi;
+            output[i * 2 + 1] = oq;
+        }
+    }
+    static NACS_INLINE void calc_wave_calib(float *OUT_ATTR output, int nchns,
+                                            const channel_param *PARAM_ATTR params,
+                                            size_t param_idx,
+                                            const channel_calib *PARAM_ATTR calib)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i++)
+            output[i] = 0;
+        // Loop over the channels first so that the calibration is only computed once.
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto freq = p.freq[param_idx];
+            auto dfreq = p.dfreq[param_idx];
+            auto amp = p.amp[param_idx];
+            auto damp = p.damp[param_idx];
+            calib[c].apply(freq, dfreq, amp, damp);
+            for (int i = 0; i < step_size; i++) {
+                output[i] += scalar::calc_single_chn(i, p.phase[param_idx], freq, amp,
+                                                     dfreq, damp);
+            }
+        }
+    }
+    template<bool nt=false>
+    static NACS_INLINE void quantize(int16_t *OUT_ATTR output, const float *OUT_ATTR input,
+                                     size_t nsteps, float scale, int nbits,
+                                     MarkerStream &markers, output_stats &stats,
+                                     dither_state *dither)
+    {
+        scalar::quantize<nt>(output, input, nsteps, scale, nbits, markers, stats, dither);
+    }
+    template<int R>
+    static NACS_INLINE void accum_wave_lowrate(float *OUT_ATTR output, int nchns,
+                                               const channel_param *PARAM_ATTR params,
+                                               size_t param_idx, Upsampler<R> &up)
+    {
+        calc_wave(up.input, nchns, params, param_idx);
+        up.hold();
+        scalar::upsample_accum(output, up);
+        up.shift();
+    }
+};
+
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+struct SSE2Gen {
+    static inline __attribute__((target("sse2")))
+    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
+                         const channel_param_fixed *PARAM_ATTR params)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 4) {
+            auto o = _mm_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += sse2::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("sse2")))
+    void calc_wave(float *OUT_ATTR output, int nchns,
+                   const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 4) {
+            auto o = _mm_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += sse2::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx], p.dfreq[param_idx],
+                                           p.damp[param_idx]);
+            }
+            _mm_store_ps(&output[i], o);
+        }
+    }
+    // Same as `calc_wave_fixed` and `calc_wave` with the channel loop fully unrolled
+    // for `N` channels and the terms for the zero `dfreq` and `damp` removed.
+    template<int N>
+    static inline __attribute__((target("sse2")))
+    void calc_wave_fixed_spec(float *OUT_ATTR output,
+                              const channel_param_fixed *PARAM_ATTR params)
+    {
+        for (int i = 0; i < step_size; i += 4) {
+            auto o = _mm_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += sse2::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm_store_ps(&output[i], o);
+        }
+    }
+    template<int N, bool has_dfreq, bool has_damp>
+    static inline __attribute__((target("sse2")))
+    void calc_wave_spec(float *OUT_ATTR output, const channel_param *PARAM_ATTR params,
+                        size_t param_idx)
+    {
+        for (int i = 0; i < step_size; i += 4) {
+            auto o = _mm_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += sse2::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx],
+                                           has_dfreq ? p.dfreq[param_idx] : 0,
+                                           has_damp ? p.damp[param_idx] : 0);
+            }
+            _mm_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("sse2")))
+    void calc_wave_iq(float *OUT_ATTR output_i, float *OUT_ATTR output_q, int nchns,
+                      const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 4) {
+            auto oi = _mm_set1_ps(0);
+            auto oq = _mm_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                sse2::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                         p.amp[param_idx], p.dfreq[param_idx],
+                                         p.damp[param_idx]);
+            }
+            _mm_store_ps(&output_i[i], oi);
+            _mm_store_ps(&output_q[i], oq);
+        }
+    }
+    static inline __attribute__((target("sse2")))
+    void calc_wave_iq_interleave(float *OUT_ATTR output, int nchns,
+                                 const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 4) {
+            auto oi = _mm_set1_ps(0);
+            auto oq = _mm_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                sse2::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                         p.amp[param_idx], p.dfreq[param_idx],
+                                         p.damp[param_idx]);
+            }
+            _mm_store_ps(&output[i * 2], _mm_unpacklo_ps(oi, oq));
+            _mm_store_ps(&output[i * 2 + 4], _mm_unpackhi_ps(oi, oq));
+        }
+    }
+    // Same as `calc_wave` but with the amplitude calibration applied.
+    // The calibration is computed once per channel and the outputs for the whole step
+    // are accumulated in registers.
+    static inline __attribute__((target("sse2")))
+    void calc_wave_calib(float *OUT_ATTR output, int nchns,
+                         const channel_param *PARAM_ATTR params, size_t param_idx,
+                         const channel_calib *PARAM_ATTR calib)
+    {
+        assume(nchns > 0);
+        __m128 o[step_size / 4];
+        for (int i = 0; i < step_size / 4; i++)
+            o[i] = _mm_set1_ps(0);
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto freq = p.freq[param_idx];
+            auto dfreq = p.dfreq[param_idx];
+            auto amp = p.amp[param_idx];
+            auto damp = p.damp[param_idx];
+            calib[c].apply(freq, dfreq, amp, damp);
+            for (int i = 0; i < step_size; i += 4) {
+                o[i / 4] += sse2::calc_single_chn(i, p.phase[param_idx], freq, amp,
+                                                  dfreq, damp);
+            }
+        }
+        for (int i = 0; i < step_size; i += 4) {
+            _mm_store_ps(&output[i], o[i / 4]);
+        }
+    }
+    template<bool nt=false>
+    static inline __attribute__((target("sse2")))
+    void quantize(int16_t *OUT_ATTR output, const float *OUT_ATTR input, size_t nsteps,
+                  float scale, int nbits, MarkerStream &markers, output_stats &stats,
+                  dither_state *dither)
+    {
+        sse2::quantize<nt>(output, input, nsteps, scale, nbits, markers, stats, dither);
+    }
+    // Compute `step_size` samples at `1 / R` of the full rate and add the upsampled
+    // `step_size * R` samples to `output`.
+    template<int R>
+    static inline __attribute__((target("sse2")))
+    void accum_wave_lowrate(float *OUT_ATTR output, int nchns,
+                            const channel_param *PARAM_ATTR params, size_t param_idx,
+                            Upsampler<R> &up)
+    {
+        calc_wave(up.input, nchns, params, param_idx);
+        up.hold();
+        sse2::upsample_accum(output, up);
+        up.shift();
+    }
+};
+
+struct AVXGen {
+    static inline __attribute__((target("avx")))
+    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
+                         const channel_param_fixed *PARAM_ATTR params)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += avx::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("avx")))
+    void calc_wave(float *OUT_ATTR output, int nchns,
+                   const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += avx::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                          p.amp[param_idx], p.dfreq[param_idx],
+                                          p.damp[param_idx]);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    // Same as `calc_wave_fixed` and `calc_wave` with the channel loop fully unrolled
+    // for `N` channels and the terms for the zero `dfreq` and `damp` removed.
+    template<int N>
+    static inline __attribute__((target("avx")))
+    void calc_wave_fixed_spec(float *OUT_ATTR output,
+                              const channel_param_fixed *PARAM_ATTR params)
+    {
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += avx::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    template<int N, bool has_dfreq, bool has_damp>
+    static inline __attribute__((target("avx")))
+    void calc_wave_spec(float *OUT_ATTR output, const channel_param *PARAM_ATTR params,
+                        size_t param_idx)
+    {
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += avx::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                          p.amp[param_idx],
+                                          has_dfreq ? p.dfreq[param_idx] : 0,
+                                          has_damp ? p.damp[param_idx] : 0);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("avx")))
+    void calc_wave_iq(float *OUT_ATTR output_i, float *OUT_ATTR output_q, int nchns,
+                      const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto oi = _mm256_set1_ps(0);
+            auto oq = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                avx::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                        p.amp[param_idx], p.dfreq[param_idx],
+                                        p.damp[param_idx]);
+            }
+            _mm256_store_ps(&output_i[i], oi);
+            _mm256_store_ps(&output_q[i], oq);
+        }
+    }
+    static inline __attribute__((target("avx")))
+    void calc_wave_iq_interleave(float *OUT_ATTR output, int nchns,
+                                 const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto oi = _mm256_set1_ps(0);
+            auto oq = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                avx::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                        p.amp[param_idx], p.dfreq[param_idx],
+                                        p.damp[param_idx]);
+            }
+            // The unpack instructions work within each 128bit lane
+            // so we need to shuffle the lanes to put them in the right order.
+            auto lo = _mm256_unpacklo_ps(oi, oq);
+            auto hi = _mm256_unpackhi_ps(oi, oq);
+            _mm256_store_ps(&output[i * 2], _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_store_ps(&output[i * 2 + 8], _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+    }
+    // Same as `calc_wave` but with the amplitude calibration applied.
+    // The calibration is computed once per channel and the outputs for the whole step
+    // are accumulated in registers.
+    static inline __attribute__((target("avx")))
+    void calc_wave_calib(float *OUT_ATTR output, int nchns,
+                         const channel_param *PARAM_ATTR params, size_t param_idx,
+                         const channel_calib *PARAM_ATTR calib)
+    {
+        assume(nchns > 0);
+        __m256 o[step_size / 8];
+        for (int i = 0; i < step_size / 8; i++)
+            o[i] = _mm256_set1_ps(0);
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto freq = p.freq[param_idx];
+            auto dfreq = p.dfreq[param_idx];
+            auto amp = p.amp[param_idx];
+            auto damp = p.damp[param_idx];
+            calib[c].apply(freq, dfreq, amp, damp);
+            for (int i = 0; i < step_size; i += 8) {
+                o[i / 8] += avx::calc_single_chn(i, p.phase[param_idx], freq, amp,
+                                                 dfreq, damp);
+            }
+        }
+        for (int i = 0; i < step_size; i += 8) {
+            _mm256_store_ps(&output[i], o[i / 8]);
+        }
+    }
+    template<bool nt=false>
+    static inline __attribute__((target("avx")))
+    void quantize(int16_t *OUT_ATTR output, const float *OUT_ATTR input, size_t nsteps,
+                  float scale, int nbits, MarkerStream &markers, output_stats &stats,
+                  dither_state *dither)
+    {
+        avx::quantize<nt>(output, input, nsteps, scale, nbits, markers, stats, dither);
+    }
+    // Compute `step_size` samples at `1 / R` of the full rate and add the upsampled
+    // `step_size * R` samples to `output`.
+    template<int R>
+    static inline __attribute__((target("avx")))
+    void accum_wave_lowrate(float *OUT_ATTR output, int nchns,
+                            const channel_param *PARAM_ATTR params, size_t param_idx,
+                            Upsampler<R> &up)
+    {
+        calc_wave(up.input, nchns, params, param_idx);
+        up.hold();
+        avx::upsample_accum(output, up);
+        up.shift();
+    }
+};
+
+struct AVX2Gen {
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
+                         const channel_param_fixed *PARAM_ATTR params)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += avx2::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave(float *OUT_ATTR output, int nchns,
+                   const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += avx2::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx], p.dfreq[param_idx],
+                                           p.damp[param_idx]);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    // Same as `calc_wave_fixed` and `calc_wave` with the channel loop fully unrolled
+    // for `N` channels and the terms for the zero `dfreq` and `damp` removed.
+    template<int N>
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave_fixed_spec(float *OUT_ATTR output,
+                              const channel_param_fixed *PARAM_ATTR params)
+    {
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += avx2::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    template<int N, bool has_dfreq, bool has_damp>
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave_spec(float *OUT_ATTR output, const channel_param *PARAM_ATTR params,
+                        size_t param_idx)
+    {
+        for (int i = 0; i < step_size; i += 8) {
+            auto o = _mm256_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += avx2::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx],
+                                           has_dfreq ? p.dfreq[param_idx] : 0,
+                                           has_damp ? p.damp[param_idx] : 0);
+            }
+            _mm256_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave_iq(float *OUT_ATTR output_i, float *OUT_ATTR output_q, int nchns,
+                      const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto oi = _mm256_set1_ps(0);
+            auto oq = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                avx2::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                         p.amp[param_idx], p.dfreq[param_idx],
+                                         p.damp[param_idx]);
+            }
+            _mm256_store_ps(&output_i[i], oi);
+            _mm256_store_ps(&output_q[i], oq);
+        }
+    }
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave_iq_interleave(float *OUT_ATTR output, int nchns,
+                                 const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 8) {
+            auto oi = _mm256_set1_ps(0);
+            auto oq = _mm256_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                avx2::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                         p.amp[param_idx], p.dfreq[param_idx],
+                                         p.damp[param_idx]);
+            }
+            // The unpack instructions work within each 128bit lane
+            // so we need to shuffle the lanes to put them in the right order.
+            auto lo = _mm256_unpacklo_ps(oi, oq);
+            auto hi = _mm256_unpackhi_ps(oi, oq);
+            _mm256_store_ps(&output[i * 2], _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_store_ps(&output[i * 2 + 8], _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+    }
+    // Same as `calc_wave` but with the amplitude calibration applied.
+    // The calibration is computed once per channel and the outputs for the whole step
+    // are accumulated in registers.
+    static inline __attribute__((target("avx2,fma")))
+    void calc_wave_calib(float *OUT_ATTR output, int nchns,
+                         const channel_param *PARAM_ATTR params, size_t param_idx,
+                         const channel_calib *PARAM_ATTR calib)
+    {
+        assume(nchns > 0);
+        __m256 o[step_size / 8];
+        for (int i = 0; i < step_size / 8; i++)
+            o[i] = _mm256_set1_ps(0);
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto freq = p.freq[param_idx];
+            auto dfreq = p.dfreq[param_idx];
+            auto amp = p.amp[param_idx];
+            auto damp = p.damp[param_idx];
+            calib[c].apply(freq, dfreq, amp, damp);
+            for (int i = 0; i < step_size; i += 8) {
+                o[i / 8] += avx2::calc_single_chn(i, p.phase[param_idx], freq, amp,
+                                                  dfreq, damp);
+            }
+        }
+        for (int i = 0; i < step_size; i += 8) {
+            _mm256_store_ps(&output[i], o[i / 8]);
+        }
+    }
+    template<bool nt=false>
+    static inline __attribute__((target("avx2,fma")))
+    void quantize(int16_t *OUT_ATTR output, const float *OUT_ATTR input, size_t nsteps,
+                  float scale, int nbits, MarkerStream &markers, output_stats &stats,
+                  dither_state *dither)
+    {
+        avx2::quantize<nt>(output, input, nsteps, scale, nbits, markers, stats, dither);
+    }
+    // Compute `step_size` samples at `1 / R` of the full rate and add the upsampled
+    // `step_size * R` samples to `output`.
+    template<int R>
+    static inline __attribute__((target("avx2,fma")))
+    void accum_wave_lowrate(float *OUT_ATTR output, int nchns,
+                            const channel_param *PARAM_ATTR params, size_t param_idx,
+                            Upsampler<R> &up)
+    {
+        calc_wave(up.input, nchns, params, param_idx);
+        up.hold();
+        avx2::upsample_accum(output, up);
+        up.shift();
+    }
+};
+
+struct AVX512Gen {
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
+                         const channel_param_fixed *PARAM_ATTR params)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 16) {
+            auto o = _mm512_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += avx512::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm512_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave(float *OUT_ATTR output, int nchns,
+                   const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 16) {
+            auto o = _mm512_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                o += avx512::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                             p.amp[param_idx], p.dfreq[param_idx],
+                                             p.damp[param_idx]);
+            }
+            _mm512_store_ps(&output[i], o);
+        }
+    }
+    // Same as `calc_wave_fixed` and `calc_wave` with the channel loop fully unrolled
+    // for `N` channels and the terms for the zero `dfreq` and `damp` removed.
+    template<int N>
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave_fixed_spec(float *OUT_ATTR output,
+                              const channel_param_fixed *PARAM_ATTR params)
+    {
+        for (int i = 0; i < step_size; i += 16) {
+            auto o = _mm512_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += avx512::calc_single_chn(i, p.phase, p.freq, p.amp);
+            }
+            _mm512_store_ps(&output[i], o);
+        }
+    }
+    template<int N, bool has_dfreq, bool has_damp>
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave_spec(float *OUT_ATTR output, const channel_param *PARAM_ATTR params,
+                        size_t param_idx)
+    {
+        for (int i = 0; i < step_size; i += 16) {
+            auto o = _mm512_set1_ps(0);
+#pragma GCC unroll 16
+            for (int c = 0; c < N; c++) {
+                auto p = params[c];
+                o += avx512::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
+                                             p.amp[param_idx],
+                                             has_dfreq ? p.dfreq[param_idx] : 0,
+                                             has_damp ? p.damp[param_idx] : 0);
+            }
+            _mm512_store_ps(&output[i], o);
+        }
+    }
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave_iq(float *OUT_ATTR output_i, float *OUT_ATTR output_q, int nchns,
+                      const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 16) {
+            auto oi = _mm512_set1_ps(0);
+            auto oq = _mm512_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                avx512::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx], p.dfreq[param_idx],
+                                           p.damp[param_idx]);
+            }
+            _mm512_store_ps(&output_i[i], oi);
+            _mm512_store_ps(&output_q[i], oq);
+        }
+    }
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave_iq_interleave(float *OUT_ATTR output, int nchns,
+                                 const channel_param *PARAM_ATTR params, size_t param_idx)
+    {
+        assume(nchns > 0);
+        for (int i = 0; i < step_size; i += 16) {
+            auto oi = _mm512_set1_ps(0);
+            auto oq = _mm512_set1_ps(0);
+            for (int c = 0; c < nchns; c++) {
+                auto p = params[c];
+                avx512::calc_single_chn_iq(i, oi, oq, p.phase[param_idx], p.freq[param_idx],
+                                           p.amp[param_idx], p.dfreq[param_idx],
+                                           p.damp[param_idx]);
+            }
+            // The unpack instructions work within each 128bit lane
+            // so we need to shuffle the lanes to put them in the right order.
+            auto lo = _mm512_unpacklo_ps(oi, oq);
+            auto hi = _mm512_unpackhi_ps(oi, oq);
+            auto idx0 = _mm512_set_epi32(23, 22, 21, 20, 7, 6, 5, 4,
+                                         19, 18, 17, 16, 3, 2, 1, 0);
+            auto idx1 = _mm512_set_epi32(31, 30, 29, 28, 15, 14, 13, 12,
+                                         27, 26, 25, 24, 11, 10, 9, 8);
+            _mm512_store_ps(&output[i * 2], _mm512_permutex2var_ps(lo, idx0, hi));
+            _mm512_store_ps(&output[i * 2 + 16], _mm512_permutex2var_ps(lo, idx1, hi));
+        }
+    }
+    // Same as `calc_wave` but with the amplitude calibration applied.
+    // The calibration is computed once per channel and the outputs for the whole step
+    // are accumulated in registers.
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void calc_wave_calib(float *OUT_ATTR output, int nchns,
+                         const channel_param *PARAM_ATTR params, size_t param_idx,
+                         const channel_calib *PARAM_ATTR calib)
+    {
+        assume(nchns > 0);
+        __m512 o[step_size / 16];
+        for (int i = 0; i < step_size / 16; i++)
+            o[i] = _mm512_set1_ps(0);
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto freq = p.freq[param_idx];
+            auto dfreq = p.dfreq[param_idx];
+            auto amp = p.amp[param_idx];
+            auto damp = p.damp[param_idx];
+            calib[c].apply(freq, dfreq, amp, damp);
+            for (int i = 0; i < step_size; i += 16) {
+                o[i / 16] += avx512::calc_single_chn(i, p.phase[param_idx], freq, amp,
+                                                     dfreq, damp);
+            }
+        }
+        for (int i = 0; i < step_size; i += 16) {
+            _mm512_store_ps(&output[i], o[i / 16]);
+        }
+    }
+    template<bool nt=false>
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void quantize(int16_t *OUT_ATTR output, const float *OUT_ATTR input, size_t nsteps,
+                  float scale, int nbits, MarkerStream &markers, output_stats &stats,
+                  dither_state *dither)
+    {
+        avx512::quantize<nt>(output, input, nsteps, scale, nbits, markers, stats, dither);
+    }
+    // Compute `step_size` samples at `1 / R` of the full rate and add the upsampled
+    // `step_size * R` samples to `output`.
+    template<int R>
+    static inline __attribute__((target("avx512f,avx512dq")))
+    void accum_wave_lowrate(float *OUT_ATTR output, int nchns,
+                            const channel_param *PARAM_ATTR params, size_t param_idx,
+                            Upsampler<R> &up)
+    {
+        calc_wave(up.input, nchns, params, param_idx);
+        up.hold();
+        avx512::upsample_accum(output, up);
+        up.shift();
+    }
+};
+#endif
+
+// Find the shortest period (in number of steps, up to `max_steps`) of the output
+// for a set of fixed frequency channels.
+// The output is periodic with `nsteps` steps if `freq * nsteps` is an integer
+// for all channels since the phase advances by `2 * freq` (in unit of pi) per step.
+// For frequencies that are not exactly commensurate, a period is accepted if the
+// phase slip of each channel over one period is no more than `tol` (in unit of pi).
+// Returns `0` if there's no such period.
+static inline int find_period(int nchns, const channel_param_fixed *params,
+                              int max_steps, double tol)
+{
+    for (int nsteps = 1; nsteps <= max_steps; nsteps++) {
+        bool found = true;
+        for (int c = 0; c < nchns; c++) {
+            auto ncycles = (double)params[c].freq * nsteps;
+            if (std::abs(ncycles - std::round(ncycles)) * 2 > tol) {
+                found = false;
+                break;
+            }
+        }
+        if (found) {
+            return nsteps;
+        }
+    }
+    return 0;
+}
+
+// Round the frequencies of the channels so that the output is exactly periodic
+// with `nsteps` steps. This turns the phase slip over each period found by `find_period`
+// into a small frequency shift so that the output can be replayed without
+// any discontinuity at the boundary.
+static inline void snap_period(int nchns, channel_param_fixed *params, int nsteps)
+{
+    for (int c = 0; c < nchns; c++) {
+        auto ncycles = std::round((double)params[c].freq * nsteps);
+        params[c].freq = float(ncycles / nsteps);
+    }
+}
+
+// Render one period (`nsteps` steps) of the output.
+// The starting phase of each step is computed in double precision and wrapped
+// so that the phase error doesn't accumulate over long periods.
+template<typename Gen>
+static inline void render_period(float *output, int nsteps, int nchns,
+                                 const channel_param_fixed *params)
+{
+    std::vector<channel_param_fixed> step_params(params, params + nchns);
+    for (int i = 0; i < nsteps; i++) {
+        for (int c = 0; c < nchns; c++) {
+            auto phase = (double)params[c].phase + 2 * (double)params[c].freq * i;
+            step_params[c].phase = float(std::fmod(phase, 2));
+        }
+        Gen::calc_wave_fixed(&output[i * step_size], nchns, step_params.data());
+    }
+}
+
+// Fill `sz` elements of `output` by replaying a rendered period of `period_sz` elements
+// starting at `offset` within the period. Returns the offset for the next call.
+// This works for both the float and the quantized output.
+template<typename T>
+static inline size_t replay_period(T *output, size_t sz, const T *period,
+                                   size_t period_sz, size_t offset)
+{
+    while (sz > 0) {
+        auto len = std::min(sz, period_sz - offset);
+        memcpy(output, &period[offset], len * sizeof(T));
+        output += len;
+        sz -= len;
+        offset += len;
+        if (offset == period_sz) {
+            offset = 0;
+        }
+    }
+    return offset;
+}
+
+// The kernels compiled for an instruction set, each processing a block of `nsteps` steps.
+struct KernelTable {
+    // The phases in `params` are advanced to the step after the block.
+    using calc_wave_fixed_t = void (*)(float *output, size_t nsteps, int nchns,
+                                       channel_param_fixed *params);
+    // Uses the parameters starting at `param_idx`.
+    using calc_wave_t = void (*)(float *output, size_t nsteps, int nchns,
+                                 const channel_param *params, size_t param_idx);
+    using quantize_t = void (*)(int16_t *output, const float *input, size_t nsteps,
+                                float scale, int nbits, MarkerStream &markers,
+                                output_stats &stats, dither_state *dither);
+    // Number of channels with specialized kernels.
+    static constexpr int max_spec_chns = 16;
+
+    KernelISA isa;
+    calc_wave_fixed_t calc_wave_fixed;
+    calc_wave_t calc_wave;
+    quantize_t quantize;
+    // Same as `quantize` but with non-temporal stores, see `get_quantize`.
+    quantize_t quantize_nt;
+    // Specializations for `1` to `max_spec_chns` channels, which ignore `nchns`,
+    // with the channel loop unrolled and (for `calc_wave`) the zero slopes removed.
+    // Indexed by `[nchns - 1]` and `[nchns - 1][has_dfreq][has_damp]`.
+    calc_wave_fixed_t calc_wave_fixed_spec[max_spec_chns];
+    calc_wave_t calc_wave_spec[max_spec_chns][2][2];
+
+    // Pick the fastest kernel for the stream configuration.
+    // `has_dfreq` and `has_damp` should be `false` only if the corresponding
+    // parameters are zero for all channels and steps.
+    calc_wave_fixed_t get_calc_wave_fixed(int nchns, bool spec=true) const
+    {
+        if (spec && nchns >= 1 && nchns <= max_spec_chns)
+            return calc_wave_fixed_spec[nchns - 1];
+        return calc_wave_fixed;
+    }
+    calc_wave_t get_calc_wave(int nchns, bool has_dfreq=true, bool has_damp=true,
+                              bool spec=true) const
+    {
+        if (spec && nchns >= 1 && nchns <= max_spec_chns)
+            return calc_wave_spec[nchns - 1][has_dfreq][has_damp];
+        return calc_wave;
+    }
+    // Pick the store type for writing `nbytes` of output (e.g. a DMA chunk)
+    // before it's handed to the card.
+    // The non-temporal stores are used when the output doesn't fit in the cache,
+    // see `nt_store_threshold`.
+    quantize_t get_quantize(size_t nbytes) const;
+};
+
+// `isa` must be supported by the host.
+const KernelTable &get_kernels(KernelISA isa);
+
+// The output size above which the non-temporal stores are used.
+// This is half of the last level cache size so that the parameters and the
+// float buffer still fit, or 4 MiB if the cache size is unknown.
+size_t nt_store_threshold();
+
 }
 }
 
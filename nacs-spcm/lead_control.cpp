@@ -0,0 +1,134 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "lead_control.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace NaCs {
+namespace Spcm {
+
+// The rate measurement needs a long enough interval since the fill level of the card
+// is only known to about a per mille of its memory.
+static constexpr uint64_t rate_interval = 10000000;
+// Per chunk decay of the peak generation time.
+static constexpr double peak_decay = 0.999;
+
+NACS_EXPORT() LeadController::LeadController(double rate, size_t chunk, size_t max_lead,
+                                             double target_latency, double margin)
+    : m_chunk(chunk),
+      m_max_lead(std::max(max_lead / chunk * chunk, chunk)),
+      m_target_latency(target_latency),
+      m_margin(margin),
+      m_rate(rate)
+{
+    update_lead();
+}
+
+void LeadController::update_lead()
+{
+    size_t lead = m_max_lead;
+    if (m_target_latency > 0) {
+        // The first sample of a chunk started with `queued` bytes in the queue
+        // is output `gen_time + queued / rate` later and the next chunk is started
+        // when `queued + chunk <= lead`.
+        auto target = (m_target_latency - m_gen_mean) * m_rate;
+        auto safety = (m_margin + 2 * m_gen_peak) * m_rate + double(m_chunk);
+        auto nchunks = std::ceil(std::max(target, safety) / double(m_chunk));
+        lead = std::min(size_t(std::max(nchunks, 1.0)) * m_chunk, m_max_lead);
+    }
+    m_lead = lead;
+    std::lock_guard<std::mutex> locker(m_stats_lock);
+    m_stats.lead = lead;
+    m_stats.rate = m_rate;
+}
+
+NACS_EXPORT() double LeadController::wait_time(size_t queued) const
+{
+    if (queued + m_chunk <= m_lead)
+        return 0;
+    return double(queued + m_chunk - m_lead) / m_rate;
+}
+
+NACS_EXPORT() void LeadController::chunk_done(size_t queued, double gen_time)
+{
+    m_gen_mean = m_gen_mean == 0 ? gen_time : m_gen_mean * 0.9 + gen_time * 0.1;
+    m_gen_peak = std::max(gen_time, m_gen_peak * peak_decay);
+    auto latency = gen_time + double(queued) / m_rate;
+    auto safety = (m_margin + gen_time) * m_rate;
+    {
+        std::lock_guard<std::mutex> locker(m_stats_lock);
+        m_stats.latency = latency;
+        m_stats.max_latency = std::max(m_stats.max_latency, latency);
+        m_stats.nchunks++;
+        if (double(queued) < safety) {
+            m_stats.nlow++;
+        }
+    }
+    update_lead();
+}
+
+NACS_EXPORT() void LeadController::update_rate(uint64_t consumed, uint64_t time)
+{
+    if (m_last_time == 0 || consumed < m_last_consumed) {
+        m_last_consumed = consumed;
+        m_last_time = time;
+        return;
+    }
+    if (time - m_last_time < rate_interval)
+        return;
+    // Nothing is consumed before the trigger.
+    if (consumed > m_last_consumed) {
+        auto rate = double(consumed - m_last_consumed) / double(time - m_last_time) * 1e9;
+        m_rate = m_rate * 0.8 + rate * 0.2;
+        update_lead();
+    }
+    m_last_consumed = consumed;
+    m_last_time = time;
+}
+
+NACS_EXPORT() LeadController::Stats LeadController::stats() const
+{
+    std::lock_guard<std::mutex> locker(m_stats_lock);
+    return m_stats;
+}
+
+NACS_EXPORT() void LeadController::reset_stats()
+{
+    std::lock_guard<std::mutex> locker(m_stats_lock);
+    m_stats.latency = 0;
+    m_stats.max_latency = 0;
+    m_stats.nchunks = 0;
+    m_stats.nlow = 0;
+}
+
+NACS_EXPORT() size_t LeadController::pick_notify_size(double rate, double target_latency,
+                                                      size_t buff_size, size_t max_notify)
+{
+    if (target_latency <= 0)
+        return max_notify;
+    size_t notify = 4096;
+    auto limit = std::min(double(max_notify), rate * target_latency / 4);
+    while (double(notify * 2) <= limit && buff_size % (notify * 2) == 0)
+        notify *= 2;
+    return notify;
+}
+
+}
+}
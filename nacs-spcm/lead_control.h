@@ -0,0 +1,112 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_LEAD_CONTROL_H
+#define _NACS_SPCM_LEAD_CONTROL_H
+
+#include <nacs-utils/utils.h>
+
+#include <mutex>
+
+namespace NaCs {
+namespace Spcm {
+
+// Decides how far ahead of the output the generator writes.
+//
+// The lead (the data queued for the card and not yet output) is the delay
+// between the generation of a sample and its output, i.e. the latency of
+// a live parameter update. It also has to cover the time it takes to generate
+// the next chunk, or the card underruns. The controller keeps the lead close to
+// `target_latency` while never going below the safety lead, which covers
+// `margin` plus twice the (slowly decaying) peak time to generate a chunk.
+// The consumption rate of the card is measured continuously from the progress
+// of the output and replaces the nominal rate once it's known.
+//
+// All sizes are in bytes and all times in seconds except the timestamps,
+// which are from `getTime()`.
+class NACS_EXPORT(spcm) LeadController {
+public:
+    struct Stats {
+        // Update latency of the last chunk: the time from the start of its generation
+        // to the output of its first sample.
+        double latency = 0;
+        double max_latency = 0;
+        // The current lead target.
+        size_t lead = 0;
+        // The measured consumption rate in bytes per second.
+        double rate = 0;
+        uint64_t nchunks = 0;
+        // Chunks generated with less than the safety lead queued.
+        uint64_t nlow = 0;
+    };
+
+    // `rate` is the nominal consumption rate in bytes per second.
+    // The lead is a multiple of `chunk` and at most `max_lead`.
+    // A `target_latency` of `0` always uses `max_lead`.
+    LeadController(double rate, size_t chunk, size_t max_lead,
+                   double target_latency, double margin=0.002);
+
+    size_t chunk() const
+    {
+        return m_chunk;
+    }
+    size_t lead() const
+    {
+        return m_lead;
+    }
+    // Time to wait before generating the next chunk with `queued` bytes in the queue,
+    // `0` if it should be generated now.
+    double wait_time(size_t queued) const;
+    // Record a chunk handed to the card after `gen_time` with `queued` bytes
+    // in the queue when the generation started.
+    void chunk_done(size_t queued, double gen_time);
+    // Record `consumed` bytes output in total at `time`.
+    void update_rate(uint64_t consumed, uint64_t time);
+    Stats stats() const;
+    void reset_stats();
+
+    // A notify size (chunk size) for a stream with the target latency:
+    // at most a quarter of the target lead so that the granularity doesn't
+    // dominate the latency, a power of 2 multiple of 4096 that divides `buff_size`,
+    // and at most `max_notify`. `max_notify` if `target_latency` is `0`.
+    static size_t pick_notify_size(double rate, double target_latency,
+                                   size_t buff_size, size_t max_notify);
+
+private:
+    void update_lead();
+
+    const size_t m_chunk;
+    const size_t m_max_lead;
+    const double m_target_latency;
+    const double m_margin;
+    double m_rate;
+    // Mean and decaying peak time to generate a chunk.
+    double m_gen_mean = 0;
+    double m_gen_peak = 0;
+    size_t m_lead;
+    uint64_t m_last_consumed = 0;
+    uint64_t m_last_time = 0;
+
+    mutable std::mutex m_stats_lock;
+    Stats m_stats;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "numa.h"
+
+#include <nacs-utils/mem.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace NaCs {
+namespace Spcm {
+
+// From `numaif.h`, which is only available with libnuma.
+static constexpr int mpol_bind = 2;
+static constexpr unsigned mpol_mf_move = 1 << 1;
+
+static int read_node_file(const std::string &path)
+{
+    std::ifstream stm(path);
+    int node;
+    if (!(stm >> node))
+        return -1;
+    // The kernel reports `-1` when the device isn't attached to a specific node.
+    return node;
+}
+
+NACS_EXPORT() int card_numa_node(const std::string &name)
+{
+    auto pos = name.rfind('/');
+    auto base = pos == std::string::npos ? name : name.substr(pos + 1);
+    for (auto &path: {"/sys/class/spcm/" + base + "/device/numa_node",
+                "/sys/class/spcm_class/" + base + "/device/numa_node",
+                "/sys/bus/pci/devices/" + base + "/numa_node"}) {
+        auto node = read_node_file(path);
+        if (node >= 0) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+// Parse a list in the sysfs format, e.g. `0-3,8-11`.
+static std::vector<int> parse_cpulist(const std::string &list)
+{
+    std::vector<int> res;
+    std::istringstream stm(list);
+    std::string range;
+    while (std::getline(stm, range, ',')) {
+        int first;
+        int last;
+        auto n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1)
+            continue;
+        if (n == 1)
+            last = first;
+        for (int cpu = first; cpu <= last; cpu++) {
+            res.push_back(cpu);
+        }
+    }
+    return res;
+}
+
+NACS_EXPORT() int numa_num_nodes()
+{
+    std::ifstream stm("/sys/devices/system/node/possible");
+    std::string list;
+    if (!std::getline(stm, list))
+        return 1;
+    auto nodes = parse_cpulist(list);
+    return nodes.empty() ? 1 : nodes.back() + 1;
+}
+
+NACS_EXPORT() std::vector<int> numa_node_cpus(int node)
+{
+    std::string path = (node < 0 ? "/sys/devices/system/cpu/online" :
+                        "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::ifstream stm(path);
+    std::string list;
+    std::getline(stm, list);
+    return parse_cpulist(list);
+}
+
+NACS_EXPORT() int numa_cpu_node(int cpu)
+{
+    auto nnodes = numa_num_nodes();
+    for (int node = 0; node < nnodes; node++) {
+        auto cpus = numa_node_cpus(node);
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+NACS_EXPORT() std::vector<int> isolated_cpus()
+{
+    std::ifstream stm("/sys/devices/system/cpu/isolated");
+    std::string list;
+    std::getline(stm, list);
+    return parse_cpulist(list);
+}
+
+NACS_EXPORT() size_t numa_free_hugepages(int node, size_t page_size)
+{
+    std::ifstream stm("/sys/devices/system/node/node" + std::to_string(node) +
+                      "/hugepages/hugepages-" + std::to_string(page_size / 1024) +
+                      "kB/free_hugepages");
+    size_t n;
+    if (!(stm >> n))
+        return 0;
+    return n;
+}
+
+NACS_EXPORT() void bind_to_node(void *ptr, size_t size, int node)
+{
+    unsigned long mask[16] = {};
+    if (node < 0 || node >= int(sizeof(mask) * 8))
+        return;
+    mask[node / 64] = 1ul << (node % 64);
+    // Best effort, e.g. the syscall is not allowed in some containers.
+    syscall(__NR_mbind, ptr, size, mpol_bind, mask, sizeof(mask) * 8, mpol_mf_move);
+}
+
+NACS_EXPORT() void *map_node_local(size_t size, int node)
+{
+    auto ptr = mapAnonPage(size, Prot::RW);
+    if (!ptr)
+        return nullptr;
+    bind_to_node(ptr, size, node);
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page_size)
+        ((volatile char*)ptr)[i] = 0;
+    return ptr;
+}
+
+NACS_EXPORT() bool pin_to_node(int node)
+{
+    auto cpus = numa_node_cpus(node);
+    if (cpus.empty())
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu: cpus)
+        CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+}
+}
@@ -0,0 +1,58 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_NUMA_H
+#define _NACS_SPCM_NUMA_H
+
+#include <nacs-utils/utils.h>
+
+#include <string>
+#include <vector>
+
+namespace NaCs {
+namespace Spcm {
+
+// NUMA node of the PCIe root of a card, from the `numa_node` file of its PCI device
+// in sysfs, or `-1` if unknown or if the device isn't attached to a node.
+// `name` is either the device name passed to `spcm_hOpen` (e.g. `/dev/spcm0`)
+// or a PCI address (e.g. `0000:03:00.0`).
+int card_numa_node(const std::string &name);
+// Number of NUMA nodes, at least 1.
+int numa_num_nodes();
+// CPUs on `node`, all the CPUs if `node` is `-1`.
+std::vector<int> numa_node_cpus(int node);
+// NUMA node of `cpu`, `-1` if unknown.
+int numa_cpu_node(int cpu);
+// CPUs isolated from the scheduler with the `isolcpus` kernel parameter.
+std::vector<int> isolated_cpus();
+// Number of free hugetlbfs pages of `page_size` bytes on `node`, `0` if unknown.
+size_t numa_free_hugepages(int node, size_t page_size);
+
+// Bind the pages in the range to `node` (best effort). No-op if `node` is `-1`.
+void bind_to_node(void *ptr, size_t size, int node);
+// Anonymous page aligned memory bound to `node`, pre-faulted so that
+// the pages are placed immediately. Uses the default policy if `node` is `-1`.
+// Free with `unmapPage`.
+void *map_node_local(size_t size, int node);
+// Pin the calling thread to the CPUs on `node`. Returns whether it succeeded.
+bool pin_to_node(int node);
+
+}
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "realtime.h"
+
+#include <algorithm>
+
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace NaCs {
+namespace Spcm {
+
+NACS_EXPORT() bool lock_all_memory()
+{
+    // With `MCL_FUTURE`, allocations beyond the lock limit fail instead of
+    // just not being locked, so only ask for it when there's no limit.
+    rlimit lim;
+    bool unlimited = (geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &lim) == 0 &&
+                                         lim.rlim_cur == RLIM_INFINITY));
+    if (unlimited && mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        return true;
+    return mlockall(MCL_CURRENT) == 0;
+}
+
+NACS_EXPORT() NACS_NOINLINE void prefault_stack(size_t size)
+{
+    auto stack = (volatile char*)alloca(size);
+    auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page_size) {
+        stack[i] = 0;
+    }
+}
+
+NACS_EXPORT() bool set_fifo_priority(int priority)
+{
+    sched_param param;
+    param.sched_priority = std::min(std::max(priority, sched_get_priority_min(SCHED_FIFO)),
+                                    sched_get_priority_max(SCHED_FIFO));
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+NACS_EXPORT() bool pin_to_cpu(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+NACS_EXPORT() RTStatus enter_realtime(int priority, int cpu)
+{
+    RTStatus status;
+    // Pin first so that the stack pages are allocated on the node of the CPU.
+    if (cpu >= 0)
+        status.pinned = pin_to_cpu(cpu);
+    status.locked = lock_all_memory();
+    prefault_stack();
+    status.fifo = set_fifo_priority(priority);
+    return status;
+}
+
+}
+}
@@ -0,0 +1,57 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_REALTIME_H
+#define _NACS_SPCM_REALTIME_H
+
+#include <nacs-utils/utils.h>
+
+namespace NaCs {
+namespace Spcm {
+
+// Settings to keep a streaming thread from being delayed by the scheduler
+// or by page faults. Each of them needs privileges (`CAP_SYS_NICE` or `RLIMIT_RTPRIO`
+// for the priority, `CAP_IPC_LOCK` or `RLIMIT_MEMLOCK` for the locking)
+// so they are all best effort and the result records which ones took effect.
+struct RTStatus {
+    // Running with `SCHED_FIFO`.
+    bool fifo = false;
+    // Pinned to the requested CPU.
+    bool pinned = false;
+    // The memory of the process is locked.
+    bool locked = false;
+};
+
+// Lock the current memory of the process and, if the lock limit allows,
+// the future mappings (`mlockall`). Returns whether the current memory is locked.
+bool lock_all_memory();
+// Touch `size` bytes below the current stack pointer so that the calls
+// made later on the thread don't page fault on a new stack page.
+void prefault_stack(size_t size=512 * 1024);
+// Set the scheduling policy of the calling thread to `SCHED_FIFO` with `priority`
+// (clamped to the valid range). Returns whether it succeeded.
+bool set_fifo_priority(int priority);
+// Pin the calling thread to `cpu`. Returns whether it succeeded.
+bool pin_to_cpu(int cpu);
+// All of the above for the calling thread. `cpu` is ignored if it's `-1`.
+RTStatus enter_realtime(int priority, int cpu=-1);
+
+}
+}
+
+#endif
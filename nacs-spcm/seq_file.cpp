@@ -0,0 +1,177 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "seq_file.h"
+#include "data_stream_p.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NaCs {
+namespace Spcm {
+
+static constexpr char seq_magic[8] = "NaCsSeq";
+static constexpr uint64_t seq_data_offset = 4096;
+
+NACS_EXPORT() SeqFileHeader SeqFileHeader::create(uint32_t nchns, uint64_t nsteps,
+                                                  double sample_rate)
+{
+    SeqFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, seq_magic, sizeof(seq_magic));
+    header.version = current_version;
+    header.nchns = nchns;
+    header.step_size = Spcm::step_size;
+    header.layout = Layout::Planar;
+    header.nsteps = nsteps;
+    // Same as `CompiledTimeline`.
+    header.stride = (nsteps + 15) / 16 * 16 + 16;
+    header.data_offset = seq_data_offset;
+    header.sample_rate = sample_rate;
+    return header;
+}
+
+NACS_EXPORT() void write_seq_file(const std::string &path, const CompiledTimeline &res,
+                                  double sample_rate)
+{
+    auto header = SeqFileHeader::create(uint32_t(res.nchns()), res.nsteps(), sample_rate);
+    header.stride = res.stride();
+    header.flags = ((res.has_dfreq() ? uint32_t(SeqFileHeader::HasDFreq) : 0) |
+                    (res.has_damp() ? uint32_t(SeqFileHeader::HasDAmp) : 0));
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream stm(tmp_path, std::ios::binary);
+        stm.write((const char*)&header, sizeof(header));
+        std::vector<char> pad(seq_data_offset - sizeof(header));
+        stm.write(pad.data(), pad.size());
+        // The arrays of all the tones are contiguous in `res`, including the padding.
+        stm.write((const char*)res.phase(0), res.stride() * 5 * res.nchns() * sizeof(float));
+        stm.flush();
+        if (!stm) {
+            throw std::runtime_error("Cannot write sequence file to " + tmp_path);
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot write sequence file to " + path);
+    }
+}
+
+NACS_EXPORT() void SeqFileHeader::check(size_t size, const std::string &path) const
+{
+    auto invalid = [&] (const char *msg) {
+        throw std::runtime_error("Invalid sequence file " + path + ": " + msg);
+    };
+    if (memcmp(magic, seq_magic, sizeof(seq_magic)) != 0)
+        invalid("wrong magic");
+    // This also catches files written on a machine with a different byte order.
+    if (version != current_version)
+        throw std::runtime_error("Unsupported sequence file version " +
+                                 std::to_string(version) + ": " + path);
+    if (step_size != Spcm::step_size)
+        invalid("different step size");
+    if (layout != Layout::Planar)
+        invalid("unknown layout");
+    if (data_offset % 64 != 0 || data_offset < sizeof(*this))
+        invalid("misaligned data");
+    if (stride % 16 != 0 || stride < nsteps)
+        invalid("invalid stride");
+    if (data_offset > size)
+        invalid("truncated");
+    if (nchns == 0)
+        return;
+    if (stride == 0)
+        invalid("invalid stride");
+    // Divided instead of computing the size of the arrays, which could overflow.
+    auto avail = (size - data_offset) / sizeof(float);
+    if (avail / 5 / stride < nchns)
+        invalid("truncated");
+}
+
+NACS_EXPORT() SeqFile::SeqFile(const std::string &path, bool populate)
+{
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot open sequence file " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "fstat");
+    }
+    if (size_t(st.st_size) < sizeof(SeqFileHeader)) {
+        close(fd);
+        throw std::runtime_error("Invalid sequence file " + path + ": truncated");
+    }
+    m_size = size_t(st.st_size);
+    m_ptr = mmap(nullptr, m_size, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0),
+                 fd, 0);
+    // The mapping holds a reference to the file.
+    close(fd);
+    if (m_ptr == MAP_FAILED) {
+        m_ptr = nullptr;
+        throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+    try {
+        header().check(m_size, path);
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+    // The kernels read each array in order.
+    if (!populate) {
+        madvise(m_ptr, m_size, MADV_SEQUENTIAL);
+    }
+}
+
+NACS_EXPORT() SeqFile &SeqFile::operator=(SeqFile &&other)
+{
+    release();
+    m_ptr = other.m_ptr;
+    m_size = other.m_size;
+    other.m_ptr = nullptr;
+    other.m_size = 0;
+    return *this;
+}
+
+NACS_EXPORT() SeqFile::~SeqFile()
+{
+    release();
+}
+
+void SeqFile::release()
+{
+    if (!m_ptr)
+        return;
+    munmap(m_ptr, m_size);
+    m_ptr = nullptr;
+}
+
+}
+}
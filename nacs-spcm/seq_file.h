@@ -0,0 +1,154 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_SEQ_FILE_H
+#define _NACS_SPCM_SEQ_FILE_H
+
+#include "timeline.h"
+
+#include <string>
+
+namespace NaCs {
+namespace Spcm {
+
+// Binary file of compiled per-step kernel parameters
+// that is mapped into memory and used by the kernels without any parsing or copying.
+//
+// The file starts with a 64 bytes header (in the host byte order) followed,
+// at `data_offset`, by the parameter arrays in the same layout as `CompiledTimeline`:
+// for each tone the phase, freq, dfreq, amp and damp arrays of `nsteps` floats,
+// each `stride` floats (a multiple of 64 bytes) apart.
+// `data_offset` is 4096 so that the arrays are 64 bytes aligned in the mapping.
+// The file is mapped shared so all the processes using it share the page cache.
+struct SeqFileHeader {
+    enum Flags : uint32_t {
+        HasDFreq = 1 << 0,
+        HasDAmp = 1 << 1,
+    };
+    enum class Layout : uint32_t {
+        Planar = 0,
+    };
+    static constexpr uint32_t current_version = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t nchns;
+    uint32_t step_size;
+    Layout layout;
+    uint64_t nsteps;
+    // In number of floats.
+    uint64_t stride;
+    // In bytes from the start of the file.
+    uint64_t data_offset;
+    double sample_rate;
+    uint32_t flags;
+    uint32_t reserved;
+
+    // Header for the arrays of `nchns` tones of `nsteps` steps with no flags set,
+    // e.g. for writing a file that doesn't fit in memory one array at a time.
+    static SeqFileHeader create(uint32_t nchns, uint64_t nsteps, double sample_rate);
+    // Throws `std::runtime_error` if the header is invalid or of an unsupported version
+    // or if the arrays don't fit in a file of `file_size` bytes.
+    void check(size_t file_size, const std::string &path) const;
+};
+static_assert(sizeof(SeqFileHeader) == 64, "");
+
+// Write `res` to `path` (through a temporary file that is renamed at the end).
+void write_seq_file(const std::string &path, const CompiledTimeline &res,
+                    double sample_rate);
+
+class NACS_EXPORT(spcm) SeqFile {
+public:
+    // Map `path` read-only. With `populate`, all the pages are read in before returning,
+    // otherwise they are read on demand when the kernels first use them.
+    // Throws `std::runtime_error` if the file is invalid or of an unsupported version.
+    SeqFile(const std::string &path, bool populate=false);
+    SeqFile(const SeqFile&) = delete;
+    SeqFile &operator=(const SeqFile&) = delete;
+    SeqFile(SeqFile &&other)
+    {
+        *this = std::move(other);
+    }
+    SeqFile &operator=(SeqFile &&other);
+    ~SeqFile();
+
+    const SeqFileHeader &header() const
+    {
+        return *(const SeqFileHeader*)m_ptr;
+    }
+    int nchns() const
+    {
+        return int(header().nchns);
+    }
+    size_t nsteps() const
+    {
+        return header().nsteps;
+    }
+    size_t stride() const
+    {
+        return header().stride;
+    }
+    double sample_rate() const
+    {
+        return header().sample_rate;
+    }
+    bool has_dfreq() const
+    {
+        return header().flags & SeqFileHeader::HasDFreq;
+    }
+    bool has_damp() const
+    {
+        return header().flags & SeqFileHeader::HasDAmp;
+    }
+    const float *phase(int chn) const
+    {
+        return array(chn, 0);
+    }
+    const float *freq(int chn) const
+    {
+        return array(chn, 1);
+    }
+    const float *dfreq(int chn) const
+    {
+        return array(chn, 2);
+    }
+    const float *amp(int chn) const
+    {
+        return array(chn, 3);
+    }
+    const float *damp(int chn) const
+    {
+        return array(chn, 4);
+    }
+
+private:
+    const float *array(int chn, int i) const
+    {
+        return (const float*)((const char*)m_ptr + header().data_offset) +
+            (size_t(chn) * 5 + i) * header().stride;
+    }
+    void release();
+
+    void *m_ptr = nullptr;
+    size_t m_size = 0;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "seq_stream.h"
+
+#include <nacs-utils/timer.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace NaCs {
+namespace Spcm {
+
+NACS_EXPORT() SeqStream::SeqStream(const std::string &path, size_t chunk_steps, int nbuffs,
+                                   int node)
+    : m_path(path),
+      m_chunk_steps(std::max<size_t>(chunk_steps, 1))
+{
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+        throw std::system_error(errno, std::generic_category(),
+                                "Cannot open sequence file " + path);
+    try {
+        struct stat st;
+        if (fstat(m_fd, &st) != 0)
+            throw std::system_error(errno, std::generic_category(), "fstat");
+        if (pread(m_fd, &m_header, sizeof(m_header), 0) != (ssize_t)sizeof(m_header))
+            throw std::runtime_error("Invalid sequence file " + path + ": truncated");
+        m_header.check(size_t(st.st_size), path);
+        m_nchunks = (m_header.nsteps + m_chunk_steps - 1) / m_chunk_steps;
+        // Padded so that the arrays don't alias in the cache.
+        auto stride = (m_chunk_steps + 15) / 16 * 16 + 16;
+        auto size = std::max<size_t>(stride * 5 * m_header.nchns * sizeof(float), 1);
+        nbuffs = std::max(nbuffs, 1);
+        for (int i = 0; i < nbuffs; i++) {
+            m_buffs.emplace_back(size, node);
+            m_chunks.push_back({0, 0, stride, m_buffs.back().get<float>()});
+        }
+    }
+    catch (...) {
+        close(m_fd);
+        throw;
+    }
+    m_thread = std::thread([this] { run(); });
+}
+
+NACS_EXPORT() SeqStream::~SeqStream()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+    close(m_fd);
+}
+
+NACS_EXPORT() const SeqStream::Chunk *SeqStream::get()
+{
+    std::unique_lock<std::mutex> locker(m_lock);
+    if (m_consumed >= m_nchunks)
+        return nullptr;
+    if (m_consumed >= m_ready && !m_error) {
+        auto t0 = getTime();
+        m_cond.wait(locker, [&] { return m_consumed < m_ready || m_error; });
+        m_stats.nstalls++;
+        m_stats.stall_time += getElapse(t0);
+    }
+    // Chunks read before the error are still valid.
+    if (m_consumed >= m_ready)
+        std::rethrow_exception(m_error);
+    return &m_chunks[m_consumed % m_chunks.size()];
+}
+
+NACS_EXPORT() void SeqStream::release()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        m_consumed++;
+    }
+    m_cond.notify_all();
+}
+
+NACS_EXPORT() SeqStream::Stats SeqStream::stats() const
+{
+    std::lock_guard<std::mutex> locker(m_lock);
+    return m_stats;
+}
+
+void SeqStream::advise_chunk(size_t first, size_t nsteps, int advice)
+{
+    for (size_t i = 0; i < size_t(m_header.nchns) * 5; i++) {
+        auto offset = m_header.data_offset + (i * m_header.stride + first) * sizeof(float);
+        posix_fadvise(m_fd, off_t(offset), off_t(nsteps * sizeof(float)), advice);
+    }
+}
+
+void SeqStream::read_chunk(Chunk &chunk)
+{
+    for (size_t i = 0; i < size_t(m_header.nchns) * 5; i++) {
+        auto offset = (m_header.data_offset +
+                       (i * m_header.stride + chunk.first) * sizeof(float));
+        auto ptr = (char*)(chunk.data + i * chunk.stride);
+        auto size = chunk.nsteps * sizeof(float);
+        while (size > 0) {
+            auto res = pread(m_fd, ptr, size, off_t(offset));
+            if (res < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(),
+                                        "Cannot read sequence file " + m_path);
+            }
+            if (res == 0)
+                throw std::runtime_error("Sequence file truncated: " + m_path);
+            ptr += res;
+            offset += size_t(res);
+            size -= size_t(res);
+        }
+    }
+}
+
+void SeqStream::run()
+{
+    auto nbuffs = m_chunks.size();
+    for (size_t idx = 0; idx < m_nchunks; idx++) {
+        {
+            std::unique_lock<std::mutex> locker(m_lock);
+            m_cond.wait(locker, [&] { return m_stop || idx < m_consumed + nbuffs; });
+            if (m_stop) {
+                return;
+            }
+        }
+        // The generator is done with the previous chunk in this buffer.
+        auto &chunk = m_chunks[idx % nbuffs];
+        chunk.first = idx * m_chunk_steps;
+        chunk.nsteps = std::min(m_chunk_steps, m_header.nsteps - chunk.first);
+        auto next = chunk.first + chunk.nsteps;
+        if (next < m_header.nsteps)
+            advise_chunk(next, std::min(m_chunk_steps, m_header.nsteps - next),
+                         POSIX_FADV_WILLNEED);
+        auto t0 = getTime();
+        try {
+            read_chunk(chunk);
+        }
+        catch (...) {
+            {
+                std::lock_guard<std::mutex> locker(m_lock);
+                m_error = std::current_exception();
+            }
+            m_cond.notify_all();
+            return;
+        }
+        auto read_time = getElapse(t0);
+        advise_chunk(chunk.first, chunk.nsteps, POSIX_FADV_DONTNEED);
+        {
+            std::lock_guard<std::mutex> locker(m_lock);
+            m_ready = idx + 1;
+            m_stats.bytes_read += chunk.nsteps * sizeof(float) * 5 * m_header.nchns;
+            m_stats.read_time += read_time;
+        }
+        m_cond.notify_all();
+    }
+}
+
+}
+}
@@ -0,0 +1,144 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_SEQ_STREAM_H
+#define _NACS_SPCM_SEQ_STREAM_H
+
+#include "buffer.h"
+#include "seq_file.h"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NaCs {
+namespace Spcm {
+
+// Stream the parameters of a sequence file that may not fit in memory.
+// A reader thread reads chunks of `chunk_steps` steps ahead of the generator
+// into `nbuffs` locked buffers on the NUMA `node`.
+// When all the buffers are full the reader waits for the generator to release one
+// so the memory use is bounded.
+//
+// For each chunk the reader hints the kernel to start reading the next one
+// (`POSIX_FADV_WILLNEED`) before reading the current one, so that the reads of the
+// arrays of all the tones are in flight together, and drops the pages it has read
+// from the page cache so that streaming a large file doesn't evict everything else.
+class NACS_EXPORT(spcm) SeqStream {
+public:
+    // The parameters of the steps `[first, first + nsteps)` in the same layout
+    // as the file but with the arrays `stride` floats apart.
+    struct Chunk {
+        size_t first;
+        size_t nsteps;
+        size_t stride;
+        float *data;
+
+        const float *phase(int chn) const
+        {
+            return array(chn, 0);
+        }
+        const float *freq(int chn) const
+        {
+            return array(chn, 1);
+        }
+        const float *dfreq(int chn) const
+        {
+            return array(chn, 2);
+        }
+        const float *amp(int chn) const
+        {
+            return array(chn, 3);
+        }
+        const float *damp(int chn) const
+        {
+            return array(chn, 4);
+        }
+
+    private:
+        const float *array(int chn, int i) const
+        {
+            return data + (size_t(chn) * 5 + i) * stride;
+        }
+    };
+    struct Stats {
+        // Number of times and total time (in ns) the generator waited for a chunk.
+        size_t nstalls = 0;
+        uint64_t stall_time = 0;
+        size_t bytes_read = 0;
+        // Total time (in ns) the reader spent reading.
+        uint64_t read_time = 0;
+    };
+
+    // Throws `std::runtime_error` if the file is invalid.
+    SeqStream(const std::string &path, size_t chunk_steps=65536, int nbuffs=4, int node=-1);
+    SeqStream(const SeqStream&) = delete;
+    SeqStream &operator=(const SeqStream&) = delete;
+    ~SeqStream();
+
+    const SeqFileHeader &header() const
+    {
+        return m_header;
+    }
+    int nchns() const
+    {
+        return int(m_header.nchns);
+    }
+    size_t nsteps() const
+    {
+        return m_header.nsteps;
+    }
+    // The next chunk, waiting for it to be read if needed,
+    // or `nullptr` at the end of the sequence.
+    // Only one chunk can be used at a time and it must be released before the next one.
+    // Rethrows the error if reading the chunk failed.
+    const Chunk *get();
+    void release();
+    Stats stats() const;
+
+private:
+    void run();
+    void read_chunk(Chunk &chunk);
+    void advise_chunk(size_t first, size_t nsteps, int advice);
+
+    std::string m_path;
+    SeqFileHeader m_header;
+    int m_fd = -1;
+    size_t m_chunk_steps;
+    std::vector<Buffer> m_buffs;
+    std::vector<Chunk> m_chunks;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_cond;
+    // Chunks `[m_consumed, m_ready)` are ready for the generator
+    // and `[m_ready, m_consumed + nbuffs)` are being read or free for the reader.
+    size_t m_consumed = 0;
+    size_t m_ready = 0;
+    size_t m_nchunks = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+    Stats m_stats;
+    std::thread m_thread;
+};
+
+}
+}
+
+#endif
@@ -18,6 +18,11 @@
 
 #include "spcm.h"
 
+#include <fstream>
+#include <sstream>
+
+#include <stdio.h>
+
 namespace NaCs {
 namespace Spcm {
 
@@ -40,6 +45,202 @@ NACS_EXPORT() void Spcm::throw_error(const char *msg, uint32_t code,
     throw Error(msg, code, reg, val);
 }
 
+Spcm::RegKind Spcm::reg_kind(int32_t name)
+{
+    switch (name) {
+    case SPC_PCITYP:
+    case SPC_PCIVERSION:
+    case SPC_BASEPCBVERSION:
+    case SPC_PCIMODULEVERSION:
+    case SPC_MODULEPCBVERSION:
+    case SPC_PCIEXTVERSION:
+    case SPC_EXTPCBVERSION:
+    case SPC_PXIHWSLOTNO:
+    case SPCM_FW_CTRL:
+    case SPCM_FW_CTRL_GOLDEN:
+    case SPCM_FW_CTRL_ACTIVE:
+    case SPCM_FW_CLOCK:
+    case SPCM_FW_CONFIG:
+    case SPCM_FW_MODULEA:
+    case SPCM_FW_MODULEB:
+    case SPCM_FW_MODEXTRA:
+    case SPCM_FW_POWER:
+    case SPC_PCIDATE:
+    case SPC_CALIBDATE:
+    case SPC_PCISERIALNO:
+    case SPC_PCISAMPLERATE:
+    case SPC_PCIMEMSIZE:
+    case SPC_PCIFEATURES:
+    case SPC_PCIEXTFEATURES:
+    case SPCM_X0_AVAILMODES:
+    case SPCM_X1_AVAILMODES:
+    case SPCM_X2_AVAILMODES:
+        return RegKind::Static;
+    case SPC_M2CMD:
+    case SPC_M2STATUS:
+    case SPC_DATA_AVAIL_USER_LEN:
+    case SPC_DATA_AVAIL_USER_POS:
+    case SPC_DATA_AVAIL_CARD_LEN:
+    case SPC_FILLSIZEPROMILLE:
+        return RegKind::Volatile;
+    case SPC_SAMPLERATE:
+        return RegKind::Adjusted;
+    default:
+        return RegKind::Normal;
+    }
+}
+
+NACS_EXPORT() void Spcm::invalidate_shadow()
+{
+    for (auto it = m_shadow.begin(); it != m_shadow.end();) {
+        if (it->second.is_static) {
+            ++it;
+        }
+        else {
+            it = m_shadow.erase(it);
+        }
+    }
+}
+
+NACS_EXPORT() void Spcm::shadow_read(int32_t name, int64_t value)
+{
+    auto kind = reg_kind(name);
+    // Only cache what can't change without a write to the same register.
+    // Other registers may be derived from the ones we write
+    // (e.g. `SPC_CHCOUNT` from `SPC_CHENABLE`) and are only cached when written.
+    if (kind == RegKind::Static || kind == RegKind::Adjusted) {
+        m_shadow[name] = {value, kind == RegKind::Static};
+    }
+}
+
+NACS_EXPORT() void Spcm::shadow_written(int32_t name, int64_t value, uint32_t err)
+{
+    auto kind = reg_kind(name);
+    // Never cached, and the DMA registers may be written while another thread
+    // is using the shadow.
+    if (kind == RegKind::Volatile)
+        return;
+    if (err || kind == RegKind::Adjusted) {
+        // The value on the card is unknown.
+        m_shadow.erase(name);
+    }
+    else {
+        m_shadow[name] = {value, kind == RegKind::Static};
+    }
+}
+
+NACS_EXPORT() size_t Spcm::Batch::commit(bool write_setup)
+{
+    size_t nwritten = 0;
+    for (auto &write: m_writes) {
+        if (m_hdl.m_shadow_enabled && m_hdl.shadow_equal(write.name, write.value))
+            continue;
+        nwritten++;
+        auto err = (write.is64 ? m_hdl.set_param(write.name, write.value) :
+                    m_hdl.set_param(write.name, int32_t(write.value)));
+        if (!err)
+            continue;
+        char buff[ERRORTEXTLEN];
+        uint32_t reg;
+        int32_t val;
+        auto code = spcm_dwGetErrorInfo_i32(m_hdl.m_hdl, &reg, &val, buff);
+        m_hdl.invalidate_shadow();
+        throw_error(buff, code ? code : err, write.name, int32_t(write.value));
+    }
+    if (write_setup && nwritten)
+        m_hdl.write_setup();
+    // Errors that the driver only detects for the combination of the settings.
+    m_hdl.check_error();
+    m_writes.clear();
+    return nwritten;
+}
+
+NACS_EXPORT() void CardConfig::save(const std::string &path) const
+{
+    // Write to a temporary file first so that a crash doesn't leave a truncated file.
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream stm(tmp_path);
+        for (auto &entry: entries)
+            stm << entry.name << "\t" << (entry.is64 ? 64 : 32) << "\t"
+                << entry.value << "\n";
+        stm.flush();
+        if (!stm) {
+            throw std::runtime_error("Cannot write card config to " + tmp_path);
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot write card config to " + path);
+    }
+}
+
+NACS_EXPORT() CardConfig CardConfig::load(const std::string &path)
+{
+    std::ifstream stm(path);
+    if (!stm)
+        throw std::runtime_error("Cannot open card config " + path);
+    CardConfig config;
+    std::string line;
+    while (std::getline(stm, line)) {
+        if (line.empty())
+            continue;
+        std::istringstream lstm(line);
+        Entry entry;
+        int width;
+        if (!(lstm >> entry.name >> width >> entry.value) || (width != 32 && width != 64))
+            throw std::runtime_error("Invalid card config line: " + line);
+        entry.is64 = width == 64;
+        // Also accepts the unsigned value of a 32-bit register.
+        entry.value = reg_value(entry.is64, entry.value);
+        config.entries.push_back(entry);
+    }
+    return config;
+}
+
+NACS_EXPORT() void Spcm::read_config(CardConfig &config)
+{
+    for (auto &entry: config.entries) {
+        uint32_t err;
+        if (entry.is64) {
+            err = get_param(entry.name, &entry.value);
+        }
+        else {
+            int32_t value;
+            err = get_param(entry.name, &value);
+            entry.value = value;
+        }
+        if (err) {
+            throw_error();
+        }
+    }
+}
+
+NACS_EXPORT() bool Spcm::warm_start(const CardConfig &config)
+{
+    try {
+        auto current = config;
+        read_config(current);
+        auto b = batch();
+        for (size_t i = 0; i < config.entries.size(); i++) {
+            auto &entry = config.entries[i];
+            if (current.entries[i].value != reg_value(entry.is64, entry.value)) {
+                b.set(entry);
+            }
+        }
+        b.commit();
+        return true;
+    }
+    catch (const Error&) {
+        clear_error();
+    }
+    reset();
+    auto b = batch();
+    for (auto &entry: config.entries)
+        b.set(entry);
+    b.commit();
+    return false;
+}
+
 NACS_EXPORT() void Spcm::dump(std::ostream &stm) noexcept
 {
     int typ = card_type();
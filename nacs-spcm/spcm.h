@@ -26,6 +26,8 @@
 #include <ostream>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace NaCs {
 namespace Spcm {
@@ -54,6 +56,49 @@ struct NACS_EXPORT(spcm) Error : std::runtime_error {
     int32_t val;
 };
 
+// The value of a register as stored in the shadow register file and in `CardConfig`.
+// The 32-bit registers are read as `int32_t` so their values are sign-extended,
+// including the unsigned ones with bit 31 set.
+template<typename T>
+static inline int64_t reg_value(T value)
+{
+    return sizeof(T) >= 8 ? int64_t(value) : int64_t(int32_t(value));
+}
+static inline int64_t reg_value(bool is64, int64_t value)
+{
+    return is64 ? value : int64_t(int32_t(value));
+}
+
+// A snapshot of the desired values of a list of registers,
+// applied in order by `Spcm::warm_start()`.
+// The file format is one `register\twidth\tvalue` line per register
+// with `width` being `32` or `64`.
+struct NACS_EXPORT(spcm) CardConfig {
+    struct Entry {
+        int32_t name;
+        bool is64;
+        int64_t value;
+    };
+    std::vector<Entry> entries;
+
+    // Replaces the value if the register is already in the snapshot.
+    template<typename T>
+    CardConfig &set(int32_t name, T value)
+    {
+        for (auto &entry: entries) {
+            if (entry.name == name) {
+                entry = {name, sizeof(T) >= 8, reg_value(value)};
+                return *this;
+            }
+        }
+        entries.push_back({name, sizeof(T) >= 8, reg_value(value)});
+        return *this;
+    }
+    // Throw `std::runtime_error` on failure.
+    void save(const std::string &path) const;
+    static CardConfig load(const std::string &path);
+};
+
 class Spcm {
 public:
     Spcm(const char *name, bool _reset=true)
@@ -66,6 +111,13 @@ public:
             reset();
         }
     }
+    // Open the card without resetting it if its configuration can be brought to
+    // `config` by writing the registers that differ. See `warm_start()`.
+    Spcm(const char *name, const CardConfig &config)
+        : Spcm(name, false)
+    {
+        warm_start(config);
+    }
     drv_handle handle()
     {
         return m_hdl;
@@ -86,6 +138,8 @@ public:
         auto code = spcm_dwGetErrorInfo_i32(m_hdl, &reg, &val, buff);
         if (likely(!code))
             return;
+        // The failed write might have left the card in a different state.
+        invalidate_shadow();
         throw_error(buff, code, reg, val);
     }
     [[noreturn]] void throw_error();
@@ -99,31 +153,72 @@ public:
         spcm_dwGetErrorInfo_i32(m_hdl, nullptr, nullptr, nullptr);
     }
 
+    // Shadow register file.
+    // Every register access is an ioctl. With the shadow enabled, the values written
+    // to the card and the hardware information read from it are remembered
+    // and later reads of the same register are served from memory.
+    // Other registers are always read from the driver since they may change on their own
+    // (status, fill level, ...) or depend on other registers (e.g. the channel count).
+    // The ones that the driver may adjust on write (e.g. the sample rate)
+    // are re-read after a write.
+    // The hardware information (card type, versions, ...) is kept until the shadow
+    // is disabled and everything else is dropped on `reset()` and on errors.
+    void enable_shadow(bool enable=true)
+    {
+        m_shadow_enabled = enable;
+        if (!enable) {
+            m_shadow.clear();
+        }
+    }
+    bool shadow_enabled() const
+    {
+        return m_shadow_enabled;
+    }
+    void invalidate_shadow();
+
     template<typename T>
     uint32_t set_param(int32_t name, T value)
     {
+        int64_t written;
+        uint32_t err;
         if (sizeof(T) >= 8) {
-            return spcm_dwSetParam_i64(m_hdl, name, (int64)value);
+            written = (int64)value;
+            err = spcm_dwSetParam_i64(m_hdl, name, (int64)value);
         }
         else {
-            return spcm_dwSetParam_i32(m_hdl, name, (int32)value);
+            written = (int32)value;
+            err = spcm_dwSetParam_i32(m_hdl, name, (int32)value);
         }
+        if (m_shadow_enabled)
+            shadow_written(name, written, err);
+        return err;
     }
     template<typename T>
     uint32_t get_param(int32_t name, T *p)
     {
+        if (m_shadow_enabled) {
+            auto it = m_shadow.find(name);
+            if (it != m_shadow.end()) {
+                *p = T(it->second.value);
+                return 0;
+            }
+        }
+        int64_t res;
+        uint32_t err;
         if (sizeof(T) >= 8) {
             int64 buff;
-            auto err = spcm_dwGetParam_i64(m_hdl, name, &buff);
-            *p = T(buff);
-            return err;
+            err = spcm_dwGetParam_i64(m_hdl, name, &buff);
+            res = buff;
         }
         else {
             int32 buff;
-            auto err = spcm_dwGetParam_i32(m_hdl, name, &buff);
-            *p = T(buff);
-            return err;
+            err = spcm_dwGetParam_i32(m_hdl, name, &buff);
+            res = buff;
         }
+        *p = T(res);
+        if (m_shadow_enabled && !err)
+            shadow_read(name, res);
+        return err;
     }
     uint32_t def_transfer(uint32_t type, uint32_t dir, uint32_t notify_size, void *buff,
                           uint64_t offset, uint64_t size) // Size in byte
@@ -255,6 +350,10 @@ public:
     void cmd(int32_t cmd)
     {
         set_param(SPC_M2CMD, cmd);
+        // The other commands (start, stop, DMA, ...) don't change any setup register.
+        if (cmd & M2CMD_CARD_RESET) {
+            invalidate_shadow();
+        }
     }
     void reset()
     {
@@ -371,7 +470,114 @@ public:
     }
     void dump(std::ostream &stm) noexcept;
 
+    // A batch of register writes applied in one pass by `commit()`,
+    // followed by a single `write_setup()` and a single error check,
+    // instead of checking for errors after each write.
+    // With the shadow register file enabled, writes of the value the register
+    // already has are skipped.
+    // If a write fails, the remaining ones are not applied and the `Error` thrown
+    // has the failing register in `reg`.
+    class Batch {
+    public:
+        Batch(Spcm &hdl)
+            : m_hdl(hdl)
+        {}
+        template<typename T>
+        Batch &set(int32_t name, T value)
+        {
+            m_writes.push_back({name, sizeof(T) >= 8, reg_value(value)});
+            return *this;
+        }
+        Batch &ch_enable(int32_t chns)
+        {
+            return set(SPC_CHENABLE, chns);
+        }
+        Batch &enable_out(unsigned chn, bool enable)
+        {
+            if (chn >= 4)
+                throw_error("enable_out: channel out of bound", ERR_REG, 0, 0);
+            return set(int32_t(SPC_ENABLEOUT0 + 100 * chn), int32_t(enable));
+        }
+        Batch &set_amp(unsigned chn, uint32_t amp)
+        {
+            if (chn >= 4)
+                throw_error("set_amp: channel out of bound", ERR_REG, 0, 0);
+            return set(int32_t(SPC_AMP0 + 100 * chn), amp);
+        }
+        Batch &x0_mode(uint32_t mode)
+        {
+            return set(SPCM_X0_MODE, mode);
+        }
+        Batch &x1_mode(uint32_t mode)
+        {
+            return set(SPCM_X1_MODE, mode);
+        }
+        Batch &x2_mode(uint32_t mode)
+        {
+            return set(SPCM_X2_MODE, mode);
+        }
+        Batch &set(const CardConfig::Entry &entry)
+        {
+            m_writes.push_back({entry.name, entry.is64,
+                                reg_value(entry.is64, entry.value)});
+            return *this;
+        }
+        size_t size() const
+        {
+            return m_writes.size();
+        }
+        // Returns the number of writes sent to the driver.
+        // The batch is cleared on success.
+        size_t commit(bool write_setup=true);
+
+    private:
+        struct Write {
+            int32_t name;
+            bool is64;
+            int64_t value;
+        };
+        Spcm &m_hdl;
+        std::vector<Write> m_writes;
+    };
+    Batch batch()
+    {
+        return Batch(*this);
+    }
+
+    // Read back the registers in `config` and write only the ones that differ,
+    // followed by a single `write_setup()`.
+    // If a register cannot be read or the writes fail, the card is reset
+    // and the full configuration is written.
+    // Returns whether the reset was avoided.
+    bool warm_start(const CardConfig &config);
+    // Update `config` with the current values of its registers.
+    void read_config(CardConfig &config);
+
 private:
+    enum class RegKind : uint8_t {
+        // Only changed by writes and commands. Cached when written but not when read
+        // since the read-only ones may be derived from other registers.
+        Normal,
+        // Hardware information that never changes.
+        Static,
+        // Changes on its own or is write only. Never cached.
+        Volatile,
+        // The driver may round the value written so it must be read back.
+        Adjusted,
+    };
+    struct ShadowReg {
+        int64_t value;
+        bool is_static;
+    };
+    bool shadow_equal(int32_t name, int64_t value) const
+    {
+        auto it = m_shadow.find(name);
+        return it != m_shadow.end() && it->second.value == value;
+    }
+    static RegKind reg_kind(int32_t name);
+    void shadow_read(int32_t name, int64_t value);
+    void shadow_written(int32_t name, int64_t value, uint32_t err);
+
     std::pair<uint16_t,uint16_t> get_param_16x2(int32_t name)
     {
         uint32_t res;
@@ -385,6 +591,8 @@ private:
         return {uint8_t(res), uint8_t(res >> 8)};
     }
     drv_handle m_hdl;
+    bool m_shadow_enabled = false;
+    std::unordered_map<int32_t,ShadowReg> m_shadow;
 };
 
 }
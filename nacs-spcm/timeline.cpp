@@ -0,0 +1,678 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "timeline.h"
+#include "data_stream.h"
+#include "data_stream_p.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <string.h>
+
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+#  include <immintrin.h>
+#endif
+
+namespace NaCs {
+namespace Spcm {
+
+// Steps computed in one work item.
+static constexpr size_t block_steps = 16384;
+// Steps computed at a time in a work item, small enough for all the intermediate
+// values to stay in the L1 cache.
+static constexpr int sub_steps = 512;
+
+NACS_EXPORT() CompiledTimeline::CompiledTimeline(int nchns, size_t nsteps)
+    : m_nchns(nchns),
+      m_nsteps(nsteps),
+      // Padded so that the arrays don't alias in the cache.
+      m_stride((nsteps + 15) / 16 * 16 + 16),
+      m_buff(std::max<size_t>(m_stride * 5 * nchns * sizeof(float), 1))
+{
+}
+
+namespace {
+
+// The phase is accumulated in fixed point, with a full cycle being `2^64`,
+// so that it wraps around for free and the sum is exact and associative.
+// The phase of each block can then be computed independently from the sum
+// of the advances of the blocks before it.
+// The frequency at each step boundary is represented in the same way
+// but with `2^63` for a cycle (i.e. modulo two cycles per step) so that the phase
+// advance over a step, `(F_k + F_{k+1}) / 2`, is the sum of the two values.
+using fixed_t = uint64_t;
+
+// `x` in `[0, 1)` to fixed point.
+static fixed_t to_fixed(double x)
+{
+    // All the 53 bits of the mantissa.
+    return fixed_t(x * 0x1p53) << 11;
+}
+
+// The unit of the phase of the kernels is pi, i.e. `[-1, 1)` for a cycle.
+static NACS_INLINE float fixed_to_phase(fixed_t phase)
+{
+    return float(int32_t(phase >> 32)) * 0x1p-31f;
+}
+
+template<RampShape shape, typename T>
+static NACS_INLINE T ramp_shape(T x)
+{
+    if (shape == RampShape::Cubic)
+        return x * x * (3 - 2 * x);
+    return x;
+}
+
+// A ramp (or a hold, with `dv == 0`) over some of the step boundaries.
+// `v0` and `dv` are in cycles per step for the frequency.
+struct Segment {
+    RampShape shape;
+    double x0;
+    double dx;
+    double v0;
+    double dv;
+};
+
+// The consecutive segments of the ramps covering ranges of the step boundaries
+// of a block. Not a callback so that the loops evaluating the segments are always
+// inlined into the copy of the caller for each instruction set.
+class Segments {
+public:
+    NACS_INLINE Segments(const std::vector<ToneRamp> &ramps, bool is_freq,
+                         size_t first, double dt)
+        : m_ramps(ramps),
+          m_is_freq(is_freq),
+          m_dt(dt)
+    {
+        // The first ramp that hasn't ended at `first`.
+        auto t0 = double(first) * dt;
+        m_r = std::upper_bound(ramps.begin(), ramps.end(), t0,
+                               [] (double t, const ToneRamp &ramp) {
+                                   return t < ramp.start + ramp.len;
+                               }) - ramps.begin();
+    }
+    // Start on the boundaries `[k0, k0 + n)`. `k0` must not be before the end
+    // of the previous range minus one, i.e. the ranges can overlap by a boundary.
+    NACS_INLINE void start(size_t k0, int n)
+    {
+        m_k0 = k0;
+        m_k1 = k0 + n;
+        m_k = k0;
+    }
+    // The next segment, covering `[k0 + i0, k0 + i1)`.
+    // Returns `false` after the last one.
+    NACS_INLINE bool next(int &i0, int &i1, Segment &seg)
+    {
+        if (m_k >= m_k1)
+            return false;
+        i0 = int(m_k - m_k0);
+        seg = get();
+        i1 = int(m_k - m_k0);
+        return true;
+    }
+
+private:
+    NACS_INLINE double v0(const ToneRamp &ramp) const
+    {
+        return m_is_freq ? ramp.freq0 * m_dt : ramp.amp0;
+    }
+    NACS_INLINE double v1(const ToneRamp &ramp) const
+    {
+        return m_is_freq ? ramp.freq1 * m_dt : ramp.amp1;
+    }
+    NACS_INLINE Segment hold(size_t kend, double v)
+    {
+        m_k = kend;
+        return Segment{RampShape::Linear, 0, 0, v, 0};
+    }
+    NACS_INLINE Segment get()
+    {
+        auto &ramps = m_ramps;
+        if (ramps.empty())
+            return hold(m_k1, 0);
+        while (true) {
+            if (m_r >= ramps.size())
+                return hold(m_k1, v1(ramps.back()));
+            auto &ramp = ramps[m_r];
+            if (double(m_k) * m_dt < ramp.start) {
+                // Hold before the ramp.
+                auto kend = std::max(std::min(m_k1, size_t(std::ceil(ramp.start / m_dt))),
+                                     m_k + 1);
+                return hold(kend, m_r == 0 ? v0(ramp) : v1(ramps[m_r - 1]));
+            }
+            auto kend = size_t(std::ceil((ramp.start + ramp.len) / m_dt));
+            // Keep the ramp for the next range if it covers the last boundary,
+            // which is also the first boundary of the next range.
+            if (kend < m_k1)
+                m_r++;
+            kend = std::min(kend, m_k1);
+            if (kend > m_k) {
+                auto shape = m_is_freq ? ramp.freq_shape : ramp.amp_shape;
+                auto x0 = (double(m_k) * m_dt - ramp.start) / ramp.len;
+                m_k = kend;
+                return Segment{shape, x0, m_dt / ramp.len, v0(ramp), v1(ramp) - v0(ramp)};
+            }
+        }
+    }
+
+    const std::vector<ToneRamp> &m_ramps;
+    bool m_is_freq;
+    double m_dt;
+    size_t m_r;
+    size_t m_k0 = 0;
+    size_t m_k1 = 0;
+    size_t m_k = 0;
+};
+
+// The frequency at the step boundaries of a segment, in cycles per step
+// and in fixed point.
+// The value at the first boundary is computed in double precision and only the change
+// from it, as a polynomial of the time, in single precision. The segments are at most
+// `sub_steps` long so the error doesn't build up along long ramps.
+template<RampShape shape>
+struct FreqRamp {
+    NACS_INLINE FreqRamp(const Segment &seg, int n)
+    {
+        auto x0 = seg.x0;
+        auto base = seg.v0 + seg.dv * ramp_shape<shape>(x0);
+        double c1 = seg.dv;
+        double c2 = 0;
+        double c3 = 0;
+        // Max slope of the shape.
+        double slope = 1;
+        if (shape == RampShape::Cubic) {
+            c1 = seg.dv * 6 * x0 * (1 - x0);
+            c2 = seg.dv * (3 - 6 * x0);
+            c3 = seg.dv * -2;
+            slope = 1.5;
+        }
+        // The change in fixed point from a 32 bits integer, scaled by a power of 2
+        // so that it can't overflow.
+        auto bound = std::fabs(seg.dv) * slope * std::min(1.0, seg.dx * n);
+        hscale = 0;
+        hshift = 0;
+        if (bound != 0) {
+            // Same as `std::ilogb` and `std::ldexp`, which are too slow
+            // for the short segments.
+            int64_t bits;
+            memcpy(&bits, &bound, sizeof(bits));
+            auto e = std::min(29 - (int(bits >> 52) - 1023), 63);
+            int32_t fbits = (e + 127) << 23;
+            memcpy(&hscale, &fbits, sizeof(hscale));
+            hshift = 63 - e;
+        }
+        h0 = to_fixed(base / 2 - std::floor(base / 2));
+        basef = float(base);
+        dx = float(seg.dx);
+        c1f = float(c1);
+        c2f = float(c2);
+        c3f = float(c3);
+    }
+    NACS_INLINE float delta(int i) const
+    {
+        auto u = float(i) * dx;
+        return ((c3f * u + c2f) * u + c1f) * u;
+    }
+    NACS_INLINE int32_t quantize(float d) const
+    {
+        return int32_t(d * hscale);
+    }
+    NACS_INLINE fixed_t fixed(int64_t q) const
+    {
+        return h0 + (fixed_t(q) << hshift);
+    }
+    NACS_INLINE fixed_t fixed_at(int i) const
+    {
+        return fixed(quantize(delta(i)));
+    }
+    // `F` and `H` for the boundaries `[0, n)` of the segment.
+    NACS_INLINE void eval(float *F, fixed_t *H, int n) const
+    {
+        for (int i = 0; i < n; i++) {
+            auto d = delta(i);
+            F[i] = basef + d;
+            H[i] = fixed(quantize(d));
+        }
+    }
+    // The sum of `H` over the boundaries `[0, n)`. The shift and the additions
+    // wrap around in the same way so this is exactly the sum of the values from `eval`.
+    NACS_INLINE fixed_t sum(int n) const
+    {
+        int64_t qsum = 0;
+        for (int i = 0; i < n; i++)
+            qsum += quantize(delta(i));
+        return fixed_t(n) * h0 + (fixed_t(qsum) << hshift);
+    }
+
+    fixed_t h0;
+    float basef;
+    float dx;
+    float c1f;
+    float c2f;
+    float c3f;
+    float hscale;
+    int hshift;
+};
+
+template<RampShape shape>
+static NACS_INLINE void eval_amp(float *A, int n, const Segment &seg)
+{
+    auto v0 = float(seg.v0);
+    auto dv = float(seg.dv);
+    auto x0 = float(seg.x0);
+    auto dx = float(seg.dx);
+    for (int i = 0; i < n; i++) {
+        A[i] = v0 + dv * ramp_shape<shape>(x0 + float(i) * dx);
+    }
+}
+
+// Intermediate values for `sub_steps` steps.
+struct Scratch {
+    float F[sub_steps + 1];
+    fixed_t H[sub_steps + 1];
+    float A[sub_steps + 1];
+    float phase[sub_steps];
+    float dfreq[sub_steps];
+    float damp[sub_steps];
+};
+
+// The phase at the start of each step from the frequencies at the boundaries in `H`,
+// overwriting `H`.
+static NACS_INLINE fixed_t eval_phase(float *out, fixed_t *H, int n, fixed_t phase)
+{
+    // The advance over each step. `H[i + 1]` is read before it's overwritten.
+    for (int i = 0; i < n; i++)
+        H[i] = H[i] + H[i + 1];
+    // The only serial part, one integer addition per step.
+    for (int i = 0; i < n; i++) {
+        auto advance = H[i];
+        H[i] = phase;
+        phase += advance;
+    }
+    for (int i = 0; i < n; i++)
+        out[i] = fixed_to_phase(H[i]);
+    return phase;
+}
+
+// The parts written for each instruction set.
+// `phase` computes the phases like `eval_phase` and `copy` stores the results.
+struct ScalarOps {
+    static NACS_INLINE fixed_t phase(float *out, fixed_t *H, int n, fixed_t phase0)
+    {
+        return eval_phase(out, H, n, phase0);
+    }
+    static NACS_INLINE void copy(float *dst, const float *src, int n)
+    {
+        memcpy(dst, src, n * sizeof(float));
+    }
+    static NACS_INLINE void fence()
+    {
+    }
+};
+
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+// The result is much larger than the cache and is only read later by the kernels,
+// so `copy` uses non-temporal stores to avoid reading it in and save half
+// of the memory traffic. `dst` must be 64 bytes aligned.
+// Not inlined since the caller isn't compiled for the instruction set.
+struct AVX2Ops {
+    static NACS_INLINE fixed_t phase(float *out, fixed_t *H, int n, fixed_t phase0)
+    {
+        return eval_phase(out, H, n, phase0);
+    }
+    static __attribute__((target("avx"))) void copy(float *dst, const float *src, int n)
+    {
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm256_stream_ps(dst + i, _mm256_loadu_ps(src + i));
+        for (; i < n; i++) {
+            dst[i] = src[i];
+        }
+    }
+    static NACS_INLINE void fence()
+    {
+        _mm_sfence();
+    }
+};
+
+struct AVX512Ops {
+    // The serial sum is the slowest part after the stores,
+    // so do the prefix sum in the vector for 8 steps at a time.
+    static __attribute__((target("avx512f"))) fixed_t phase(float *out, fixed_t *H,
+                                                            int n, fixed_t phase0)
+    {
+        auto carry = _mm512_set1_epi64(int64_t(phase0));
+        auto last = _mm512_set1_epi64(7);
+        auto scale = _mm256_set1_ps(0x1p-31f);
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            auto advance = _mm512_add_epi64(_mm512_loadu_si512(H + i),
+                                            _mm512_loadu_si512(H + i + 1));
+            auto sum = _mm512_add_epi64(advance,
+                                        _mm512_maskz_alignr_epi64(0xfe, advance, advance, 7));
+            sum = _mm512_add_epi64(sum, _mm512_maskz_alignr_epi64(0xfc, sum, sum, 6));
+            sum = _mm512_add_epi64(sum, _mm512_maskz_alignr_epi64(0xf0, sum, sum, 4));
+            sum = _mm512_add_epi64(sum, carry);
+            // Same as `fixed_to_phase` on the phase before the advance.
+            auto hi = _mm512_srli_epi64(_mm512_sub_epi64(sum, advance), 32);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(
+                                 _mm256_cvtepi32_ps(_mm512_cvtepi64_epi32(hi)), scale));
+            carry = _mm512_permutexvar_epi64(last, sum);
+        }
+        _mm_storel_epi64((__m128i*)&phase0, _mm512_castsi512_si128(carry));
+        return eval_phase(out + i, H + i, n - i, phase0);
+    }
+    static __attribute__((target("avx512f"))) void copy(float *dst, const float *src, int n)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+            _mm512_stream_ps(dst + i, _mm512_loadu_ps(src + i));
+        for (; i < n; i++) {
+            dst[i] = src[i];
+        }
+    }
+    static NACS_INLINE void fence()
+    {
+        _mm_sfence();
+    }
+};
+#endif
+
+// The frequency at the step boundaries `[k0, k0 + n]`.
+static NACS_INLINE void eval_boundaries(Segments &segs, size_t k0, int n, Scratch &s)
+{
+    segs.start(k0, n + 1);
+    int i0, i1;
+    Segment seg;
+    while (segs.next(i0, i1, seg)) {
+        if (seg.shape == RampShape::Cubic) {
+            FreqRamp<RampShape::Cubic>(seg, i1 - i0).eval(s.F + i0, s.H + i0, i1 - i0);
+        }
+        else {
+            FreqRamp<RampShape::Linear>(seg, i1 - i0).eval(s.F + i0, s.H + i0, i1 - i0);
+        }
+    }
+}
+
+// The part of the phase advance over the steps `[0, n)` from the boundaries `[i0, i1)`,
+// i.e. the sum of `H[i] + H[i + 1]` with `H` from `eval_boundaries`
+// but without computing the values one by one.
+template<RampShape shape>
+static NACS_INLINE fixed_t freq_advance(const Segment &seg, int i0, int i1, int n)
+{
+    FreqRamp<shape> ramp(seg, i1 - i0);
+    auto sum = 2 * ramp.sum(i1 - i0);
+    if (i0 == 0)
+        sum -= ramp.fixed_at(0);
+    if (i1 == n + 1)
+        sum -= ramp.fixed_at(i1 - i0 - 1);
+    return sum;
+}
+
+// The phase advance over the steps `[first, last)`, with the same rounding
+// as `_compile_block`.
+static NACS_INLINE fixed_t _block_advance(const ToneTimeline &tone, size_t first,
+                                          size_t last, double dt)
+{
+    fixed_t sum = 0;
+    Segments segs(tone.ramps, true, first, dt);
+    for (size_t k0 = first; k0 < last; k0 += sub_steps) {
+        auto n = int(std::min<size_t>(sub_steps, last - k0));
+        segs.start(k0, n + 1);
+        int i0, i1;
+        Segment seg;
+        while (segs.next(i0, i1, seg)) {
+            if (seg.shape == RampShape::Cubic) {
+                sum += freq_advance<RampShape::Cubic>(seg, i0, i1, n);
+            }
+            else {
+                sum += freq_advance<RampShape::Linear>(seg, i0, i1, n);
+            }
+        }
+    }
+    return sum;
+}
+
+// Compute the parameters for the steps `[first, last)`
+// from the phase at the start of the block.
+template<typename Ops>
+static NACS_INLINE void _compile_block(const ToneTimeline &tone, const CompiledTimeline &res,
+                                       int chn, size_t first, size_t last, double dt,
+                                       fixed_t phase, bool dfreq, bool damp, Scratch &s)
+{
+    Segments freq_segs(tone.ramps, true, first, dt);
+    Segments amp_segs(tone.ramps, false, first, dt);
+    for (size_t k0 = first; k0 < last; k0 += sub_steps) {
+        auto n = int(std::min<size_t>(sub_steps, last - k0));
+        eval_boundaries(freq_segs, k0, n, s);
+        amp_segs.start(k0, n + 1);
+        int i0, i1;
+        Segment seg;
+        while (amp_segs.next(i0, i1, seg)) {
+            if (seg.shape == RampShape::Cubic) {
+                eval_amp<RampShape::Cubic>(s.A + i0, i1 - i0, seg);
+            }
+            else {
+                eval_amp<RampShape::Linear>(s.A + i0, i1 - i0, seg);
+            }
+        }
+        auto F = s.F;
+        auto A = s.A;
+        auto H = s.H;
+        phase = Ops::phase(s.phase, H, n, phase);
+        Ops::copy(res.phase(chn) + k0, s.phase, n);
+        Ops::copy(res.freq(chn) + k0, F, n);
+        Ops::copy(res.amp(chn) + k0, A, n);
+        // The stores take most of the time so the zero slopes are skipped.
+        if (dfreq) {
+            for (int i = 0; i < n; i++)
+                s.dfreq[i] = (F[i + 1] - F[i]) * 0.5f;
+            Ops::copy(res.dfreq(chn) + k0, s.dfreq, n);
+        }
+        if (damp) {
+            for (int i = 0; i < n; i++)
+                s.damp[i] = (A[i + 1] - A[i]) * 0.5f;
+            Ops::copy(res.damp(chn) + k0, s.damp, n);
+        }
+    }
+    Ops::fence();
+}
+
+using block_advance_t = fixed_t (*)(const ToneTimeline&, size_t, size_t, double);
+using compile_block_t = void (*)(const ToneTimeline&, const CompiledTimeline&, int,
+                                 size_t, size_t, double, fixed_t, bool, bool, Scratch&);
+
+// Compiled for each instruction set like the kernels in `data_stream.cpp`,
+// so that the loops above are vectorized with the widest vectors available.
+#define DEF_COMPILER(name, Ops, ...)                                    \
+    struct name##_compiler {                                            \
+        static fixed_t __attribute__((__VA_ARGS__))                     \
+        block_advance(const ToneTimeline &tone, size_t first, size_t last, \
+                      double dt)                                        \
+        {                                                               \
+            return _block_advance(tone, first, last, dt);               \
+        }                                                               \
+        static void __attribute__((__VA_ARGS__))                        \
+        compile_block(const ToneTimeline &tone, const CompiledTimeline &res, \
+                      int chn, size_t first, size_t last, double dt,    \
+                      fixed_t phase, bool dfreq, bool damp, Scratch &s) \
+        {                                                               \
+            _compile_block<Ops>(tone, res, chn, first, last, dt, phase, \
+                                dfreq, damp, s);                        \
+        }                                                               \
+    }
+
+DEF_COMPILER(scalar, ScalarOps, flatten);
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+DEF_COMPILER(avx2, AVX2Ops, target("avx2,fma"), flatten);
+DEF_COMPILER(avx512, AVX512Ops, target("avx512f,avx512dq,avx512bw,avx512vl"),
+             flatten);
+#endif
+
+#undef DEF_COMPILER
+
+template<typename Compiler>
+static void select_compiler(block_advance_t &block_advance, compile_block_t &compile_block)
+{
+    block_advance = Compiler::block_advance;
+    compile_block = Compiler::compile_block;
+}
+
+static void get_compiler(block_advance_t &block_advance, compile_block_t &compile_block)
+{
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    if (kernel_isa_supported(KernelISA::AVX512))
+        return select_compiler<avx512_compiler>(block_advance, compile_block);
+    if (kernel_isa_supported(KernelISA::AVX2))
+        return select_compiler<avx2_compiler>(block_advance, compile_block);
+#endif
+    select_compiler<scalar_compiler>(block_advance, compile_block);
+}
+
+static void check_ramps(const ToneTimeline &tone)
+{
+    double end = -INFINITY;
+    for (auto &ramp: tone.ramps) {
+        if (!(ramp.len > 0) || !(ramp.start >= end))
+            throw std::invalid_argument("Tone ramps must have a positive length, "
+                                        "be sorted and not overlap");
+        end = ramp.start + ramp.len;
+    }
+}
+
+// Whether the frequency (`is_freq`) or the amplitude changes before `tend`,
+// either during a ramp or by a jump between two ramps.
+static bool has_slope(const ToneTimeline &tone, bool is_freq, double tend)
+{
+    auto &ramps = tone.ramps;
+    for (size_t i = 0; i < ramps.size() && ramps[i].start <= tend; i++) {
+        auto &ramp = ramps[i];
+        auto v0 = is_freq ? ramp.freq0 : ramp.amp0;
+        if (v0 != (is_freq ? ramp.freq1 : ramp.amp1))
+            return true;
+        if (i > 0 && v0 != (is_freq ? ramps[i - 1].freq1 : ramps[i - 1].amp1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Func>
+static void parallel_for(size_t n, int nthreads, Func &&func)
+{
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        std::unique_ptr<Scratch> scratch(new Scratch);
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;) {
+            func(i, *scratch);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nthreads && size_t(i) < n; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+struct Block {
+    int chn;
+    size_t first;
+    size_t last;
+    fixed_t advance;
+    fixed_t phase;
+};
+
+}
+
+NACS_EXPORT() CompiledTimeline compile_timeline(const std::vector<ToneTimeline> &tones,
+                                                double sample_rate, size_t nsteps,
+                                                int nthreads)
+{
+    CompiledTimeline res(int(tones.size()), nsteps);
+    compile_timeline(res, tones, sample_rate, nthreads);
+    return res;
+}
+
+NACS_EXPORT() void compile_timeline(CompiledTimeline &res,
+                                    const std::vector<ToneTimeline> &tones,
+                                    double sample_rate, int nthreads)
+{
+    if (int(tones.size()) != res.nchns())
+        throw std::invalid_argument("Number of tones mismatch");
+    for (auto &tone: tones)
+        check_ramps(tone);
+    if (nthreads <= 0)
+        nthreads = std::max(int(std::thread::hardware_concurrency()), 1);
+    block_advance_t block_advance;
+    compile_block_t compile_block;
+    get_compiler(block_advance, compile_block);
+    auto nchns = res.nchns();
+    auto nsteps = res.nsteps();
+    auto dt = step_size / sample_rate;
+
+    auto tend = double(nsteps) * dt;
+    res.m_has_dfreq = false;
+    res.m_has_damp = false;
+    for (auto &tone: tones) {
+        res.m_has_dfreq |= has_slope(tone, true, tend);
+        res.m_has_damp |= has_slope(tone, false, tend);
+    }
+    bool dfreq = res.m_has_dfreq || !res.m_zero_dfreq;
+    bool damp = res.m_has_damp || !res.m_zero_damp;
+
+    std::vector<Block> blocks;
+    for (int chn = 0; chn < nchns; chn++) {
+        for (size_t first = 0; first < nsteps; first += block_steps) {
+            blocks.push_back({chn, first, std::min(first + block_steps, nsteps), 0, 0});
+        }
+    }
+    // The phase advance of each block, which only needs the frequency.
+    parallel_for(blocks.size(), nthreads, [&] (size_t i, Scratch&) {
+        auto &block = blocks[i];
+        if (block.first + block_steps < nsteps) {
+            block.advance = block_advance(tones[block.chn], block.first, block.last, dt);
+        }
+    });
+    // The exact phase at the start of each block.
+    fixed_t phase = 0;
+    for (auto &block: blocks) {
+        if (block.first == 0) {
+            auto cycles = tones[block.chn].phase / (2 * M_PI);
+            phase = to_fixed(cycles - std::floor(cycles));
+        }
+        block.phase = phase;
+        phase += block.advance;
+    }
+    parallel_for(blocks.size(), nthreads, [&] (size_t i, Scratch &s) {
+        auto &block = blocks[i];
+        compile_block(tones[block.chn], res, block.chn, block.first, block.last, dt,
+                      block.phase, dfreq, damp, s);
+    });
+    res.m_zero_dfreq = !res.m_has_dfreq;
+    res.m_zero_damp = !res.m_has_damp;
+}
+
+}
+}
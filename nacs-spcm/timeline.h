@@ -0,0 +1,148 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#ifndef _NACS_SPCM_TIMELINE_H
+#define _NACS_SPCM_TIMELINE_H
+
+#include "buffer.h"
+
+#include <vector>
+
+namespace NaCs {
+namespace Spcm {
+
+enum class RampShape : uint8_t {
+    Linear,
+    // `3x^2 - 2x^3`, i.e. no slope at either end.
+    Cubic,
+};
+
+// A ramp of the frequency (in Hz) and the amplitude of a tone from `start`
+// for `len` (both in seconds).
+struct ToneRamp {
+    double start;
+    double len;
+    double freq0;
+    double freq1;
+    double amp0;
+    double amp1;
+    RampShape freq_shape = RampShape::Linear;
+    RampShape amp_shape = RampShape::Linear;
+};
+
+// The ramps of a tone, sorted and not overlapping.
+// The frequency and the amplitude are held between the ramps, before the first one
+// (at the start values of the first ramp) and after the last one.
+// A tone without any ramp is off.
+struct ToneTimeline {
+    // Phase at time `0` in radians.
+    double phase = 0;
+    std::vector<ToneRamp> ramps;
+};
+
+// Per step kernel parameters of a shot (see `channel_param` in `data_stream_p.h`):
+// the phase (in unit of pi), the frequency (in cycles per step), the amplitude
+// at the start of each step and the slopes of the frequency and the amplitude
+// (half of the change over the step).
+// The arrays of each tone are `stride()` apart in a single huge page buffer.
+class NACS_EXPORT(spcm) CompiledTimeline {
+public:
+    CompiledTimeline(int nchns, size_t nsteps);
+
+    int nchns() const
+    {
+        return m_nchns;
+    }
+    size_t nsteps() const
+    {
+        return m_nsteps;
+    }
+    size_t stride() const
+    {
+        return m_stride;
+    }
+    float *phase(int chn) const
+    {
+        return array(chn, 0);
+    }
+    float *freq(int chn) const
+    {
+        return array(chn, 1);
+    }
+    float *dfreq(int chn) const
+    {
+        return array(chn, 2);
+    }
+    float *amp(int chn) const
+    {
+        return array(chn, 3);
+    }
+    float *damp(int chn) const
+    {
+        return array(chn, 4);
+    }
+    // Whether any of the slopes are non-zero, for picking the kernel.
+    bool has_dfreq() const
+    {
+        return m_has_dfreq;
+    }
+    bool has_damp() const
+    {
+        return m_has_damp;
+    }
+
+private:
+    float *array(int chn, int i) const
+    {
+        return m_buff.get<float>() + (size_t(chn) * 5 + i) * m_stride;
+    }
+
+    int m_nchns;
+    size_t m_nsteps;
+    size_t m_stride;
+    Buffer m_buff;
+    bool m_has_dfreq = false;
+    bool m_has_damp = false;
+    // Whether the slope arrays are all zeros (as they are when allocated)
+    // so that they don't need to be written again when the slopes are zero.
+    bool m_zero_dfreq = true;
+    bool m_zero_damp = true;
+
+    friend void compile_timeline(CompiledTimeline&, const std::vector<ToneTimeline>&,
+                                 double, int);
+};
+
+// Compute the parameters of the first `nsteps` steps of the tones at `sample_rate`.
+// The frequency and the amplitude within each step are linear between the values
+// at the step boundaries and the phase is continuous, accumulated exactly in fixed point.
+// The tones are split into blocks of steps that are computed on `nthreads` threads
+// (all the CPUs if `0`).
+// Throws `std::invalid_argument` if the ramps of a tone are not sorted or overlap.
+CompiledTimeline compile_timeline(const std::vector<ToneTimeline> &tones,
+                                  double sample_rate, size_t nsteps, int nthreads=0);
+// Same but reusing the memory of `res`, which must have the same number of tones.
+// The allocation of the parameter arrays can take longer than the computation.
+// The slope arrays are only written when the slopes are non-zero
+// or when they are not zeros from a previous compilation.
+void compile_timeline(CompiledTimeline &res, const std::vector<ToneTimeline> &tones,
+                      double sample_rate, int nthreads=0);
+
+}
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Wake-up latency of the `AsyncWaiter` compared to polling.
+//
+//     bench-async [<device>]
+//
+// The latency is the time from the end of the (emulated) blocking wait
+// to the waiting thread running again.
+// For polling, it is the time from the flag being set to the poll noticing it,
+// for a few poll intervals. With a device, the cost of each status poll
+// (an ioctl) is measured as well.
+
+#include <nacs-spcm/async.h>
+
+#include <nacs-utils/timer.h>
+
+#include <assert.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr int nrep = 2000;
+// Time between the submission and the end of the emulated wait.
+static constexpr uint64_t wait_ns = 100000;
+
+static void spin_until(uint64_t t)
+{
+    while (getTime() < t) {
+    }
+}
+
+static void print_stats(const char *name, std::vector<uint64_t> &lat)
+{
+    std::sort(lat.begin(), lat.end());
+    std::cout << "  " << name << ": median: " << double(lat[lat.size() / 2]) / 1000
+              << " us, 99%: " << double(lat[lat.size() * 99 / 100]) / 1000
+              << " us, max: " << double(lat.back()) / 1000 << " us" << std::endl;
+}
+
+static void bench_async()
+{
+    AsyncWaiter waiter(nullptr);
+    std::vector<uint64_t> lat;
+    for (int i = 0; i < nrep; i++) {
+        auto t = getTime() + wait_ns;
+        auto id = waiter.submit([t] {
+            spin_until(t);
+            return uint32_t(ERR_OK);
+        });
+        auto res = waiter.wait();
+        auto now = getTime();
+        assert(res.id == id);
+        assert(res.err == ERR_OK);
+        lat.push_back(now - res.done_time);
+    }
+    print_stats("eventfd", lat);
+
+    // The callback runs on the service thread so this only measures the overhead
+    // of the dispatch.
+    lat.clear();
+    for (int i = 0; i < nrep; i++) {
+        std::atomic<bool> done{false};
+        auto t = getTime() + wait_ns;
+        waiter.submit([t] {
+            spin_until(t);
+            return uint32_t(ERR_OK);
+        }, [&] (const AsyncWaiter::Completion &res) {
+            lat.push_back(getTime() - res.done_time);
+            done.store(true, std::memory_order_release);
+        });
+        while (!done.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    print_stats("callback", lat);
+}
+
+static void bench_poll(uint64_t interval)
+{
+    std::vector<uint64_t> lat;
+    for (int i = 0; i < nrep; i++) {
+        std::atomic<uint64_t> done_time{0};
+        auto t = getTime() + wait_ns;
+        std::thread thread([&] {
+            spin_until(t);
+            done_time.store(getTime(), std::memory_order_release);
+        });
+        uint64_t done;
+        while (!(done = done_time.load(std::memory_order_acquire))) {
+            if (interval) {
+                timespec ts{0, long(interval)};
+                nanosleep(&ts, nullptr);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+        lat.push_back(getTime() - done);
+        thread.join();
+    }
+    std::string name = "poll every " + std::to_string(interval / 1000) + " us";
+    print_stats(name.c_str(), lat);
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Wake-up latency:" << std::endl;
+    bench_async();
+    bench_poll(0);
+    bench_poll(10000);
+    bench_poll(100000);
+
+    if (argc >= 2) {
+        NaCs::Spcm::Spcm hdl(argv[1], false);
+        int32_t status;
+        hdl.get_param(SPC_M2STATUS, &status);
+        auto t0 = getTime();
+        for (int i = 0; i < nrep; i++)
+            hdl.get_param(SPC_M2STATUS, &status);
+        std::cout << "Status poll: " << double(getElapse(t0)) / nrep / 1000
+                  << " us/call" << std::endl;
+    }
+    return 0;
+}
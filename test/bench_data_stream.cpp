@@ -0,0 +1,509 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Micro-benchmarks for the data stream kernels.
+//
+//     bench-data_stream [--json <file>] [--compare <baseline>] [--threshold <fraction>]
+//                       [--filter <substring>] [--time <ms>] [--rounds <n>]
+//
+// Every benchmark is run for `--rounds` rounds of about `--time` ms each
+// and the fastest round is reported, together with the cycle, instruction and
+// cache miss counts from `perf_event_open` for that round when they are available
+// (the counters only include user space so that they work with the default
+// `perf_event_paranoid` setting).
+// `--json` writes the results to a file (`-` for stdout) that can be used as the
+// baseline for `--compare` later. The compare mode prints the ratio to the baseline
+// for each benchmark and exits with a non-zero status if any of them is slower
+// by more than `--threshold` (default `0.05`).
+
+#include "calc_wave_helper.h"
+#include "perf_counters.h"
+
+#include <nacs-spcm/data_stream.h>
+
+#include <nacs-utils/mem.h>
+#include <nacs-utils/processor.h>
+#include <nacs-utils/timer.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static std::random_device rd;
+static std::mt19937 gen(rd());
+
+static void fill_random(std::vector<float> &data, float lb, float ub)
+{
+    std::uniform_real_distribution<float> dis(lb, ub);
+    for (auto &d: data) {
+        d = dis(gen);
+    }
+}
+
+namespace {
+
+// Indices in the counter group of `Bench`.
+enum CounterEvent {
+    Cycles,
+    Instructions,
+    CacheMisses,
+    NEvents
+};
+
+struct Options {
+    const char *json = nullptr;
+    const char *compare = nullptr;
+    const char *filter = nullptr;
+    double threshold = 0.05;
+    double time_ms = 20;
+    int rounds = 5;
+};
+
+struct Result {
+    std::string name;
+    std::string isa;
+    int nchns;
+    double ns_per_sample;
+    double cycles_per_sample;
+    double ipc;
+    double cache_misses_per_ksample;
+};
+
+class Bench {
+public:
+    Bench(const Options &opts)
+        : m_opts(opts)
+    {
+        if (!m_counters.available()) {
+            std::cerr << "Hardware counters not available." << std::endl;
+        }
+    }
+    // `run(rep)` processes `rep * nsamples` output samples.
+    void run(const char *name, KernelISA isa, int nchns, size_t nsamples,
+             const std::function<void(size_t)> &run);
+    const std::vector<Result> &results() const
+    {
+        return m_results;
+    }
+
+private:
+    const Options &m_opts;
+    PerfCounters m_counters{{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}};
+    std::vector<Result> m_results;
+};
+
+void Bench::run(const char *name, KernelISA isa, int nchns, size_t nsamples,
+                const std::function<void(size_t)> &run)
+{
+    if (m_opts.filter) {
+        std::string full = std::string(kernel_isa_name(isa)) + "/" + name;
+        if (full.find(m_opts.filter) == std::string::npos) {
+            return;
+        }
+    }
+    // Warm up and pick the repetition count for the target round time.
+    auto t0 = getTime();
+    run(1);
+    auto once = std::max<uint64_t>(getElapse(t0), 1);
+    size_t rep = std::max<size_t>(size_t(m_opts.time_ms * 1e6 / double(once)), 1);
+
+    double best = INFINITY;
+    double best_counts[NEvents] = {NAN, NAN, NAN};
+    double counts[NEvents];
+    for (int r = 0; r < m_opts.rounds; r++) {
+        m_counters.start();
+        t0 = getTime();
+        run(rep);
+        auto t = getElapse(t0);
+        m_counters.stop(counts);
+        if (double(t) < best) {
+            best = double(t);
+            memcpy(best_counts, counts, sizeof(counts));
+        }
+    }
+    double total = double(nsamples) * double(rep);
+    Result res{name, kernel_isa_name(isa), nchns, best / total,
+               best_counts[Cycles] / total,
+               best_counts[Instructions] / best_counts[Cycles],
+               best_counts[CacheMisses] / total * 1000};
+    std::cout << "  " << std::left << std::setw(16) << res.name << std::right
+              << " [nchn: " << std::setw(2) << nchns << "] "
+              << std::setw(8) << res.ns_per_sample << " ns/sample";
+    if (!isnan(res.cycles_per_sample))
+        std::cout << "; " << res.cycles_per_sample << " cycles/sample";
+    if (!isnan(res.ipc))
+        std::cout << "; IPC: " << res.ipc;
+    if (!isnan(res.cache_misses_per_ksample))
+        std::cout << "; " << res.cache_misses_per_ksample << " misses/ksample";
+    std::cout << std::endl;
+    m_results.push_back(std::move(res));
+}
+
+struct ChannelParams {
+    std::vector<float> values;
+    std::vector<channel_param_fixed> fixed;
+    std::vector<channel_param> ramp;
+    std::vector<channel_param> ramp_noslope;
+    std::vector<float> tables;
+    std::vector<channel_calib> calib;
+    ChannelParams(int nchns, size_t nsteps)
+        : values(nchns * nsteps * 5),
+          fixed(nchns),
+          ramp(nchns),
+          ramp_noslope(nchns),
+          // 256 points gain table and 64 points amplitude curve for each channel.
+          tables(nchns * (256 + 64)),
+          calib(nchns)
+    {
+        fill_random(values, -2, 2);
+        fill_random(tables, 0.5, 1.5);
+        // Shared all-zero slopes for the constant-parameter ramp.
+        values.resize(values.size() + nsteps, 0);
+        auto zeros = &values[nchns * nsteps * 5];
+        for (int i = 0; i < nchns; i++) {
+            auto p = &values[i * nsteps * 5];
+            fixed[i] = {p[0], p[nsteps], fabsf(p[nsteps * 3])};
+            ramp[i] = {p, p + nsteps, p + nsteps * 2, p + nsteps * 3, p + nsteps * 4};
+            ramp_noslope[i] = {p, p + nsteps, zeros, p + nsteps * 3, zeros};
+            calib[i].freq0 = -2;
+            calib[i].freq_scale = 255 / 4.0;
+            calib[i].nfreq = 256;
+            calib[i].gain = &tables[i * (256 + 64)];
+            calib[i].amp_scale = 63 / 2.0;
+            calib[i].namp = 64;
+            calib[i].amp_curve = &tables[i * (256 + 64) + 256];
+        }
+    }
+};
+
+// The size of the block processed by each call.
+// Small enough for all the buffers to stay in the L2 cache.
+constexpr size_t bench_size = 2 * 4096;
+static const int bench_nchns[] = {1, 2, 4, 8, 16};
+
+template<typename Gen>
+NACS_NOINLINE void bench_quantize(Bench &bench, KernelISA isa, float *data)
+{
+    constexpr size_t sz = bench_size;
+    auto out = (int16_t*)mapAnonPage(sz * sizeof(int16_t), Prot::RW);
+    std::vector<float> input(sz);
+    fill_random(input, -1, 1);
+    memcpy(data, input.data(), sz * sizeof(float));
+    // Marker edges every few hundred samples, many of them within a step.
+    std::vector<marker_run> runs;
+    std::uniform_int_distribution<uint32_t> len_dis(1, 500);
+    for (size_t n = 0; n < sz; n += runs.back().len)
+        runs.push_back({len_dis(gen), uint16_t(runs.size() % 2 ? 0x8000 : 0)});
+    output_stats stats;
+    dither_state dither;
+
+    bench.run("quantize", isa, 0, sz, [&] (size_t rep) {
+        Runner<Gen>::run_quantize(out, data, sz, rep, 32767.0f, 0, nullptr, 0, stats);
+    });
+    bench.run("quantize_marker", isa, 0, sz, [&] (size_t rep) {
+        Runner<Gen>::run_quantize(out, data, sz, rep, 16383.0f, 1, runs.data(),
+                                  runs.size(), stats);
+    });
+    bench.run("quantize_dither", isa, 0, sz, [&] (size_t rep) {
+        Runner<Gen>::run_quantize(out, data, sz, rep, 32767.0f, 0, nullptr, 0,
+                                  stats, &dither);
+    });
+
+    // Writing to a ring much larger than the cache, like the DMA buffer,
+    // with the normal and the non-temporal stores.
+    auto &kernels = get_kernels(isa);
+    constexpr size_t ring_sz = 64 * 1024 * 1024 / sizeof(int16_t);
+    auto ring = (int16_t*)mapAnonPage(ring_sz * sizeof(int16_t), Prot::RW);
+    memset(ring, 0, ring_sz * sizeof(int16_t));
+    size_t ring_offset = 0;
+    for (bool nt: {false, true}) {
+        auto kernel = nt ? kernels.quantize_nt : kernels.quantize;
+        bench.run(nt ? "quantize_ring_nt" : "quantize_ring", isa, 0, sz, [&] (size_t rep) {
+            for (size_t r = 0; r < rep; r++) {
+                MarkerStream markers(nullptr, 0);
+                kernel(ring + ring_offset, data, sz / step_size, 32767.0f, 0,
+                       markers, stats, nullptr);
+                ring_offset = (ring_offset + sz) % ring_sz;
+            }
+        });
+    }
+    stats.collect();
+    unmapPage(ring, ring_sz * sizeof(int16_t));
+    unmapPage(out, sz * sizeof(int16_t));
+}
+
+template<typename Gen>
+NACS_NOINLINE void bench_chn(Bench &bench, KernelISA isa, float *data, int nchns)
+{
+    constexpr size_t sz = bench_size;
+    constexpr size_t nsteps = sz / step_size;
+    ChannelParams ps(nchns, nsteps);
+    auto &kernels = get_kernels(isa);
+
+    bench.run("fixed", isa, nchns, sz, [&] (size_t rep) {
+        Runner<Gen>::run_wave_fixed(data, sz, rep, nchns, ps.fixed.data());
+    });
+    bench.run("ramp", isa, nchns, sz, [&] (size_t rep) {
+        Runner<Gen>::run_wave(data, sz, rep, nchns, ps.ramp.data());
+    });
+    // Block kernels from the kernel table, including the call overhead
+    // and the specialization on the channel count and the slopes.
+    bench.run("table_fixed", isa, nchns, sz, [&] (size_t rep) {
+        auto kernel = kernels.get_calc_wave_fixed(nchns);
+        for (size_t r = 0; r < rep; r++) {
+            kernel(data, nsteps, nchns, ps.fixed.data());
+        }
+    });
+    bench.run("table_ramp", isa, nchns, sz, [&] (size_t rep) {
+        auto kernel = kernels.get_calc_wave(nchns);
+        for (size_t r = 0; r < rep; r++) {
+            kernel(data, nsteps, nchns, ps.ramp.data(), 0);
+        }
+    });
+    bench.run("table_ramp_flat", isa, nchns, sz, [&] (size_t rep) {
+        auto kernel = kernels.get_calc_wave(nchns, false, false);
+        for (size_t r = 0; r < rep; r++) {
+            kernel(data, nsteps, nchns, ps.ramp_noslope.data(), 0);
+        }
+    });
+    bench.run("calib", isa, nchns, sz, [&] (size_t rep) {
+        Runner<Gen>::run_wave_calib(data, sz, rep, nchns, ps.ramp.data(), ps.calib.data());
+    });
+    // `data` has `sz * 2` elements so that the I/Q outputs fit.
+    bench.run("iq", isa, nchns, sz, [&] (size_t rep) {
+        Runner<Gen>::run_wave_iq(data, data + sz, sz, rep, nchns, ps.ramp.data());
+    });
+    bench.run("iq_interleave", isa, nchns, sz, [&] (size_t rep) {
+        Runner<Gen>::run_wave_iq_interleave(data, sz, rep, nchns, ps.ramp.data());
+    });
+    Upsampler<4> up;
+    bench.run("lowrate4", isa, nchns, sz, [&] (size_t rep) {
+        Runner<Gen>::run_wave_lowrate(data, sz, rep, nchns, ps.ramp.data(), up);
+    });
+}
+
+template<typename Gen>
+void bench_isa(Bench &bench, KernelISA isa)
+{
+    std::cout << kernel_isa_name(isa) << ":" << std::endl;
+    auto data = (float*)mapAnonPage(bench_size * 2 * sizeof(float), Prot::RW);
+    bench_quantize<Gen>(bench, isa, data);
+    for (auto nchns: bench_nchns)
+        bench_chn<Gen>(bench, isa, data, nchns);
+    unmapPage(data, bench_size * 2 * sizeof(float));
+}
+
+static void write_json(std::ostream &stm, const std::string &cpu,
+                       const std::vector<Result> &results)
+{
+    // One result per line so that `read_json` doesn't need a full JSON parser.
+    auto num = [&] (double v) {
+        if (isnan(v) || isinf(v)) {
+            stm << "null";
+        }
+        else {
+            stm << v;
+        }
+    };
+    stm << std::setprecision(6);
+    stm << "{\n  \"cpu\": \"" << cpu << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &res = results[i];
+        stm << "    {\"name\": \"" << res.name << "\", \"isa\": \"" << res.isa
+            << "\", \"nchns\": " << res.nchns << ", \"ns_per_sample\": ";
+        num(res.ns_per_sample);
+        stm << ", \"cycles_per_sample\": ";
+        num(res.cycles_per_sample);
+        stm << ", \"ipc\": ";
+        num(res.ipc);
+        stm << ", \"cache_misses_per_ksample\": ";
+        num(res.cache_misses_per_ksample);
+        stm << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    stm << "  ]\n}\n";
+}
+
+using ResultKey = std::tuple<std::string,std::string,int>;
+
+static bool find_field(const std::string &line, const char *field, size_t &pos)
+{
+    auto key = std::string("\"") + field + "\": ";
+    pos = line.find(key);
+    if (pos == std::string::npos)
+        return false;
+    pos += key.size();
+    return true;
+}
+
+static bool read_str_field(const std::string &line, const char *field, std::string &res)
+{
+    size_t pos;
+    if (!find_field(line, field, pos) || line[pos] != '"')
+        return false;
+    auto end = line.find('"', pos + 1);
+    if (end == std::string::npos)
+        return false;
+    res = line.substr(pos + 1, end - pos - 1);
+    return true;
+}
+
+static bool read_num_field(const std::string &line, const char *field, double &res)
+{
+    size_t pos;
+    if (!find_field(line, field, pos))
+        return false;
+    char *end;
+    res = strtod(line.c_str() + pos, &end);
+    return end != line.c_str() + pos;
+}
+
+// Reads the per-sample time from a file written by `write_json`.
+static std::map<ResultKey,double> read_json(const char *path)
+{
+    std::map<ResultKey,double> res;
+    std::ifstream stm(path);
+    if (!stm) {
+        std::cerr << "Cannot open baseline " << path << std::endl;
+        exit(2);
+    }
+    std::string line;
+    while (std::getline(stm, line)) {
+        std::string name;
+        std::string isa;
+        double nchns;
+        double ns;
+        if (!read_str_field(line, "name", name) || !read_str_field(line, "isa", isa) ||
+            !read_num_field(line, "nchns", nchns) ||
+            !read_num_field(line, "ns_per_sample", ns))
+            continue;
+        res[ResultKey(name, isa, int(nchns))] = ns;
+    }
+    return res;
+}
+
+// Returns the number of regressions.
+static int compare(const std::vector<Result> &results, const char *path, double threshold)
+{
+    auto baseline = read_json(path);
+    int nregress = 0;
+    std::cout << "Compared to " << path << ":" << std::endl;
+    for (auto &res: results) {
+        auto it = baseline.find(ResultKey(res.name, res.isa, res.nchns));
+        if (it == baseline.end())
+            continue;
+        auto ratio = res.ns_per_sample / it->second;
+        const char *flag = "";
+        if (ratio > 1 + threshold) {
+            flag = "  REGRESSION";
+            nregress++;
+        }
+        else if (ratio < 1 - threshold) {
+            flag = "  improved";
+        }
+        std::cout << "  " << std::left << std::setw(8) << res.isa << std::setw(16)
+                  << res.name << std::right << " [nchn: " << std::setw(2) << res.nchns
+                  << "] " << std::fixed << std::setprecision(3) << ratio
+                  << std::defaultfloat << flag << std::endl;
+    }
+    std::cout << nregress << " regression(s) above " << threshold * 100 << "%" << std::endl;
+    return nregress;
+}
+
+static void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [--json <file>] [--compare <baseline>]"
+              << " [--threshold <fraction>] [--filter <substring>] [--time <ms>]"
+              << " [--rounds <n>]" << std::endl;
+    exit(2);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage(argv[0]);
+        auto val = argv[++i];
+        if (strcmp(arg, "--json") == 0) {
+            opts.json = val;
+        }
+        else if (strcmp(arg, "--compare") == 0) {
+            opts.compare = val;
+        }
+        else if (strcmp(arg, "--filter") == 0) {
+            opts.filter = val;
+        }
+        else if (strcmp(arg, "--threshold") == 0) {
+            opts.threshold = atof(val);
+        }
+        else if (strcmp(arg, "--time") == 0) {
+            opts.time_ms = atof(val);
+        }
+        else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = std::max(atoi(val), 1);
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    Bench bench(opts);
+    bench_isa<ScalarGen>(bench, KernelISA::Scalar);
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    if (kernel_isa_supported(KernelISA::SSE2))
+        bench_isa<SSE2Gen>(bench, KernelISA::SSE2);
+    if (kernel_isa_supported(KernelISA::AVX))
+        bench_isa<AVXGen>(bench, KernelISA::AVX);
+    if (kernel_isa_supported(KernelISA::AVX2))
+        bench_isa<AVX2Gen>(bench, KernelISA::AVX2);
+    if (kernel_isa_supported(KernelISA::AVX512))
+        bench_isa<AVX512Gen>(bench, KernelISA::AVX512);
+#endif
+
+    if (opts.json) {
+        auto cpu = KernelTuner("").cpu_model();
+        if (strcmp(opts.json, "-") == 0) {
+            write_json(std::cout, cpu, bench.results());
+        }
+        else {
+            std::ofstream stm(opts.json);
+            write_json(stm, cpu, bench.results());
+        }
+    }
+    if (opts.compare && compare(bench.results(), opts.compare, opts.threshold) > 0)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Streaming throughput and TLB misses with the ring buffer and the parameter
+// arrays on normal pages and on huge pages.
+//
+//     bench-hugepage [<nchns>] [<ring size in MiB>]
+
+#include "perf_counters.h"
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/buffer.h>
+#include <nacs-spcm/data_stream.h>
+
+#include <nacs-utils/timer.h>
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr size_t chunk_size = 1024 * 1024;
+static constexpr size_t chunk_steps = chunk_size / sizeof(int16_t) / step_size;
+// Each channel has parameters for a long sequence of which every chunk uses a part,
+// so that the parameter reads are spread over many pages.
+static constexpr size_t param_steps = chunk_steps * 64;
+// Offset between the arrays, so that they don't alias in the cache.
+static constexpr size_t param_stride = param_steps + 16;
+
+static void bench(bool huge, int nchns, size_t ring_size)
+{
+    auto &kernels = get_kernels(KernelTuner::global().select(nchns, StepType::Ramp));
+    Buffer ring(ring_size, -1, huge);
+    size_t nparams = param_stride * 5 * nchns;
+    Buffer values(nparams * sizeof(float), -1, huge);
+    Buffer fbuff(chunk_size / sizeof(int16_t) * sizeof(float), -1, huge);
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dis(-0.1f, 0.1f);
+    for (size_t i = 0; i < nparams; i++)
+        values.get<float>()[i] = dis(gen);
+    std::vector<channel_param> ps(nchns);
+    for (int c = 0; c < nchns; c++) {
+        auto p = values.get<float>() + c * param_stride * 5;
+        ps[c] = {p, p + param_stride, p + param_stride * 2, p + param_stride * 3,
+                 p + param_stride * 4};
+    }
+
+    PerfCounters counters{
+        {PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))},
+        {PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_WRITE << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))}};
+    output_stats stats;
+    size_t nsamples = 0;
+    size_t param_idx = 0;
+    double counts[2];
+    counters.start();
+    auto t0 = getTime();
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t offset = 0; offset < ring_size; offset += chunk_size) {
+            kernels.calc_wave(fbuff.get<float>(), chunk_steps, nchns, ps.data(), param_idx);
+            MarkerStream markers(nullptr, 0);
+            kernels.quantize(ring.get<int16_t>() + offset / sizeof(int16_t),
+                             fbuff.get<float>(), chunk_steps, 32767.0f / float(nchns), 0,
+                             markers, stats, nullptr);
+            nsamples += chunk_size / sizeof(int16_t);
+            param_idx = (param_idx + chunk_steps) % param_steps;
+        }
+    }
+    auto elapsed = getElapse(t0);
+    counters.stop(counts);
+    std::cout << "  " << (huge ? "Huge" : "Normal") << " [" << kernel_isa_name(kernels.isa)
+              << ", ring: " << page_name(ring.page())
+              << ", params: " << page_name(values.page())
+              << (ring.locked() ? ", locked" : "") << "] "
+              << double(elapsed) / double(nsamples) << " ns/sample";
+    if (counters.available()) {
+        std::cout << "; dTLB misses: load: " << counts[0] / double(nsamples) * 1000
+                  << "/ksample, store: " << counts[1] / double(nsamples) * 1000
+                  << "/ksample";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int nchns = argc >= 2 ? std::max(atoi(argv[1]), 1) : 16;
+    size_t ring_size = (argc >= 3 ? std::max(atoi(argv[2]), 1) : 512) * size_t(1024 * 1024);
+    ring_size = (ring_size + chunk_size - 1) / chunk_size * chunk_size;
+    std::cout << "Tones: " << nchns << ", ring: " << ring_size / 1024 / 1024
+              << " MiB" << std::endl;
+    bench(false, nchns, ring_size);
+    bench(true, nchns, ring_size);
+    return 0;
+}
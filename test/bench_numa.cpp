@@ -0,0 +1,131 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Streaming throughput with the generator thread and the memory
+// (ring buffer and parameter arrays) on the same or different NUMA nodes.
+//
+//     bench-numa [<nchns>]
+//
+// Each combination of CPU node and memory node generates `nchns` ramping
+// tones into a ring much larger than the cache, as the streaming threads do.
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/data_stream.h>
+#include <nacs-spcm/numa.h>
+
+#include <nacs-utils/mem.h>
+#include <nacs-utils/timer.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr size_t ring_size = 256 * 1024 * 1024;
+static constexpr size_t chunk_size = 1024 * 1024;
+static constexpr size_t chunk_steps = chunk_size / sizeof(int16_t) / step_size;
+
+static size_t cache_size()
+{
+    long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (size <= 0)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (size <= 0)
+        return size_t(32 * 1024 * 1024);
+    return size_t(size);
+}
+
+static void bench(int cpu_node, int mem_node, int nchns)
+{
+    double ns_per_sample = 0;
+    std::thread thread([&] {
+        pin_to_node(cpu_node);
+        auto &kernels = get_kernels(KernelTuner::global().select(nchns, StepType::Ramp));
+        auto ring = (int16_t*)map_node_local(ring_size, mem_node);
+        // Several times the size of the last level cache and read in order
+        // by the chunks, so that the parameters are streamed from the memory node.
+        auto param_steps = (4 * cache_size() / (5 * sizeof(float) * nchns) / chunk_steps + 1) *
+            chunk_steps;
+        size_t nparams = param_steps * 5 * nchns;
+        auto params_size = nparams * sizeof(float);
+        auto values = (float*)map_node_local(params_size, mem_node);
+        std::mt19937 gen(0);
+        std::uniform_real_distribution<float> dis(-0.1f, 0.1f);
+        for (size_t i = 0; i < nparams; i++)
+            values[i] = dis(gen);
+        std::vector<channel_param> ps(nchns);
+        for (int c = 0; c < nchns; c++) {
+            auto p = &values[c * param_steps * 5];
+            ps[c] = {p, p + param_steps, p + param_steps * 2, p + param_steps * 3,
+                     p + param_steps * 4};
+        }
+        auto fbuff = (float*)mapAnonPage(chunk_size / sizeof(int16_t) * sizeof(float),
+                                         Prot::RW);
+        output_stats stats;
+        auto t0 = getTime();
+        // Two passes over the ring.
+        size_t nsamples = 0;
+        size_t param_idx = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            for (size_t offset = 0; offset < ring_size; offset += chunk_size) {
+                kernels.calc_wave(fbuff, chunk_steps, nchns, ps.data(), param_idx);
+                param_idx = (param_idx + chunk_steps) % param_steps;
+                MarkerStream markers(nullptr, 0);
+                kernels.quantize(ring + offset / sizeof(int16_t), fbuff, chunk_steps,
+                                 32767.0f / float(nchns), 0, markers, stats, nullptr);
+                nsamples += chunk_size / sizeof(int16_t);
+            }
+        }
+        ns_per_sample = double(getElapse(t0)) / double(nsamples);
+        unmapPage(fbuff, chunk_size / sizeof(int16_t) * sizeof(float));
+        unmapPage(values, params_size);
+        unmapPage(ring, ring_size);
+    });
+    thread.join();
+    std::cout << "  [CPU node: " << cpu_node << ", memory node: " << mem_node << "] "
+              << ns_per_sample << " ns/sample, "
+              << sizeof(int16_t) / ns_per_sample << " GB/s output"
+              << (cpu_node == mem_node ? " (local)" : " (remote)") << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int nchns = argc >= 2 ? std::max(atoi(argv[1]), 1) : 8;
+    int nnodes = numa_num_nodes();
+    std::cout << "NUMA nodes: " << nnodes << ", tones: " << nchns << std::endl;
+    for (int cpu_node = 0; cpu_node < nnodes; cpu_node++) {
+        if (numa_node_cpus(cpu_node).empty())
+            continue;
+        for (int mem_node = 0; mem_node < nnodes; mem_node++) {
+            bench(cpu_node, mem_node, nchns);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Scheduling latency of a generator thread, with and without the real-time mode.
+//
+//     bench-rt [--rate <samples/s>] [--chunk <samples>] [--tones <n>] [--time <s>]
+//              [--rt <priority>] [--cpu <n>]
+//
+// The thread wakes up every `chunk / rate` seconds, like a generator thread
+// woken up by the card for every chunk, generates and quantizes a chunk into a ring buffer
+// and goes back to sleep. For every chunk, the wake-up latency (from the time
+// the chunk should start to the time the thread runs) and the completion latency
+// (from the same start time to the time the chunk is in the ring) are recorded.
+// A chunk whose completion latency is longer than the period is counted as a miss,
+// which would eat into the lead of the stream on a card.
+//
+// The run is repeated in the real-time mode (`SCHED_FIFO` with `--rt`, pinned to `--cpu`
+// or the first isolated CPU, with the memory locked and the stack pre-faulted)
+// if `--rt` is given. The settings that couldn't be applied (e.g. without the privileges)
+// are reported and the run continues without them.
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/buffer.h>
+#include <nacs-spcm/data_stream.h>
+#include <nacs-spcm/numa.h>
+#include <nacs-spcm/realtime.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+namespace {
+
+struct Options {
+    double rate = 625e6;
+    size_t chunk = 65536;
+    int ntones = 1;
+    double time = 10;
+    int rt_priority = 0;
+    int cpu = -1;
+};
+
+// Latencies in 1 µs bins up to 100 ms.
+class Histogram {
+public:
+    void add(int64_t ns)
+    {
+        auto bin = size_t(std::max<int64_t>(ns, 0) / 1000);
+        m_bins[std::min(bin, nbins - 1)]++;
+        m_max = std::max(m_max, ns);
+        m_sum += double(ns);
+        m_count++;
+    }
+    // Upper bound of the `q` quantile in µs.
+    uint64_t quantile(double q) const
+    {
+        auto target = uint64_t(ceil(q * double(m_count)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < nbins; i++) {
+            seen += m_bins[i];
+            if (seen >= target) {
+                return i + 1;
+            }
+        }
+        return nbins;
+    }
+    void print(const char *name) const
+    {
+        std::cout << std::fixed << std::setprecision(1)
+                  << "    " << std::left << std::setw(11) << name << std::right
+                  << " mean: " << std::setw(8) << m_sum / double(m_count) / 1000
+                  << " µs, 99.9%: <" << std::setw(6) << quantile(0.999)
+                  << " µs, 99.99%: <" << std::setw(6) << quantile(0.9999)
+                  << " µs, max: " << std::setw(8) << double(m_max) / 1000 << " µs"
+                  << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+
+private:
+    static constexpr size_t nbins = 100000;
+    std::vector<uint64_t> m_bins = std::vector<uint64_t>(nbins);
+    int64_t m_max = 0;
+    double m_sum = 0;
+    uint64_t m_count = 0;
+};
+
+static int64_t to_ns(const timespec &t)
+{
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+static timespec from_ns(int64_t ns)
+{
+    return {time_t(ns / 1000000000), long(ns % 1000000000)};
+}
+
+static int64_t now_ns()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return to_ns(t);
+}
+
+static void run(const Options &opts, bool rt)
+{
+    RTStatus status;
+    if (rt) {
+        auto cpu = opts.cpu;
+        if (cpu < 0) {
+            auto isolated = isolated_cpus();
+            if (!isolated.empty()) {
+                cpu = isolated[0];
+            }
+        }
+        status = enter_realtime(opts.rt_priority, cpu);
+    }
+    else if (opts.cpu >= 0) {
+        status.pinned = pin_to_cpu(opts.cpu);
+    }
+    std::cout << (rt ? "Real-time" : "Normal") << " ["
+              << (status.fifo ? "SCHED_FIFO" : "SCHED_OTHER")
+              << (status.pinned ? ", pinned" : "")
+              << (status.locked ? ", locked" : "") << "]:" << std::endl;
+    if (rt && !status.fifo) {
+        std::cout << "    (no permission for SCHED_FIFO, "
+                  << "needs CAP_SYS_NICE or RLIMIT_RTPRIO)" << std::endl;
+    }
+
+    auto &kernels = get_kernels(KernelTuner::global().select(opts.ntones, StepType::Fixed));
+    auto calc_wave = kernels.get_calc_wave_fixed(opts.ntones);
+    auto quantize = kernels.get_quantize(opts.chunk * sizeof(int16_t));
+    constexpr size_t nslots = 32;
+    Buffer ring(opts.chunk * sizeof(int16_t) * nslots);
+    Buffer fbuff(opts.chunk * sizeof(float));
+    std::vector<channel_param_fixed> params(opts.ntones);
+    for (int i = 0; i < opts.ntones; i++)
+        params[i] = {0, 0.01f * float(i + 1), 0.9f / float(opts.ntones)};
+    auto nsteps = opts.chunk / step_size;
+
+    Histogram wakeup;
+    Histogram completion;
+    uint64_t nmiss = 0;
+    auto period = int64_t(double(opts.chunk) / opts.rate * 1e9);
+    auto nchunks = uint64_t(opts.time * 1e9 / double(period));
+    // Start on a period boundary a little later so that the first wake-up is a normal one.
+    auto start = now_ns() + period * 10;
+    for (uint64_t chunk = 0; chunk < nchunks; chunk++) {
+        auto target = start + int64_t(chunk) * period;
+        auto deadline = from_ns(target);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) != 0) {
+        }
+        wakeup.add(now_ns() - target);
+        calc_wave(fbuff.get<float>(), nsteps, opts.ntones, params.data());
+        MarkerStream markers(nullptr, 0);
+        output_stats stats;
+        quantize(ring.get<int16_t>() + (chunk % nslots) * opts.chunk, fbuff.get<float>(),
+                 nsteps, 32767.0f, 0, markers, stats, nullptr);
+        auto done = now_ns() - target;
+        completion.add(done);
+        if (done > period) {
+            nmiss++;
+        }
+    }
+    std::cout << "    period: " << double(period) / 1000 << " µs, chunks: " << nchunks
+              << ", missed: " << nmiss << std::endl;
+    wakeup.print("wake-up");
+    completion.print("completion");
+}
+
+static void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [--rate <samples/s>] [--chunk <samples>]"
+              << " [--tones <n>] [--time <s>] [--rt <priority>] [--cpu <n>]" << std::endl;
+    exit(2);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage(argv[0]);
+        auto val = argv[++i];
+        if (strcmp(arg, "--rate") == 0) {
+            opts.rate = atof(val);
+        }
+        else if (strcmp(arg, "--chunk") == 0) {
+            opts.chunk = std::max<size_t>(size_t(atoll(val)) / step_size, 1) * step_size;
+        }
+        else if (strcmp(arg, "--tones") == 0) {
+            opts.ntones = std::max(atoi(val), 1);
+        }
+        else if (strcmp(arg, "--time") == 0) {
+            opts.time = atof(val);
+        }
+        else if (strcmp(arg, "--rt") == 0) {
+            opts.rt_priority = atoi(val);
+        }
+        else if (strcmp(arg, "--cpu") == 0) {
+            opts.cpu = atoi(val);
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    // Each mode on a new thread so that the normal run isn't affected
+    // by the settings of the real-time one.
+    std::thread([&] { run(opts, false); }).join();
+    if (opts.rt_priority > 0)
+        std::thread([&] { run(opts, true); }).join();
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Sustained generation from a sequence file streamed from disk.
+//
+//     bench-seq_stream <path> [<nchns>] [<size in MiB>]
+//
+// Writes a sequence file of the given size (16 tones and 4 GiB by default)
+// to `path` (which should be on the disk to test), drops it from the page cache
+// and then generates and quantizes all the samples from the streamed parameters.
+// The rate is compared with the card rate of 625 MS/s, which needs 390 MB/s
+// from the disk for each tone, and the time the generator waited for the disk
+// is reported.
+// Use a size larger than the memory to make sure nothing is cached.
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/data_stream.h>
+#include <nacs-spcm/seq_stream.h>
+
+#include <nacs-utils/timer.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr double card_rate = 625e6;
+static constexpr size_t gen_steps = 1024;
+
+// Written one array at a time so that the file can be larger than the memory.
+static void write_file(const std::string &path, int nchns, size_t size)
+{
+    auto nsteps = size / (sizeof(float) * 5 * nchns);
+    auto header = SeqFileHeader::create(uint32_t(nchns), nsteps, card_rate);
+    header.flags = SeqFileHeader::HasDFreq | SeqFileHeader::HasDAmp;
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dis(-0.1f, 0.1f);
+    std::vector<float> block(1024 * 1024);
+    for (auto &v: block)
+        v = dis(gen);
+    std::ofstream stm(path, std::ios::binary | std::ios::trunc);
+    stm.write((const char*)&header, sizeof(header));
+    stm.seekp(header.data_offset);
+    for (int i = 0; i < nchns * 5; i++) {
+        for (size_t k = 0; k < header.stride; k += block.size()) {
+            auto n = std::min(block.size(), header.stride - k);
+            stm.write((const char*)block.data(), n * sizeof(float));
+        }
+    }
+    stm.flush();
+    if (!stm) {
+        std::cerr << "Cannot write " << path << std::endl;
+        exit(1);
+    }
+}
+
+static void drop_cache(const std::string &path)
+{
+    auto fd = open(path.c_str(), O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <path> [<nchns>] [<size in MiB>]"
+                  << std::endl;
+        return 1;
+    }
+    std::string path(argv[1]);
+    int nchns = argc >= 3 ? std::max(atoi(argv[2]), 1) : 16;
+    size_t size = (argc >= 4 ? std::max(atoi(argv[3]), 1) : 4096) * size_t(1024 * 1024);
+    write_file(path, nchns, size);
+    drop_cache(path);
+
+    auto &kernels = get_kernels(KernelTuner::global().select(nchns, StepType::Ramp));
+    // The kernels require aligned output.
+    Buffer fbuff(gen_steps * step_size * sizeof(float));
+    Buffer out(gen_steps * step_size * sizeof(int16_t));
+    std::vector<channel_param> ps(nchns);
+    output_stats stats;
+    auto t0 = getTime();
+    SeqStream stream(path);
+    while (auto chunk = stream.get()) {
+        for (int c = 0; c < nchns; c++)
+            ps[c] = {chunk->phase(c), chunk->freq(c), chunk->dfreq(c), chunk->amp(c),
+                     chunk->damp(c)};
+        for (size_t k = 0; k < chunk->nsteps; k += gen_steps) {
+            auto n = std::min(gen_steps, chunk->nsteps - k);
+            kernels.calc_wave(fbuff.get<float>(), n, nchns, ps.data(), k);
+            MarkerStream markers(nullptr, 0);
+            kernels.quantize(out.get<int16_t>(), fbuff.get<float>(), n,
+                             32767.0f / float(nchns), 0, markers, stats, nullptr);
+        }
+        stream.release();
+    }
+    auto elapsed = double(getElapse(t0)) * 1e-9;
+    unlink(path.c_str());
+
+    auto sstats = stream.stats();
+    auto rate = double(stream.nsteps() * step_size) / elapsed;
+    std::cout << "Tones: " << nchns << ", file: " << size / 1024 / 1024 << " MiB ["
+              << kernel_isa_name(kernels.isa) << "]" << std::endl;
+    std::cout << "  Generated " << rate / 1e6 << " MS/s (" << rate / card_rate * 100
+              << "% of the card rate)" << std::endl;
+    std::cout << "  Read " << double(sstats.bytes_read) / 1024 / 1024 / elapsed
+              << " MiB/s sustained, "
+              << double(sstats.bytes_read) / 1024 / 1024 / (double(sstats.read_time) * 1e-9)
+              << " MiB/s while reading" << std::endl;
+    // Five floats per step for each tone.
+    auto tone_rate = card_rate / step_size * sizeof(float) * 5;
+    auto read_rate = double(sstats.bytes_read) / (double(sstats.read_time) * 1e-9);
+    std::cout << "  The card rate needs " << tone_rate * nchns / 1024 / 1024
+              << " MiB/s, the read rate would sustain it for up to "
+              << int(read_rate / tone_rate) << " tones" << std::endl;
+    std::cout << "  Waited for the disk " << sstats.nstalls << " times, "
+              << double(sstats.stall_time) * 1e-9 / elapsed * 100 << "% of the time"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,403 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// End-to-end streaming benchmark.
+// Finds the maximum number of tones per output channel that can be streamed
+// at the full sample rate without underrun, for each instruction set and
+// number of generator threads.
+//
+//     bench-stream [--rate <samples/s>] [--nchns <outputs>] [--type fixed|ramp]
+//                  [--chunk <samples>] [--slots <n>] [--time <ms>]
+//                  [--threads <n>,...] [--isa <name>]
+//
+// The streaming path is emulated without a card:
+// the generator threads claim chunks in order, compute all the tones for every
+// output channel with the kernels from the kernel table, quantize the result
+// into a slot of a ring buffer and mark the slot as ready.
+// The DMA consumer thread starts once the ring is full and then releases one
+// chunk every `chunk / rate` seconds, exactly like the card would read it.
+// The run fails if a chunk is not ready at the time it should be read.
+// The maximum tone count is found by doubling and then bisecting,
+// and the idle fraction of the generator threads at that tone count is reported
+// as the headroom.
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/data_stream.h>
+
+#include <nacs-utils/mem.h>
+#include <nacs-utils/timer.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+namespace {
+
+struct Options {
+    double rate = 625e6;
+    int nchns = 1;
+    StepType type = StepType::Fixed;
+    size_t chunk = 65536;
+    size_t nslots = 32;
+    double time_ms = 300;
+    std::vector<int> threads;
+    int isa = -1;
+};
+
+struct RunResult {
+    bool ok;
+    // Fraction of the time the generator threads were computing.
+    double busy;
+};
+
+class Stream {
+public:
+    Stream(const Options &opts, const KernelTable &kernels, int ntones, int nthreads);
+    ~Stream();
+    RunResult run();
+
+private:
+    struct Tone {
+        double phase;
+        double freq;
+        float amp;
+    };
+    void worker();
+    void generate(uint64_t chunk, int16_t *out, float *buff,
+                  std::vector<channel_param_fixed> &fixed);
+    void consumer();
+    int16_t *slot(uint64_t chunk) const
+    {
+        return m_ring + (chunk % m_opts.nslots) * m_slot_size;
+    }
+
+    const Options &m_opts;
+    const KernelTable &m_kernels;
+    const int m_ntones;
+    const int m_nthreads;
+    const size_t m_nsteps;
+    const size_t m_slot_size;
+    const uint64_t m_total;
+    int16_t *m_ring;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_ready;
+    // Tones for each output channel.
+    std::vector<std::vector<Tone>> m_tones;
+    // Per step parameters for the ramps, reused for every chunk.
+    std::vector<float> m_ramp_values;
+    std::vector<std::vector<channel_param>> m_ramps;
+
+    std::atomic<uint64_t> m_next{0};
+    std::atomic<uint64_t> m_consumed{0};
+    std::atomic<bool> m_stop{false};
+    std::atomic<uint64_t> m_busy{0};
+    bool m_underrun = false;
+};
+
+Stream::Stream(const Options &opts, const KernelTable &kernels, int ntones, int nthreads)
+    : m_opts(opts),
+      m_kernels(kernels),
+      m_ntones(ntones),
+      m_nthreads(nthreads),
+      m_nsteps(opts.chunk / step_size),
+      m_slot_size(opts.chunk * opts.nchns),
+      m_total(uint64_t(opts.time_ms * 1e-3 * opts.rate / double(opts.chunk)) + opts.nslots),
+      m_ring((int16_t*)mapAnonPage(m_slot_size * opts.nslots * sizeof(int16_t), Prot::RW)),
+      m_ready(new std::atomic<uint64_t>[opts.nslots]),
+      m_tones(opts.nchns)
+{
+    for (size_t i = 0; i < opts.nslots; i++)
+        m_ready[i].store(0, std::memory_order_relaxed);
+    std::mt19937 gen(0);
+    // Up to a quarter of the sample rate.
+    std::uniform_real_distribution<double> freq_dis(0, step_size / 4.0);
+    std::uniform_real_distribution<double> phase_dis(-1, 1);
+    for (auto &tones: m_tones) {
+        tones.resize(ntones);
+        for (auto &tone: tones) {
+            tone.phase = phase_dis(gen);
+            tone.freq = freq_dis(gen);
+            tone.amp = 1.0f / float(ntones);
+        }
+    }
+    if (opts.type == StepType::Ramp) {
+        m_ramp_values.resize(size_t(opts.nchns) * ntones * 5 * m_nsteps);
+        std::uniform_real_distribution<float> dis(-1e-3f, 1e-3f);
+        for (auto &v: m_ramp_values)
+            v = dis(gen);
+        m_ramps.resize(opts.nchns);
+        for (int o = 0; o < opts.nchns; o++) {
+            for (int i = 0; i < ntones; i++) {
+                auto p = &m_ramp_values[(size_t(o) * ntones + i) * 5 * m_nsteps];
+                auto &tone = m_tones[o][i];
+                for (size_t s = 0; s < m_nsteps; s++) {
+                    p[s] = float(tone.phase);
+                    p[m_nsteps + s] = float(tone.freq);
+                    p[m_nsteps * 3 + s] = tone.amp / 2;
+                }
+                m_ramps[o].push_back({p, p + m_nsteps, p + m_nsteps * 2,
+                                      p + m_nsteps * 3, p + m_nsteps * 4});
+            }
+        }
+    }
+}
+
+Stream::~Stream()
+{
+    unmapPage(m_ring, m_slot_size * m_opts.nslots * sizeof(int16_t));
+}
+
+void Stream::generate(uint64_t chunk, int16_t *out, float *buff,
+                      std::vector<channel_param_fixed> &fixed)
+{
+    for (int o = 0; o < m_opts.nchns; o++) {
+        if (m_opts.type == StepType::Fixed) {
+            // The phase at the start of the chunk is computed from the chunk index
+            // in double precision so that the chunks can be generated in any order.
+            double nsteps = double(chunk * m_nsteps);
+            for (int i = 0; i < m_ntones; i++) {
+                auto &tone = m_tones[o][i];
+                double phase = tone.phase + 2 * tone.freq * nsteps;
+                phase -= 2 * nearbyint(phase / 2);
+                fixed[i] = {float(phase), float(tone.freq), tone.amp};
+            }
+            m_kernels.get_calc_wave_fixed(m_ntones)(buff, m_nsteps, m_ntones, fixed.data());
+        }
+        else {
+            m_kernels.get_calc_wave(m_ntones)(buff, m_nsteps, m_ntones,
+                                              m_ramps[o].data(), 0);
+        }
+        MarkerStream markers(nullptr, 0);
+        output_stats stats;
+        auto quantize = m_kernels.get_quantize(m_slot_size * sizeof(int16_t));
+        quantize(out + o * m_opts.chunk, buff, m_nsteps, 32767.0f, 0,
+                 markers, stats, nullptr);
+    }
+}
+
+void Stream::worker()
+{
+    auto buff = (float*)mapAnonPage(m_opts.chunk * sizeof(float), Prot::RW);
+    std::vector<channel_param_fixed> fixed(m_ntones);
+    uint64_t busy = 0;
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        auto chunk = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= m_total)
+            break;
+        // Wait for the consumer to release the slot.
+        while (chunk >= m_consumed.load(std::memory_order_acquire) + m_opts.nslots) {
+            if (m_stop.load(std::memory_order_relaxed))
+                goto done;
+            std::this_thread::yield();
+        }
+        {
+            auto t0 = getTime();
+            generate(chunk, slot(chunk), buff, fixed);
+            busy += getElapse(t0);
+        }
+        m_ready[chunk % m_opts.nslots].store(chunk + 1, std::memory_order_release);
+    }
+done:
+    m_busy.fetch_add(busy, std::memory_order_relaxed);
+    unmapPage(buff, m_opts.chunk * sizeof(float));
+}
+
+void Stream::consumer()
+{
+    auto is_ready = [&] (uint64_t chunk) {
+        return m_ready[chunk % m_opts.nslots].load(std::memory_order_acquire) == chunk + 1;
+    };
+    // The card starts with the buffer filled.
+    for (uint64_t chunk = 0; chunk < m_opts.nslots; chunk++) {
+        while (!is_ready(chunk)) {
+            std::this_thread::yield();
+        }
+    }
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double chunk_ns = double(m_opts.chunk) / m_opts.rate * 1e9;
+    for (uint64_t chunk = 0; chunk < m_total; chunk++) {
+        // Chunk `chunk` is read starting at `start + chunk * chunk_ns`,
+        // which is also when the previous chunk is released.
+        auto ns = uint64_t(double(chunk) * chunk_ns) + uint64_t(start.tv_nsec);
+        timespec deadline{time_t(start.tv_sec + time_t(ns / 1000000000)),
+                          long(ns % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) != 0) {
+        }
+        if (!is_ready(chunk)) {
+            m_underrun = true;
+            break;
+        }
+        m_consumed.store(chunk, std::memory_order_release);
+    }
+    m_stop.store(true, std::memory_order_relaxed);
+}
+
+RunResult Stream::run()
+{
+    std::vector<std::thread> workers;
+    auto t0 = getTime();
+    for (int i = 0; i < m_nthreads; i++)
+        workers.emplace_back([&] { worker(); });
+    consumer();
+    for (auto &w: workers)
+        w.join();
+    auto elapsed = getElapse(t0);
+    return {!m_underrun, double(m_busy.load()) / double(elapsed) / m_nthreads};
+}
+
+static RunResult run_stream(const Options &opts, KernelISA isa, int ntones, int nthreads)
+{
+    Stream stream(opts, get_kernels(isa), ntones, nthreads);
+    return stream.run();
+}
+
+static void bisect(const Options &opts, KernelISA isa, int nthreads)
+{
+    constexpr int max_tones = 4096;
+    int good = 0;
+    RunResult good_res{true, 0};
+    int bad = 1;
+    // Double until the first failure and bisect between the last success and it.
+    while (bad <= max_tones) {
+        auto res = run_stream(opts, isa, bad, nthreads);
+        if (!res.ok)
+            break;
+        good = bad;
+        good_res = res;
+        bad *= 2;
+    }
+    while (bad - good > 1 && good < max_tones) {
+        int mid = (good + bad) / 2;
+        auto res = run_stream(opts, isa, mid, nthreads);
+        if (res.ok) {
+            good = mid;
+            good_res = res;
+        }
+        else {
+            bad = mid;
+        }
+    }
+    std::cout << "  [threads: " << nthreads << "] max tones: " << good
+              << " (" << std::fixed << std::setprecision(1)
+              << double(good) * opts.nchns / nthreads << " tone-channels/thread)";
+    if (good > 0)
+        std::cout << "; headroom: " << (1 - good_res.busy) * 100 << "%";
+    std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+static void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [--rate <samples/s>] [--nchns <outputs>]"
+              << " [--type fixed|ramp] [--chunk <samples>] [--slots <n>] [--time <ms>]"
+              << " [--threads <n>,...] [--isa <name>]" << std::endl;
+    exit(2);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (i + 1 >= argc)
+            usage(argv[0]);
+        auto val = argv[++i];
+        if (strcmp(arg, "--rate") == 0) {
+            opts.rate = atof(val);
+        }
+        else if (strcmp(arg, "--nchns") == 0) {
+            opts.nchns = std::max(atoi(val), 1);
+        }
+        else if (strcmp(arg, "--type") == 0) {
+            if (strcmp(val, "fixed") == 0) {
+                opts.type = StepType::Fixed;
+            }
+            else if (strcmp(val, "ramp") == 0) {
+                opts.type = StepType::Ramp;
+            }
+            else {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(arg, "--chunk") == 0) {
+            opts.chunk = std::max<size_t>(strtoul(val, nullptr, 0) / step_size, 1) * step_size;
+        }
+        else if (strcmp(arg, "--slots") == 0) {
+            opts.nslots = std::max<size_t>(strtoul(val, nullptr, 0), 2);
+        }
+        else if (strcmp(arg, "--time") == 0) {
+            opts.time_ms = atof(val);
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            std::istringstream stm(val);
+            std::string item;
+            while (std::getline(stm, item, ','))
+                opts.threads.push_back(std::max(atoi(item.c_str()), 1));
+        }
+        else if (strcmp(arg, "--isa") == 0) {
+            for (int isa = 0; isa < num_kernel_isa; isa++) {
+                if (strcmp(val, kernel_isa_name(KernelISA(isa))) == 0) {
+                    opts.isa = isa;
+                }
+            }
+            if (opts.isa < 0) {
+                usage(argv[0]);
+            }
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (opts.threads.empty()) {
+        int ncpus = std::max<int>(std::thread::hardware_concurrency(), 1);
+        for (int n = 1; n < ncpus; n *= 2)
+            opts.threads.push_back(n);
+        opts.threads.push_back(ncpus);
+    }
+
+    std::cout << "Rate: " << opts.rate / 1e6 << " MS/s; outputs: " << opts.nchns
+              << "; chunk: " << opts.chunk << " samples ("
+              << double(opts.chunk) / opts.rate * 1e6 << " us); ring: " << opts.nslots
+              << " chunks; " << (opts.type == StepType::Fixed ? "fixed" : "ramp")
+              << " tones" << std::endl;
+    for (int i = 0; i < num_kernel_isa; i++) {
+        auto isa = KernelISA(i);
+        if (!kernel_isa_supported(isa) || (opts.isa >= 0 && opts.isa != i))
+            continue;
+        std::cout << kernel_isa_name(isa) << ":" << std::endl;
+        for (auto nthreads: opts.threads) {
+            bisect(opts, isa, nthreads);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+// Time to compile a shot of tone timelines compared to the duration of the shot,
+// which must be much shorter so that the next shot can be compiled
+// while the current one is playing.
+//
+//     bench-timeline [<nchns>] [<duration in ms>] [<nthreads>]
+//
+// The shot with a cubic ramp every 10 us on every tone writes all five arrays
+// and the one with static tones skips the slopes.
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/data_stream.h>
+#include <nacs-spcm/timeline.h>
+
+#include <nacs-utils/timer.h>
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr double sample_rate = 625e6;
+
+static void bench(const char *name, const std::vector<ToneTimeline> &tones,
+                  double duration, int nthreads)
+{
+    auto nsteps = size_t(duration * sample_rate / step_size);
+    auto t0 = getTime();
+    auto res = compile_timeline(tones, sample_rate, nsteps, nthreads);
+    auto first = double(getElapse(t0)) * 1e-9;
+    // The best of a few runs so that the result isn't affected by other processes.
+    double elapsed = INFINITY;
+    for (int i = 0; i < 10; i++) {
+        t0 = getTime();
+        compile_timeline(res, tones, sample_rate, nthreads);
+        elapsed = std::min(elapsed, double(getElapse(t0)) * 1e-9);
+    }
+    std::cout << "  " << name << ": " << elapsed * 1e3 << " ms ("
+              << elapsed / duration * 100 << "% of the shot), "
+              << first * 1e3 << " ms with allocation" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int nchns = argc >= 2 ? std::max(atoi(argv[1]), 1) : 16;
+    double duration = (argc >= 3 ? std::max(atof(argv[2]), 0.01) : 20) * 1e-3;
+    int nthreads = argc >= 4 ? std::max(atoi(argv[3]), 0) : 0;
+    std::cout << "Tones: " << nchns << ", shot: " << duration * 1e3 << " ms" << std::endl;
+    std::vector<ToneTimeline> tones(nchns);
+    for (int c = 0; c < nchns; c++) {
+        for (double t = 0; t < duration; t += 1e-5) {
+            tones[c].ramps.push_back({t, 1e-5, 10e6 + c * 1e6, 10.5e6 + c * 1e6,
+                                      0.05, 0.06, RampShape::Cubic});
+        }
+    }
+    bench("Ramps", tones, duration, nthreads);
+    for (int c = 0; c < nchns; c++)
+        tones[c].ramps = {{0, duration, 10e6 + c * 1e6, 10e6 + c * 1e6, 0.05, 0.05}};
+    bench("Static", tones, duration, nthreads);
+    return 0;
+}
@@ -21,23 +21,6 @@
 using namespace NaCs;
 using namespace NaCs::Spcm;
 
-#define OUT_ATTR __restrict__ __attribute__((aligned(64)))
-#define PARAM_ATTR __restrict__
-
-struct channel_param_fixed {
-    float phase;
-    float freq;
-    float amp;
-};
-
-struct channel_param {
-    const float *phase;
-    const float *freq;
-    const float *dfreq;
-    const float *amp;
-    const float *damp;
-};
-
 static NACS_INLINE void leak_data(const void *p)
 {
     asm volatile ("" :: "r"(p): "memory");
@@ -79,6 +62,91 @@ static NACS_INLINE void _run_wave(float *data, size_t sz, size_t rep, int nchn,
     }
 }
 
+template<typename Gen>
+static NACS_INLINE void _run_wave_iq(float *data_i, float *data_q, size_t sz, size_t rep,
+                                     int nchn, const channel_param *params)
+{
+    assume(rep > 0);
+    assume(sz > 0);
+    for (size_t r = 0; r < rep; r++) {
+        for (size_t offset = 0; offset < sz; offset += step_size) {
+            leak_data(&nchn);
+            leak_data(params);
+            Gen::calc_wave_iq(&data_i[offset], &data_q[offset], nchn, params,
+                              offset / step_size);
+        }
+    }
+}
+
+// `data` is of size `sz * 2` with the I and Q outputs interleaved.
+template<typename Gen>
+static NACS_INLINE void _run_wave_iq_interleave(float *data, size_t sz, size_t rep,
+                                                int nchn, const channel_param *params)
+{
+    assume(rep > 0);
+    assume(sz > 0);
+    for (size_t r = 0; r < rep; r++) {
+        for (size_t offset = 0; offset < sz; offset += step_size) {
+            leak_data(&nchn);
+            leak_data(params);
+            Gen::calc_wave_iq_interleave(&data[offset * 2], nchn, params,
+                                         offset / step_size);
+        }
+    }
+}
+
+template<typename Gen>
+static NACS_INLINE void _run_wave_calib(float *data, size_t sz, size_t rep, int nchn,
+                                        const channel_param *params,
+                                        const channel_calib *calib)
+{
+    assume(rep > 0);
+    assume(sz > 0);
+    for (size_t r = 0; r < rep; r++) {
+        for (size_t offset = 0; offset < sz; offset += step_size) {
+            leak_data(&nchn);
+            leak_data(params);
+            Gen::calc_wave_calib(&data[offset], nchn, params, offset / step_size, calib);
+        }
+    }
+}
+
+// Convert `sz` samples from `data` into `out` with the marker bits from `runs`.
+// The peak and clipping statistics are accumulated in `stats`.
+// Dither is added if `dither` is not `NULL`.
+template<typename Gen>
+static NACS_INLINE void _run_quantize(int16_t *out, const float *data, size_t sz, size_t rep,
+                                      float scale, int nbits, const marker_run *runs,
+                                      size_t nruns, output_stats &stats,
+                                      dither_state *dither=nullptr)
+{
+    assume(rep > 0);
+    assume(sz > 0);
+    for (size_t r = 0; r < rep; r++) {
+        MarkerStream markers(runs, nruns);
+        leak_data(&scale);
+        Gen::quantize(out, data, sz / step_size, scale, nbits, markers, stats, dither);
+    }
+}
+
+// Channels computed at `1 / R` of the full rate.
+// `params` is indexed by the low rate step and the output is accumulated into `data`.
+template<typename Gen, int R>
+static NACS_INLINE void _run_wave_lowrate(float *data, size_t sz, size_t rep, int nchn,
+                                          const channel_param *params, Upsampler<R> &up)
+{
+    assume(rep > 0);
+    assume(sz > 0);
+    for (size_t r = 0; r < rep; r++) {
+        for (size_t offset = 0; offset < sz; offset += step_size * R) {
+            leak_data(&nchn);
+            leak_data(params);
+            Gen::accum_wave_lowrate(&data[offset], nchn, params,
+                                    offset / (step_size * R), up);
+        }
+    }
+}
+
 // The generators for non-default implementations implement this class
 // to add the correct target attribute so that the inlining is allowed.
 // However, since the implementation of the loop (`_run_wave` and `_run_wave_fixed`)
@@ -102,73 +170,36 @@ struct Runner {
     {
         _run_wave<Gen>(std::forward<Args>(args)...);
     }
-};
-
-struct ScalarGen {
-    static NACS_INLINE void calc_wave_fixed(float *OUT_ATTR output, int nchns,
-                                            const channel_param_fixed *PARAM_ATTR params)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i++) {
-            float o = 0;
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += scalar::calc_single_chn(i, p.phase, p.freq, p.amp);
-            }
-            output[i] = o;
-        }
+    template<typename... Args>
+    static void __attribute__((flatten)) run_wave_iq(Args&&... args)
+    {
+        _run_wave_iq<Gen>(std::forward<Args>(args)...);
     }
-    static NACS_INLINE void calc_wave(float *OUT_ATTR output, int nchns,
-                                      const channel_param *PARAM_ATTR params,
-                                      size_t param_idx)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i++) {
-            float o = 0;
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += scalar::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
-                                             p.amp[param_idx], p.dfreq[param_idx],
-                                             p.damp[param_idx]);
-            }
-            output[i] = o;
-        }
+    template<typename... Args>
+    static void __attribute__((flatten)) run_wave_iq_interleave(Args&&... args)
+    {
+        _run_wave_iq_interleave<Gen>(std::forward<Args>(args)...);
     }
-};
-
-#if NACS_CPU_X86 || NACS_CPU_X86_64
-struct SSE2Gen {
-    static inline __attribute__((target("sse2")))
-    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
-                         const channel_param_fixed *PARAM_ATTR params)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 4) {
-            auto o = _mm_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += sse2::calc_single_chn(i, p.phase, p.freq, p.amp);
-            }
-            _mm_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((flatten)) run_wave_calib(Args&&... args)
+    {
+        _run_wave_calib<Gen>(std::forward<Args>(args)...);
     }
-    static inline __attribute__((target("sse2")))
-    void calc_wave(float *OUT_ATTR output, int nchns,
-                   const channel_param *PARAM_ATTR params, size_t param_idx)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 4) {
-            auto o = _mm_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += sse2::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
-                                           p.amp[param_idx], p.dfreq[param_idx],
-                                           p.damp[param_idx]);
-            }
-            _mm_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((flatten)) run_quantize(Args&&... args)
+    {
+        _run_quantize<Gen>(std::forward<Args>(args)...);
+    }
+    template<int R>
+    static void __attribute__((flatten))
+    run_wave_lowrate(float *data, size_t sz, size_t rep, int nchn,
+                     const channel_param *params, Upsampler<R> &up)
+    {
+        _run_wave_lowrate<Gen>(data, sz, rep, nchn, params, up);
     }
 };
+
+#if NACS_CPU_X86 || NACS_CPU_X86_64
 template<>
 struct Runner<SSE2Gen> {
     template<typename... Args>
@@ -183,40 +214,39 @@ struct Runner<SSE2Gen> {
     {
         _run_wave<SSE2Gen>(std::forward<Args>(args)...);
     }
-};
-
-struct AVXGen {
-    static inline __attribute__((target("avx")))
-    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
-                         const channel_param_fixed *PARAM_ATTR params)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 8) {
-            auto o = _mm256_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += avx::calc_single_chn(i, p.phase, p.freq, p.amp);
-            }
-            _mm256_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((target("sse2"), flatten))
+    run_wave_iq(Args&&... args)
+    {
+        _run_wave_iq<SSE2Gen>(std::forward<Args>(args)...);
     }
-    static inline __attribute__((target("avx")))
-    void calc_wave(float *OUT_ATTR output, int nchns,
-                   const channel_param *PARAM_ATTR params, size_t param_idx)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 8) {
-            auto o = _mm256_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += avx::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
-                                          p.amp[param_idx], p.dfreq[param_idx],
-                                          p.damp[param_idx]);
-            }
-            _mm256_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((target("sse2"), flatten))
+    run_wave_iq_interleave(Args&&... args)
+    {
+        _run_wave_iq_interleave<SSE2Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("sse2"), flatten))
+    run_wave_calib(Args&&... args)
+    {
+        _run_wave_calib<SSE2Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("sse2"), flatten))
+    run_quantize(Args&&... args)
+    {
+        _run_quantize<SSE2Gen>(std::forward<Args>(args)...);
+    }
+    template<int R>
+    static void __attribute__((target("sse2"), flatten))
+    run_wave_lowrate(float *data, size_t sz, size_t rep, int nchn,
+                     const channel_param *params, Upsampler<R> &up)
+    {
+        _run_wave_lowrate<SSE2Gen>(data, sz, rep, nchn, params, up);
     }
 };
+
 template<>
 struct Runner<AVXGen> {
     template<typename... Args>
@@ -231,40 +261,39 @@ struct Runner<AVXGen> {
     {
         _run_wave<AVXGen>(std::forward<Args>(args)...);
     }
-};
-
-struct AVX2Gen {
-    static inline __attribute__((target("avx2,fma")))
-    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
-                         const channel_param_fixed *PARAM_ATTR params)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 8) {
-            auto o = _mm256_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += avx2::calc_single_chn(i, p.phase, p.freq, p.amp);
-            }
-            _mm256_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((target("avx"), flatten))
+    run_wave_iq(Args&&... args)
+    {
+        _run_wave_iq<AVXGen>(std::forward<Args>(args)...);
     }
-    static inline __attribute__((target("avx2,fma")))
-    void calc_wave(float *OUT_ATTR output, int nchns,
-                   const channel_param *PARAM_ATTR params, size_t param_idx)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 8) {
-            auto o = _mm256_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += avx2::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
-                                           p.amp[param_idx], p.dfreq[param_idx],
-                                           p.damp[param_idx]);
-            }
-            _mm256_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((target("avx"), flatten))
+    run_wave_iq_interleave(Args&&... args)
+    {
+        _run_wave_iq_interleave<AVXGen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx"), flatten))
+    run_wave_calib(Args&&... args)
+    {
+        _run_wave_calib<AVXGen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx"), flatten))
+    run_quantize(Args&&... args)
+    {
+        _run_quantize<AVXGen>(std::forward<Args>(args)...);
+    }
+    template<int R>
+    static void __attribute__((target("avx"), flatten))
+    run_wave_lowrate(float *data, size_t sz, size_t rep, int nchn,
+                     const channel_param *params, Upsampler<R> &up)
+    {
+        _run_wave_lowrate<AVXGen>(data, sz, rep, nchn, params, up);
     }
 };
+
 template<>
 struct Runner<AVX2Gen> {
     template<typename... Args>
@@ -279,40 +308,39 @@ struct Runner<AVX2Gen> {
     {
         _run_wave<AVX2Gen>(std::forward<Args>(args)...);
     }
-};
-
-struct AVX512Gen {
-    static inline __attribute__((target("avx512f,avx512dq")))
-    void calc_wave_fixed(float *OUT_ATTR output, int nchns,
-                         const channel_param_fixed *PARAM_ATTR params)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 16) {
-            auto o = _mm512_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += avx512::calc_single_chn(i, p.phase, p.freq, p.amp);
-            }
-            _mm512_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((target("avx2,fma"), flatten))
+    run_wave_iq(Args&&... args)
+    {
+        _run_wave_iq<AVX2Gen>(std::forward<Args>(args)...);
     }
-    static inline __attribute__((target("avx512f,avx512dq")))
-    void calc_wave(float *OUT_ATTR output, int nchns,
-                   const channel_param *PARAM_ATTR params, size_t param_idx)
-    {
-        assume(nchns > 0);
-        for (int i = 0; i < step_size; i += 16) {
-            auto o = _mm512_set1_ps(0);
-            for (int c = 0; c < nchns; c++) {
-                auto p = params[c];
-                o += avx512::calc_single_chn(i, p.phase[param_idx], p.freq[param_idx],
-                                             p.amp[param_idx], p.dfreq[param_idx],
-                                             p.damp[param_idx]);
-            }
-            _mm512_store_ps(&output[i], o);
-        }
+    template<typename... Args>
+    static void __attribute__((target("avx2,fma"), flatten))
+    run_wave_iq_interleave(Args&&... args)
+    {
+        _run_wave_iq_interleave<AVX2Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx2,fma"), flatten))
+    run_wave_calib(Args&&... args)
+    {
+        _run_wave_calib<AVX2Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx2,fma"), flatten))
+    run_quantize(Args&&... args)
+    {
+        _run_quantize<AVX2Gen>(std::forward<Args>(args)...);
+    }
+    template<int R>
+    static void __attribute__((target("avx2,fma"), flatten))
+    run_wave_lowrate(float *data, size_t sz, size_t rep, int nchn,
+                     const channel_param *params, Upsampler<R> &up)
+    {
+        _run_wave_lowrate<AVX2Gen>(data, sz, rep, nchn, params, up);
     }
 };
+
 template<>
 struct Runner<AVX512Gen> {
     template<typename... Args>
@@ -327,5 +355,36 @@ struct Runner<AVX512Gen> {
     {
         _run_wave<AVX512Gen>(std::forward<Args>(args)...);
     }
+    template<typename... Args>
+    static void __attribute__((target("avx512f,avx512dq"), flatten))
+    run_wave_iq(Args&&... args)
+    {
+        _run_wave_iq<AVX512Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx512f,avx512dq"), flatten))
+    run_wave_iq_interleave(Args&&... args)
+    {
+        _run_wave_iq_interleave<AVX512Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx512f,avx512dq"), flatten))
+    run_wave_calib(Args&&... args)
+    {
+        _run_wave_calib<AVX512Gen>(std::forward<Args>(args)...);
+    }
+    template<typename... Args>
+    static void __attribute__((target("avx512f,avx512dq"), flatten))
+    run_quantize(Args&&... args)
+    {
+        _run_quantize<AVX512Gen>(std::forward<Args>(args)...);
+    }
+    template<int R>
+    static void __attribute__((target("avx512f,avx512dq"), flatten))
+    run_wave_lowrate(float *data, size_t sz, size_t rep, int nchn,
+                     const channel_param *params, Upsampler<R> &up)
+    {
+        _run_wave_lowrate<AVX512Gen>(data, sz, rep, nchn, params, up);
+    }
 };
 #endif
@@ -0,0 +1,111 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <initializer_list>
+#include <utility>
+
+// A group of hardware counters for the current thread, given as `(type, config)`
+// pairs of `perf_event_attr`. Only the user space events are counted so that
+// it works with the default `perf_event_paranoid` setting.
+// Counters that cannot be opened (no PMU in a VM, `perf_event_paranoid` too high,
+// ...) are reported as `NAN`.
+class PerfCounters {
+public:
+    static constexpr int max_events = 8;
+    PerfCounters(std::initializer_list<std::pair<uint32_t,uint64_t>> events)
+    {
+        for (auto event: events) {
+            if (m_nevents >= max_events)
+                break;
+            int i = m_nevents++;
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = event.first;
+            attr.size = sizeof(attr);
+            attr.config = event.second;
+            attr.disabled = m_leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = (PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                PERF_FORMAT_TOTAL_TIME_RUNNING);
+            int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, m_leader, 0);
+            if (fd < 0) {
+                m_idx[i] = -1;
+                continue;
+            }
+            if (m_leader < 0)
+                m_leader = fd;
+            m_idx[i] = m_nfds;
+            m_fds[m_nfds++] = fd;
+        }
+    }
+    ~PerfCounters()
+    {
+        for (int i = 0; i < m_nfds; i++) {
+            close(m_fds[i]);
+        }
+    }
+    bool available() const
+    {
+        return m_leader >= 0;
+    }
+    void start()
+    {
+        if (m_leader < 0)
+            return;
+        ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    // `res` has one element for each event.
+    void stop(double *res)
+    {
+        for (int i = 0; i < m_nevents; i++)
+            res[i] = NAN;
+        if (m_leader < 0)
+            return;
+        ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // nr, time_enabled, time_running, values...
+        uint64_t buff[3 + max_events];
+        if (read(m_leader, buff, sizeof(buff)) < ssize_t(sizeof(uint64_t) * (3 + m_nfds)))
+            return;
+        if (buff[2] == 0)
+            return;
+        // Scale up if the counters were multiplexed with other users of the PMU.
+        double scale = double(buff[1]) / double(buff[2]);
+        for (int i = 0; i < m_nevents; i++) {
+            if (m_idx[i] >= 0) {
+                res[i] = double(buff[3 + m_idx[i]]) * scale;
+            }
+        }
+    }
+
+private:
+    int m_leader = -1;
+    int m_nevents = 0;
+    int m_nfds = 0;
+    int m_fds[max_events];
+    int m_idx[max_events];
+};
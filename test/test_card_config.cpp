@@ -0,0 +1,68 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+// The values of 32-bit registers in `CardConfig` must match what the card reports,
+// which is sign-extended, so that an unchanged register is not written again
+// by `Spcm::warm_start()`. Doesn't need a card.
+
+#include <nacs-spcm/spcm.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+using namespace NaCs;
+
+int main()
+{
+    // A trigger mask with bit 31 set.
+    uint32_t mask = 0x80000001u;
+    Spcm::CardConfig config;
+    config.set(SPC_TRIG_ORMASK, mask);
+    config.set(SPC_SAMPLERATE, int64_t(625000000));
+    assert(config.entries.size() == 2);
+    assert(config.entries[0].value == int32_t(mask));
+    assert(config.entries[0].value == Spcm::reg_value(mask));
+    config.set(SPC_TRIG_ORMASK, int32_t(mask));
+    assert(config.entries.size() == 2);
+    assert(config.entries[0].value == int32_t(mask));
+
+    auto path = "/tmp/test-card_config-" + std::to_string(getpid());
+    config.save(path);
+    auto loaded = Spcm::CardConfig::load(path);
+    assert(loaded.entries.size() == 2);
+    for (size_t i = 0; i < 2; i++) {
+        assert(loaded.entries[i].name == config.entries[i].name);
+        assert(loaded.entries[i].is64 == config.entries[i].is64);
+        assert(loaded.entries[i].value == config.entries[i].value);
+    }
+    // Files with the unsigned value of the mask.
+    {
+        FILE *fp = fopen(path.c_str(), "w");
+        fprintf(fp, "%d\t32\t%u\n", int(SPC_TRIG_ORMASK), unsigned(mask));
+        fclose(fp);
+    }
+    loaded = Spcm::CardConfig::load(path);
+    assert(loaded.entries.size() == 1);
+    assert(loaded.entries[0].value == int32_t(mask));
+    unlink(path.c_str());
+    std::cout << "Passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Stream a tone on each card of a group for a few seconds.
+//
+//     test-card_group [--sync <hub>] [--rt <priority>] <device>...
+//
+// The tone on card `i` is at `(i + 1) * 10` MHz so that the alignment
+// can be checked on a scope. After the first shot, a second one is prepared
+// while the first one runs and the time to re-arm the cards is reported.
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/card_group.h>
+#include <nacs-spcm/data_stream.h>
+
+#include <nacs-utils/log.h>
+#include <nacs-utils/mem.h>
+#include <nacs-utils/timer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+int main(int argc, char **argv)
+{
+    const char *sync_name = nullptr;
+    int rt_priority = 0;
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+            sync_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rt") == 0 && i + 1 < argc) {
+            rt_priority = atoi(argv[++i]);
+        }
+        else {
+            names.push_back(argv[i]);
+        }
+    }
+    if (names.empty()) {
+        Log::error("Missing device name.\n");
+        return 1;
+    }
+
+    CardGroup::Config config;
+    config.trigger_mask = SPC_TMASK_SOFTWARE;
+    config.rt_priority = rt_priority;
+    // The real-time mode picks the isolated CPUs.
+    int ncpus = (int)std::thread::hardware_concurrency();
+    for (size_t i = 0; rt_priority <= 0 && i < names.size(); i++)
+        config.cpus.push_back(int(i) % std::max(ncpus, 1));
+    CardGroup group(names, sync_name, config);
+
+    auto &kernels = get_kernels(KernelTuner::global().select(1, StepType::Fixed));
+    std::atomic<uint64_t> busy{0};
+    auto gen = [&] (size_t card, uint64_t offset, int16_t *buff, size_t nsamples) {
+        thread_local float *fbuff = nullptr;
+        if (!fbuff)
+            fbuff = (float*)mapAnonPage(config.notify_size * 2, Prot::RW);
+        auto t0 = getTime();
+        auto quantize = kernels.get_quantize(nsamples * sizeof(int16_t));
+        // The frequency in cycles per step.
+        double freq = double(card + 1) * 10e6 / double(config.sample_rate) * step_size;
+        for (size_t done = 0; done < nsamples;) {
+            auto n = std::min(nsamples - done, config.notify_size / sizeof(int16_t));
+            double phase = 2 * freq * double((offset + done) / step_size);
+            channel_param_fixed param{float(phase - 2 * nearbyint(phase / 2)),
+                                      float(freq), 0.5f};
+            kernels.calc_wave_fixed(fbuff, n / step_size, 1, &param);
+            MarkerStream markers(nullptr, 0);
+            output_stats stats;
+            quantize(buff + done, fbuff, n / step_size, 32767.0f, 0,
+                     markers, stats, nullptr);
+            done += n;
+        }
+        busy.fetch_add(getElapse(t0), std::memory_order_relaxed);
+    };
+
+    group.start(gen);
+    for (size_t i = 0; rt_priority > 0 && i < group.size(); i++) {
+        auto &rt = group.rt_status(i);
+        std::cout << "Card " << i << ": " << (rt.fifo ? "SCHED_FIFO" : "normal priority")
+                  << (rt.pinned ? ", pinned" : "") << (rt.locked ? ", locked" : "")
+                  << std::endl;
+    }
+    group.force_trigger();
+    auto t0 = getTime();
+    sleep(5);
+    auto elapsed = getElapse(t0);
+    std::cout << "Generator load: "
+              << double(busy.load()) / double(elapsed) / double(names.size()) * 100
+              << "% per card" << std::endl;
+
+    // A second shot with the prefill rendered while the first one is running.
+    group.prepare(gen);
+    sleep(1);
+    t0 = getTime();
+    group.arm();
+    std::cout << "Re-arm time: " << double(getElapse(t0)) / 1e6 << " ms" << std::endl;
+    group.force_trigger();
+    sleep(1);
+    group.stop();
+    return 0;
+}
@@ -69,6 +69,116 @@ static double calc_wave(float *output, int nchns, const channel_param *params)
     return total_amp;
 }
 
+static double calc_wave_iq(float *output_i, float *output_q, int nchns,
+                           const channel_param *params)
+{
+    assert(nchns > 0);
+    double total_amp = 0;
+    for (int i = 0; i < step_size; i++) {
+        double oi = 0;
+        double oq = 0;
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto phase = (double)p.phase[0] + (double)p.freq[0] * (double)i / 16;
+            phase += (double)p.dfreq[0] * (double)(i * i) / 512;
+            auto amp = (double)p.amp[0] + (double)p.damp[0] * (double)i / 16;
+            oi += std::cos(phase * M_PI) / M_PI * amp;
+            oq += std::sin(phase * M_PI) / M_PI * amp;
+            total_amp += p.amp[0] + max(0, p.damp[0]);
+        }
+        output_i[i] = (float)oi;
+        output_q[i] = (float)oq;
+    }
+    return total_amp;
+}
+
+// Reference for channels computed at `1 / R` of the full rate.
+// The frequency is in unit of the reduced sample rate and the output is delayed by
+// `Upsampler<R>::delay` samples.
+template<int R>
+static double calc_wave_lowrate(float *output, size_t sz, int nchns,
+                                const channel_param_fixed *params)
+{
+    assert(nchns > 0);
+    double total_amp = 0;
+    for (int c = 0; c < nchns; c++)
+        total_amp += params[c].amp;
+    for (size_t i = 0; i < sz; i++) {
+        double t = (double(i) - Upsampler<R>::delay) / R;
+        double o = 0;
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto phase = (double)p.phase + (double)p.freq * t / 16;
+            o += std::sin(phase * M_PI) / M_PI * (double)p.amp;
+        }
+        output[i] = (float)o;
+    }
+    return total_amp;
+}
+
+static double calc_wave_long(float *output, size_t sz, int nchns,
+                             const channel_param_fixed *params)
+{
+    assert(nchns > 0);
+    double total_amp = 0;
+    for (int c = 0; c < nchns; c++)
+        total_amp += params[c].amp;
+    for (size_t i = 0; i < sz; i++) {
+        double o = 0;
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto phase = (double)p.phase + (double)p.freq * (double)i / 16;
+            o += std::sin(phase * M_PI) / M_PI * (double)p.amp;
+        }
+        output[i] = (float)o;
+    }
+    return total_amp;
+}
+
+static double interp_ref(const float *table, int n, double idx)
+{
+    if (idx <= 0)
+        return table[0];
+    if (idx >= n - 1)
+        return table[n - 1];
+    int i = (int)idx;
+    auto r = idx - i;
+    return table[i] * (1 - r) + table[i + 1] * r;
+}
+
+static double calib_ref(const channel_calib &calib, double freq, double amp)
+{
+    if (calib.nfreq >= 2)
+        amp *= interp_ref(calib.gain, calib.nfreq, (freq - calib.freq0) * calib.freq_scale);
+    if (calib.namp >= 2)
+        amp = interp_ref(calib.amp_curve, calib.namp, amp * calib.amp_scale);
+    return amp;
+}
+
+static double calc_wave_calib(float *output, int nchns, const channel_param *params,
+                              const channel_calib *calib)
+{
+    assert(nchns > 0);
+    double total_amp = 0;
+    for (int i = 0; i < step_size; i++) {
+        double o = 0;
+        for (int c = 0; c < nchns; c++) {
+            auto p = params[c];
+            auto phase = (double)p.phase[0] + (double)p.freq[0] * (double)i / 16;
+            phase += (double)p.dfreq[0] * (double)(i * i) / 512;
+            // The calibration is computed at both ends of the step.
+            auto amp0 = calib_ref(calib[c], p.freq[0], p.amp[0]);
+            auto amp1 = calib_ref(calib[c], (double)p.freq[0] + 2 * (double)p.dfreq[0],
+                                  (double)p.amp[0] + 2 * (double)p.damp[0]);
+            auto amp = amp0 + (amp1 - amp0) * (double)i / 32;
+            o += std::sin(phase * M_PI) / M_PI * amp;
+            total_amp += max(std::abs(amp0), std::abs(amp1));
+        }
+        output[i] = (float)o;
+    }
+    return total_amp;
+}
+
 static bool approx_array(const float *a1, const float *a2, size_t sz, double tol)
 {
     for (size_t i = 0; i < sz; i++) {
@@ -98,6 +208,131 @@ static void test_gen(const float *expected, float *buff, int nchn,
     assert(approx_array(expected, buff, step_size, tol));
 }
 
+static void quantize_ref(int16_t *output, const float *input, size_t sz, float scale,
+                         int nbits, const marker_run *runs, size_t nruns,
+                         const dither_state *dither, float &peak, uint64_t &nclip)
+{
+    std::vector<uint16_t> bits(sz, 0);
+    size_t offset = 0;
+    for (size_t i = 0; i < nruns; i++) {
+        for (uint32_t j = 0; j < runs[i].len && offset < sz; j++) {
+            bits[offset++] = runs[i].bits;
+        }
+    }
+    double hi = (1 << (15 - nbits)) - 1;
+    double lo = -(1 << (15 - nbits));
+    uint32_t lanes[step_size];
+    if (dither)
+        memcpy(lanes, dither->lanes, sizeof(lanes));
+    peak = 0;
+    nclip = 0;
+    for (size_t i = 0; i < sz; i++) {
+        float scaled = input[i] * scale;
+        peak = std::max(peak, std::abs(scaled));
+        if (scaled > hi || scaled < lo)
+            nclip++;
+        float dithered = scaled;
+        if (dither) {
+            // Xorshift32 for each sample in the step.
+            auto &x = lanes[i % step_size];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            dithered += float(int((x & 0xffff) + (x >> 16)) - 65535) / 65536;
+        }
+        double v = std::nearbyint(dithered);
+        if (!(v > lo))
+            v = lo;
+        if (v > hi)
+            v = hi;
+        auto q = uint16_t(int(v) & (0xffff >> nbits));
+        output[i] = int16_t(q | bits[i]);
+    }
+}
+
+template<typename Gen>
+static void test_gen_quantize(const int16_t *expected, int16_t *buff, const float *input,
+                              size_t sz, float scale, int nbits,
+                              const std::vector<marker_run> &runs,
+                              const dither_state *dither, float peak, uint64_t nclip)
+{
+    memset(buff, 0, sz * sizeof(int16_t));
+    output_stats stats;
+    dither_state dither_copy;
+    if (dither)
+        dither_copy = *dither;
+    Runner<Gen>::run_quantize(buff, input, sz, 1, scale, nbits, runs.data(), runs.size(),
+                              stats, dither ? &dither_copy : nullptr);
+    assert(memcmp(expected, buff, sz * sizeof(int16_t)) == 0);
+    stats.collect();
+    assert(stats.peak == peak);
+    assert(stats.nclip == nclip);
+    // Accumulate another block.
+    Runner<Gen>::run_quantize(buff, input, sz, 1, scale, nbits, runs.data(), runs.size(),
+                              stats);
+    stats.collect();
+    assert(stats.peak == peak);
+    assert(stats.nclip == nclip * 2);
+    for (int i = 0; i < 16; i++) {
+        assert(stats.peak_lanes[i] == 0);
+        assert(stats.clip_lanes[i] == 0);
+    }
+}
+
+template<typename Gen>
+static void test_gen_calib(const float *expected, float *buff, int nchn,
+                           const channel_param *params, const channel_calib *calib,
+                           double tol)
+{
+    memset(buff, 0, step_size * sizeof(float));
+    Runner<Gen>::run_wave_calib(buff, step_size, 1, nchn, params, calib);
+    assert(approx_array(expected, buff, step_size, tol));
+}
+
+template<typename Gen>
+static void test_gen_iq(const float *expected_i, const float *expected_q, float *buff,
+                        int nchn, const channel_param *params, double tol)
+{
+    memset(buff, 0, step_size * 2 * sizeof(float));
+    Runner<Gen>::run_wave_iq(buff, &buff[step_size], step_size, 1, nchn, params);
+    assert(approx_array(expected_i, buff, step_size, tol));
+    assert(approx_array(expected_q, &buff[step_size], step_size, tol));
+
+    memset(buff, 0, step_size * 2 * sizeof(float));
+    Runner<Gen>::run_wave_iq_interleave(buff, step_size, 1, nchn, params);
+    for (int i = 0; i < step_size; i++) {
+        assert(std::abs(expected_i[i] - buff[i * 2]) < tol);
+        assert(std::abs(expected_q[i] - buff[i * 2 + 1]) < tol);
+    }
+}
+
+template<typename Gen, int R>
+static void test_gen_lowrate(const float *expected, float *buff, size_t sz, int nchn,
+                             const channel_param *params, double tol)
+{
+    Upsampler<R> up;
+    memset(buff, 0, sz * sizeof(float));
+    Runner<Gen>::run_wave_lowrate(buff, sz, 1, nchn, params, up);
+    // The first `ntaps` low rate samples depend on the initial (zero) history.
+    constexpr size_t skip = Upsampler<R>::ntaps * R;
+    assert(approx_array(&expected[skip], &buff[skip], sz - skip, tol));
+}
+
+template<typename Gen>
+static void test_gen_period(const float *expected, float *buff, float *period, size_t sz,
+                            int nsteps, int nchn, const channel_param_fixed *params,
+                            double tol)
+{
+    size_t period_sz = nsteps * step_size;
+    render_period<Gen>(period, nsteps, nchn, params);
+    // Replay in uneven pieces to test the wrapping.
+    size_t offset = 0;
+    for (size_t i = 0; i < sz; i += 100)
+        offset = replay_period(&buff[i], std::min<size_t>(100, sz - i), period,
+                               period_sz, offset);
+    assert(approx_array(expected, buff, sz, tol));
+}
+
 static void test_fixed_param(float *buff1, float *buff2,
                              int nchn, const channel_param_fixed *params_fixed)
 {
@@ -145,6 +380,127 @@ static void test_param(float *buff1, float *buff2, int nchn, const channel_param
 #endif
 }
 
+static void test_param_calib(float *buff1, float *buff2, int nchn,
+                             const channel_param *params, const channel_calib *calib)
+{
+    auto tol = calc_wave_calib(buff1, nchn, params, calib) * 0.5e-5;
+    test_gen_calib<ScalarGen>(buff1, buff2, nchn, params, calib, tol);
+
+    auto &host NACS_UNUSED = CPUInfo::get_host();
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    test_gen_calib<SSE2Gen>(buff1, buff2, nchn, params, calib, tol);
+    if (host.test_feature(X86::Feature::avx)) {
+        test_gen_calib<AVXGen>(buff1, buff2, nchn, params, calib, tol);
+    }
+    if (host.test_feature(X86::Feature::avx2) && host.test_feature(X86::Feature::fma)) {
+        test_gen_calib<AVX2Gen>(buff1, buff2, nchn, params, calib, tol);
+    }
+    if (host.test_feature(X86::Feature::avx512f) &&
+        host.test_feature(X86::Feature::avx512dq)) {
+        test_gen_calib<AVX512Gen>(buff1, buff2, nchn, params, calib, tol);
+    }
+#endif
+}
+
+static void test_param_quantize(int16_t *buff1, int16_t *buff2, const float *input,
+                                size_t sz, float scale, int nbits,
+                                const std::vector<marker_run> &runs,
+                                const dither_state *dither)
+{
+    float peak;
+    uint64_t nclip;
+    quantize_ref(buff1, input, sz, scale, nbits, runs.data(), runs.size(), dither,
+                 peak, nclip);
+    test_gen_quantize<ScalarGen>(buff1, buff2, input, sz, scale, nbits, runs, dither,
+                                 peak, nclip);
+
+    auto &host NACS_UNUSED = CPUInfo::get_host();
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    test_gen_quantize<SSE2Gen>(buff1, buff2, input, sz, scale, nbits, runs, dither,
+                               peak, nclip);
+    if (host.test_feature(X86::Feature::avx)) {
+        test_gen_quantize<AVXGen>(buff1, buff2, input, sz, scale, nbits, runs, dither,
+                                  peak, nclip);
+    }
+    if (host.test_feature(X86::Feature::avx2) && host.test_feature(X86::Feature::fma)) {
+        test_gen_quantize<AVX2Gen>(buff1, buff2, input, sz, scale, nbits, runs, dither,
+                                   peak, nclip);
+    }
+    if (host.test_feature(X86::Feature::avx512f) &&
+        host.test_feature(X86::Feature::avx512dq)) {
+        test_gen_quantize<AVX512Gen>(buff1, buff2, input, sz, scale, nbits, runs, dither,
+                                     peak, nclip);
+    }
+#endif
+}
+
+static void test_param_iq(float *buff1, float *buff2, int nchn, const channel_param *params)
+{
+    auto tol = calc_wave_iq(buff1, &buff1[step_size], nchn, params) * 0.5e-5;
+    test_gen_iq<ScalarGen>(buff1, &buff1[step_size], buff2, nchn, params, tol);
+
+    auto &host NACS_UNUSED = CPUInfo::get_host();
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    test_gen_iq<SSE2Gen>(buff1, &buff1[step_size], buff2, nchn, params, tol);
+    if (host.test_feature(X86::Feature::avx)) {
+        test_gen_iq<AVXGen>(buff1, &buff1[step_size], buff2, nchn, params, tol);
+    }
+    if (host.test_feature(X86::Feature::avx2) && host.test_feature(X86::Feature::fma)) {
+        test_gen_iq<AVX2Gen>(buff1, &buff1[step_size], buff2, nchn, params, tol);
+    }
+    if (host.test_feature(X86::Feature::avx512f) &&
+        host.test_feature(X86::Feature::avx512dq)) {
+        test_gen_iq<AVX512Gen>(buff1, &buff1[step_size], buff2, nchn, params, tol);
+    }
+#endif
+}
+
+template<int R>
+static void test_param_lowrate(float *buff1, float *buff2, size_t sz, int nchn,
+                               const channel_param_fixed *params_fixed,
+                               const channel_param *params)
+{
+    auto tol = calc_wave_lowrate<R>(buff1, sz, nchn, params_fixed) * 0.5e-5;
+    test_gen_lowrate<ScalarGen, R>(buff1, buff2, sz, nchn, params, tol);
+
+    auto &host NACS_UNUSED = CPUInfo::get_host();
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    test_gen_lowrate<SSE2Gen, R>(buff1, buff2, sz, nchn, params, tol);
+    if (host.test_feature(X86::Feature::avx)) {
+        test_gen_lowrate<AVXGen, R>(buff1, buff2, sz, nchn, params, tol);
+    }
+    if (host.test_feature(X86::Feature::avx2) && host.test_feature(X86::Feature::fma)) {
+        test_gen_lowrate<AVX2Gen, R>(buff1, buff2, sz, nchn, params, tol);
+    }
+    if (host.test_feature(X86::Feature::avx512f) &&
+        host.test_feature(X86::Feature::avx512dq)) {
+        test_gen_lowrate<AVX512Gen, R>(buff1, buff2, sz, nchn, params, tol);
+    }
+#endif
+}
+
+static void test_param_period(float *buff1, float *buff2, float *period, size_t sz,
+                              int nsteps, int nchn, const channel_param_fixed *params)
+{
+    auto tol = calc_wave_long(buff1, sz, nchn, params) * 0.5e-5;
+    test_gen_period<ScalarGen>(buff1, buff2, period, sz, nsteps, nchn, params, tol);
+
+    auto &host NACS_UNUSED = CPUInfo::get_host();
+#if NACS_CPU_X86 || NACS_CPU_X86_64
+    test_gen_period<SSE2Gen>(buff1, buff2, period, sz, nsteps, nchn, params, tol);
+    if (host.test_feature(X86::Feature::avx)) {
+        test_gen_period<AVXGen>(buff1, buff2, period, sz, nsteps, nchn, params, tol);
+    }
+    if (host.test_feature(X86::Feature::avx2) && host.test_feature(X86::Feature::fma)) {
+        test_gen_period<AVX2Gen>(buff1, buff2, period, sz, nsteps, nchn, params, tol);
+    }
+    if (host.test_feature(X86::Feature::avx512f) &&
+        host.test_feature(X86::Feature::avx512dq)) {
+        test_gen_period<AVX512Gen>(buff1, buff2, period, sz, nsteps, nchn, params, tol);
+    }
+#endif
+}
+
 static std::random_device rd;  // Will be used to obtain a seed for the random number engine
 static std::mt19937 gen(rd()); // Standard mersenne_twister_engine seeded with rd()
 
@@ -176,18 +532,174 @@ static void test_nchn(float *buff1, float *buff2, int nchn, int rep)
                  &real_ps[i].amp, &real_ps[i].damp};
     std::uniform_real_distribution<float> pf_dis(-2, 2);
     std::uniform_real_distribution<float> a_dis(0, 2);
+
+    // The frequency range of the gain table doesn't cover all the frequencies
+    // to test the clamping. Every third channel has no gain table and every other channel
+    // doesn't have an amplitude curve.
+    std::vector<float> gains(nchn * 64);
+    std::vector<float> amp_curves(nchn * 32);
+    std::vector<channel_calib> calib(nchn);
+    std::uniform_real_distribution<float> g_dis(0.5, 1.5);
+    for (int i = 0; i < nchn; i++) {
+        for (int k = 0; k < 64; k++)
+            gains[i * 64 + k] = g_dis(gen);
+        for (int k = 0; k < 32; k++)
+            amp_curves[i * 32 + k] = 4 * std::pow(float(k) / 31, 0.8f);
+        if (i % 3 != 0) {
+            calib[i].freq0 = -1.5;
+            calib[i].freq_scale = 63 / 3.0;
+            calib[i].nfreq = 64;
+            calib[i].gain = &gains[i * 64];
+        }
+        if (i % 2 == 0) {
+            calib[i].amp_scale = 31 / 4.0;
+            calib[i].namp = 32;
+            calib[i].amp_curve = &amp_curves[i * 32];
+        }
+    }
+
     for (int j = 0; j < rep; j++) {
         for (int i = 0; i < nchn; i++)
             real_ps[i] = {pf_dis(gen), pf_dis(gen), pf_dis(gen), a_dis(gen), a_dis(gen)};
         test_param(buff1, buff2, nchn, ps.data());
+        test_param_iq(buff1, buff2, nchn, ps.data());
+        test_param_calib(buff1, buff2, nchn, ps.data(), calib.data());
+    }
+}
+
+template<int R>
+static void test_lowrate_nchn(float *buff1, float *buff2, int nchn, int rep)
+{
+    constexpr int nsteps = 4;
+    constexpr size_t sz = nsteps * step_size * R;
+    static_assert(4096 >= sz * sizeof(float), "");
+    struct param {
+        float phase[nsteps];
+        float freq[nsteps];
+        float dfreq[nsteps];
+        float amp[nsteps];
+        float damp[nsteps];
+    };
+    std::vector<param> real_ps(nchn);
+    std::vector<channel_param_fixed> ps_fixed(nchn);
+    std::vector<channel_param> ps(nchn);
+    for (int i = 0; i < nchn; i++)
+        ps[i] = {real_ps[i].phase, real_ps[i].freq, real_ps[i].dfreq,
+                 real_ps[i].amp, real_ps[i].damp};
+    // Up to ~0.2 of the reduced sample rate.
+    std::uniform_real_distribution<float> f_dis(-6, 6);
+    std::uniform_real_distribution<float> p_dis(-2, 2);
+    std::uniform_real_distribution<float> a_dis(0, 2);
+    for (int j = 0; j < rep; j++) {
+        for (int i = 0; i < nchn; i++) {
+            ps_fixed[i] = {p_dis(gen), f_dis(gen), a_dis(gen)};
+            // The phase advances by `2 * freq` per step.
+            for (int s = 0; s < nsteps; s++) {
+                auto phase = (double)ps_fixed[i].phase + 2.0 * s * (double)ps_fixed[i].freq;
+                real_ps[i].phase[s] = (float)std::fmod(phase, 2);
+                real_ps[i].freq[s] = ps_fixed[i].freq;
+                real_ps[i].dfreq[s] = 0;
+                real_ps[i].amp[s] = ps_fixed[i].amp;
+                real_ps[i].damp[s] = 0;
+            }
+        }
+        test_param_lowrate<R>(buff1, buff2, sz, nchn, ps_fixed.data(), ps.data());
+    }
+}
+
+static void test_period_nchn(float *buff1, float *buff2, float *period, int nchn, int rep)
+{
+    // 4 periods of up to 8 steps.
+    constexpr int max_steps = 8;
+    constexpr size_t sz = max_steps * 4 * step_size;
+    static_assert(4096 >= sz * sizeof(float), "");
+    std::vector<channel_param_fixed> ps(nchn);
+    std::uniform_int_distribution<int> n_dis(1, max_steps);
+    std::uniform_real_distribution<float> p_dis(-2, 2);
+    std::uniform_real_distribution<float> a_dis(0, 2);
+    for (int j = 0; j < rep; j++) {
+        int nsteps = n_dis(gen);
+        // Same frequency range (`[-2, 2]`) as the other tests.
+        std::uniform_int_distribution<int> c_dis(-2 * nsteps, 2 * nsteps);
+        for (int i = 0; i < nchn; i++)
+            ps[i] = {p_dis(gen), float(c_dis(gen)) / float(nsteps), a_dis(gen)};
+        // The float frequencies are not exactly commensurate.
+        int found = find_period(nchn, ps.data(), max_steps, 1e-5);
+        assert(found > 0 && nsteps % found == 0);
+        snap_period(nchn, ps.data(), found);
+        test_param_period(buff1, buff2, period, sz / found / step_size * found * step_size,
+                          found, nchn, ps.data());
+    }
+    // Incommensurate frequencies
+    ps[0].freq = 0.1234567f;
+    assert(find_period(nchn, ps.data(), max_steps, 1e-5) == 0);
+}
+
+static void test_quantize(float *input, int16_t *buff1, int16_t *buff2, int rep)
+{
+    constexpr size_t sz = 8 * step_size;
+    static_assert(4096 >= sz * sizeof(float), "");
+    // Include some samples that are out of range.
+    std::uniform_real_distribution<float> v_dis(-1.2f, 1.2f);
+    std::uniform_int_distribution<int> nbits_dis(0, 3);
+    std::uniform_int_distribution<int> nruns_dis(0, 10);
+    std::uniform_int_distribution<uint32_t> len_dis(0, 80);
+    std::uniform_int_distribution<int> bits_dis(0, 7);
+    std::vector<marker_run> runs;
+    for (int j = 0; j < rep; j++) {
+        for (size_t i = 0; i < sz; i++)
+            input[i] = v_dis(gen);
+        int nbits = nbits_dis(gen);
+        runs.resize(nruns_dis(gen));
+        for (auto &run: runs) {
+            run.len = len_dis(gen);
+            run.bits = uint16_t((bits_dis(gen) << 13) & ~(0xffff >> nbits));
+        }
+        // A few long runs that cover whole steps.
+        if (j % 2)
+            runs.push_back({uint32_t(3 * step_size), uint16_t(~(0xffff >> nbits))});
+        auto scale = float(1 << (15 - nbits));
+        test_param_quantize(buff1, buff2, input, sz, scale, nbits, runs, nullptr);
+        dither_state dither(gen());
+        test_param_quantize(buff1, buff2, input, sz, scale, nbits, runs, &dither);
     }
 }
 
+static void test_dither_distribution(float *input, int16_t *buff)
+{
+    constexpr size_t sz = 1024;
+    static_assert(4096 >= sz * sizeof(float), "");
+    std::uniform_real_distribution<float> v_dis(-0.9f, 0.9f);
+    constexpr float scale = 32768;
+    dither_state dither(gen());
+    output_stats stats;
+    double err = 0;
+    double err2 = 0;
+    for (int j = 0; j < 64; j++) {
+        for (size_t i = 0; i < sz; i++)
+            input[i] = v_dis(gen);
+        Runner<ScalarGen>::run_quantize(buff, input, sz, 1, scale, 0, nullptr, 0,
+                                        stats, &dither);
+        for (size_t i = 0; i < sz; i++) {
+            double e = buff[i] - double(input[i] * scale);
+            err += e;
+            err2 += e * e;
+        }
+    }
+    err /= sz * 64;
+    err2 = err2 / (sz * 64) - err * err;
+    // The total error is the triangular dither (variance `1 / 6`)
+    // plus the rounding error (variance `1 / 12`), independent of the signal.
+    assert(std::abs(err) < 0.01);
+    assert(std::abs(err2 - 0.25) < 0.01);
+}
+
 int main()
 {
-    static_assert(4096 > step_size * sizeof(float), "");
+    static_assert(4096 > step_size * 2 * sizeof(float), "");
     auto buff1 = (float*)mapAnonPage(4096, Prot::RW);
     auto buff2 = (float*)mapAnonPage(4096, Prot::RW);
+    auto buff3 = (float*)mapAnonPage(4096, Prot::RW);
     auto t0 = getTime();
     do {
         test_fixed_nchn(buff1, buff2, 1, 1000);
@@ -199,8 +711,19 @@ int main()
         test_nchn(buff1, buff2, 2, 500);
         test_nchn(buff1, buff2, 4, 250);
         test_nchn(buff1, buff2, 10, 100);
+
+        test_lowrate_nchn<2>(buff1, buff2, 1, 100);
+        test_lowrate_nchn<4>(buff1, buff2, 2, 50);
+        test_lowrate_nchn<8>(buff1, buff2, 4, 25);
+
+        test_period_nchn(buff1, buff2, buff3, 1, 100);
+        test_period_nchn(buff1, buff2, buff3, 4, 25);
+
+        test_quantize(buff1, (int16_t*)buff2, (int16_t*)buff3, 100);
+        test_dither_distribution(buff1, (int16_t*)buff2);
     } while (getElapse(t0) < 10ull * 1000 * 1000 * 1000);
     unmapPage(buff1, 4096);
     unmapPage(buff2, 4096);
+    unmapPage(buff3, 4096);
     return 0;
 }
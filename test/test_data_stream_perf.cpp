@@ -22,6 +22,7 @@
 #include <nacs-utils/timer.h>
 #include <nacs-utils/mem.h>
 
+#include <cstring>
 #include <iostream>
 #include <random>
 #include <vector>
@@ -43,7 +44,7 @@ static void fill_random(std::vector<float> &data, float lb, float ub)
 template<typename Gen>
 NACS_NOINLINE void benchmark_chn_sz(float *data, size_t sz, size_t rep, int nchn,
                                     channel_param_fixed *params_fixed,
-                                    channel_param *params)
+                                    channel_param *params, channel_calib *calib)
 {
     Timer timer;
     Runner<Gen>::run_wave_fixed(data, sz, 1, nchn, params_fixed);
@@ -56,9 +57,26 @@ NACS_NOINLINE void benchmark_chn_sz(float *data, size_t sz, size_t rep, int nchn
     Runner<Gen>::run_wave(data, sz, rep, nchn, params);
     auto change = timer.elapsed();
 
+    // `data` has `sz * 2` elements so that the interleaved I/Q output fits.
+    timer.restart();
+    Runner<Gen>::run_wave_iq_interleave(data, sz, rep, nchn, params);
+    auto iq = timer.elapsed();
+
+    timer.restart();
+    Runner<Gen>::run_wave_calib(data, sz, rep, nchn, params, calib);
+    auto calibrated = timer.elapsed();
+
+    Upsampler<4> up;
+    timer.restart();
+    Runner<Gen>::run_wave_lowrate(data, sz, rep, nchn, params, up);
+    auto lowrate = timer.elapsed();
+
     std::cout << "  [nchn: " << nchn << ", rep: " << rep << "] "
               << "Fixed: " << double(fixed) / double(sz) / (double)rep / nchn << " ns; Change: "
-              << double(change) / double(sz) / (double)rep / nchn << " ns" << std::endl;
+              << double(change) / double(sz) / (double)rep / nchn << " ns; Calib: "
+              << double(calibrated) / double(sz) / (double)rep / nchn << " ns; IQ: "
+              << double(iq) / double(sz) / (double)rep / nchn << " ns; 1/4 rate: "
+              << double(lowrate) / double(sz) / (double)rep / nchn << " ns" << std::endl;
 }
 
 template<typename Gen>
@@ -89,24 +107,76 @@ NACS_NOINLINE void benchmark_chn(float *data, size_t sz, size_t rep, int nchn)
     std::vector<params> vps(nchn);
     std::vector<channel_param_fixed> ps_fixed(nchn);
     std::vector<channel_param> ps(nchn);
+    // 256 points gain table and 64 points amplitude curve for each channel.
+    std::vector<float> tables(nchn * (256 + 64));
+    std::vector<channel_calib> calib(nchn);
+    fill_random(tables, 0.5, 1.5);
+    for (int i = 0; i < nchn; i++) {
+        calib[i].freq0 = -2;
+        calib[i].freq_scale = 255 / 4.0;
+        calib[i].nfreq = 256;
+        calib[i].gain = &tables[i * (256 + 64)];
+        calib[i].amp_scale = 63 / 2.0;
+        calib[i].namp = 64;
+        calib[i].amp_curve = &tables[i * (256 + 64) + 256];
+    }
     for (int i = 0; i < nchn; i++) {
         vps[i] = params(sz / step_size);
         ps_fixed[i] = {vps[i].phase.front(), vps[i].freq.front(), vps[i].amp.front()};
         ps[i] = {vps[i].phase.data(), vps[i].freq.data(), vps[i].dfreq.data(),
                  vps[i].amp.data(), vps[i].damp.data()};
     }
-    benchmark_chn_sz<Gen>(data, sz, rep, nchn, ps_fixed.data(), ps.data());
+    benchmark_chn_sz<Gen>(data, sz, rep, nchn, ps_fixed.data(), ps.data(), calib.data());
+}
+
+template<typename Gen>
+NACS_NOINLINE void benchmark_quantize(float *data, size_t sz, size_t rep)
+{
+    auto out = (int16_t*)mapAnonPage(sz * sizeof(int16_t), Prot::RW);
+    std::vector<float> input(sz);
+    fill_random(input, -1, 1);
+    memcpy(data, input.data(), sz * sizeof(float));
+    // Marker edges every few hundred samples, many of them within a step.
+    std::vector<marker_run> runs;
+    std::uniform_int_distribution<uint32_t> len_dis(1, 500);
+    for (size_t n = 0; n < sz; n += runs.back().len)
+        runs.push_back({len_dis(gen), uint16_t(runs.size() % 2 ? 0x8000 : 0)});
+
+    output_stats stats;
+    Timer timer;
+    Runner<Gen>::run_quantize(out, data, sz, 1, 32767.0f, 0, nullptr, 0, stats);
+    timer.restart();
+    Runner<Gen>::run_quantize(out, data, sz, rep, 32767.0f, 0, nullptr, 0, stats);
+    auto plain = timer.elapsed();
+
+    timer.restart();
+    Runner<Gen>::run_quantize(out, data, sz, rep, 16383.0f, 1, runs.data(), runs.size(),
+                              stats);
+    auto marker = timer.elapsed();
+
+    dither_state dither;
+    timer.restart();
+    Runner<Gen>::run_quantize(out, data, sz, rep, 32767.0f, 0, nullptr, 0, stats, &dither);
+    auto dithered = timer.elapsed();
+    stats.collect();
+
+    std::cout << "  Quantize: " << double(plain) / double(sz) / (double)rep
+              << " ns; With markers: " << double(marker) / double(sz) / (double)rep
+              << " ns; Dither: " << double(dithered) / double(sz) / (double)rep
+              << " ns" << std::endl;
+    unmapPage(out, sz * sizeof(int16_t));
 }
 
 template<typename Gen>
 void benchmark(size_t sz, size_t rep)
 {
-    auto data = (float*)mapAnonPage(sz * sizeof(float), Prot::RW);
+    auto data = (float*)mapAnonPage(sz * 2 * sizeof(float), Prot::RW);
+    benchmark_quantize<Gen>(data, sz, rep);
     benchmark_chn<Gen>(data, sz, rep, 1);
     benchmark_chn<Gen>(data, sz, rep / 2, 2);
     benchmark_chn<Gen>(data, sz, rep / 4, 4);
     benchmark_chn<Gen>(data, sz, rep / 10, 10);
-    unmapPage(data, sz * sizeof(float));
+    unmapPage(data, sz * 2 * sizeof(float));
 }
 
 int main()
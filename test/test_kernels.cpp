@@ -0,0 +1,193 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-utils/mem.h>
+#include <nacs-utils/timer.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static std::random_device rd;
+static std::mt19937 gen(rd());
+
+// The specialized kernels should give the same result as the generic ones
+// up to the rounding differences from FMA contraction in the unrolled loop.
+static void check_close(const float *buff1, const float *buff2, size_t n, int nchns)
+{
+    // Each channel contributes at most `|amp| + |damp| <= 4`.
+    float tol = 4e-6f * float(nchns);
+    for (size_t i = 0; i < n; i++) {
+        assert(fabsf(buff1[i] - buff2[i]) <= tol);
+    }
+}
+
+static void test_spec(const KernelTable &kernels, float *buff1, float *buff2, int nchns)
+{
+    constexpr size_t nsteps = 8;
+    static_assert(4096 >= nsteps * step_size * sizeof(float), "");
+    std::uniform_real_distribution<float> dis(-2, 2);
+    std::vector<float> values(nchns * nsteps * 5);
+    for (auto &v: values)
+        v = dis(gen);
+    std::vector<channel_param_fixed> ps_fixed1(nchns);
+    std::vector<channel_param> ps(nchns);
+    for (int c = 0; c < nchns; c++) {
+        auto p = &values[c * nsteps * 5];
+        ps_fixed1[c] = {p[0], p[nsteps], p[nsteps * 3]};
+        ps[c] = {p, p + nsteps, p + nsteps * 2, p + nsteps * 3, p + nsteps * 4};
+    }
+    auto ps_fixed2 = ps_fixed1;
+    kernels.calc_wave_fixed(buff1, nsteps, nchns, ps_fixed1.data());
+    kernels.get_calc_wave_fixed(nchns)(buff2, nsteps, nchns, ps_fixed2.data());
+    check_close(buff1, buff2, nsteps * step_size, nchns);
+    for (int c = 0; c < nchns; c++)
+        assert(ps_fixed1[c].phase == ps_fixed2[c].phase);
+
+    for (int flags = 3; flags >= 0; flags--) {
+        bool has_dfreq = flags & 1;
+        bool has_damp = flags & 2;
+        for (int c = 0; c < nchns; c++) {
+            auto p = &values[c * nsteps * 5];
+            if (!has_dfreq)
+                std::fill_n(p + nsteps * 2, nsteps, 0.0f);
+            if (!has_damp) {
+                std::fill_n(p + nsteps * 4, nsteps, 0.0f);
+            }
+        }
+        kernels.calc_wave(buff1, nsteps, nchns, ps.data(), 0);
+        kernels.get_calc_wave(nchns, has_dfreq, has_damp)(buff2, nsteps, nchns,
+                                                          ps.data(), 0);
+        check_close(buff1, buff2, nsteps * step_size, nchns);
+    }
+}
+
+// The non-temporal stores should only change where the output goes through
+// and not the output or the statistics.
+static void test_quantize_nt(const KernelTable &kernels, float *input, int16_t *out1,
+                             int16_t *out2)
+{
+    constexpr size_t nsteps = 16;
+    static_assert(4096 >= nsteps * step_size * sizeof(float), "");
+    std::uniform_real_distribution<float> dis(-1.2f, 1.2f);
+    for (size_t i = 0; i < nsteps * step_size; i++)
+        input[i] = dis(gen);
+    std::vector<marker_run> runs{{100, 0x8000}, {40, 0}, {200, 0x8000}};
+    for (int nbits = 0; nbits <= 1; nbits++) {
+        output_stats stats1;
+        output_stats stats2;
+        MarkerStream markers1(nbits ? runs.data() : nullptr, nbits ? runs.size() : 0);
+        MarkerStream markers2(nbits ? runs.data() : nullptr, nbits ? runs.size() : 0);
+        kernels.quantize(out1, input, nsteps, 32767.0f, nbits, markers1, stats1, nullptr);
+        kernels.quantize_nt(out2, input, nsteps, 32767.0f, nbits, markers2, stats2, nullptr);
+        assert(memcmp(out1, out2, nsteps * step_size * sizeof(int16_t)) == 0);
+        stats1.collect();
+        stats2.collect();
+        assert(stats1.peak == stats2.peak);
+        assert(stats1.nclip == stats2.nclip);
+    }
+    assert(kernels.get_quantize(0) == kernels.quantize);
+    assert(kernels.get_quantize(nt_store_threshold() + 1) == kernels.quantize_nt);
+}
+
+int main()
+{
+    auto buff1 = (float*)mapAnonPage(4096, Prot::RW);
+    auto buff2 = (float*)mapAnonPage(4096, Prot::RW);
+    for (int i = 0; i < num_kernel_isa; i++) {
+        auto isa = KernelISA(i);
+        if (!kernel_isa_supported(isa))
+            continue;
+        auto &kernels = get_kernels(isa);
+        assert(kernels.isa == isa);
+        for (int nchns = 1; nchns <= KernelTable::max_spec_chns + 1; nchns++) {
+            test_spec(kernels, buff1, buff2, nchns);
+        }
+        test_quantize_nt(kernels, buff1, (int16_t*)buff2, (int16_t*)buff2 + 1024);
+    }
+    unmapPage(buff1, 4096);
+    unmapPage(buff2, 4096);
+
+    char path[] = "/tmp/nacs-spcm-kernels-XXXXXX";
+    close(mkstemp(path));
+
+    std::vector<int> nchns{1, 2, 4, 8, 16};
+    std::vector<StepType> types{StepType::Fixed, StepType::Ramp};
+    auto t0 = getTime();
+    KernelTuner tuner(path);
+    tuner.tune(nchns, types);
+    auto elapsed = getElapse(t0);
+
+    std::cout << "CPU: " << tuner.cpu_model() << std::endl;
+    for (auto type: types) {
+        std::cout << (type == StepType::Fixed ? "Fixed:" : "Ramp:") << std::endl;
+        for (auto nchn: nchns) {
+            std::cout << "  [nchn: " << nchn << "] "
+                      << kernel_isa_name(tuner.select(nchn, type)) << std::endl;
+        }
+    }
+    std::cout << "Tuning time: " << double(elapsed) / 1e6 << " ms" << std::endl;
+
+    for (int nchn: {0, -1}) {
+        bool thrown = false;
+        try {
+            tuner.select(nchn, StepType::Ramp);
+        }
+        catch (const std::invalid_argument&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    // A new tuner should load the results from the cache without timing the kernels.
+    // The cache file is replaced after every new measurement.
+    // Invalid channel counts in the file are ignored.
+    {
+        std::ofstream stm(path, std::ios::app);
+        stm << tuner.cpu_model() << "\tramp\t-5\t" << kernel_isa_name(KernelISA(0)) << "\n";
+    }
+    struct stat st0;
+    assert(stat(path, &st0) == 0);
+    t0 = getTime();
+    KernelTuner tuner2(path);
+    for (auto type: types) {
+        for (auto nchn: nchns) {
+            assert(tuner2.select(nchn, type) == tuner.select(nchn, type));
+        }
+    }
+    std::cout << "Loading time: " << double(getElapse(t0)) / 1e6 << " ms" << std::endl;
+    struct stat st1;
+    assert(stat(path, &st1) == 0);
+    assert(st1.st_ino == st0.st_ino);
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Simulate a card consuming at a fixed rate and a generator with a jittery
+// generation time driven by the lead controller.
+
+#include <nacs-spcm/lead_control.h>
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+struct SimResult {
+    LeadController::Stats stats;
+    bool underrun;
+};
+
+// `rate` in bytes per second, and the actual rate of the card differs from the nominal
+// rate given to the controller by `rate_error`.
+static SimResult simulate(double rate, double rate_error, size_t chunk, size_t max_lead,
+                          double target, double gen_time, double duration)
+{
+    LeadController ctrl(rate, chunk, max_lead, target);
+    std::mt19937 gen(0);
+    std::exponential_distribution<double> jitter(1 / (gen_time * 0.1));
+    std::uniform_real_distribution<double> spike(0, 1);
+    auto card_rate = rate * (1 + rate_error);
+    // The card is started after the prefill, at `t = 0`.
+    double written = double(ctrl.lead());
+    double t = 0;
+    bool underrun = false;
+    while (t < duration) {
+        auto queued = written - t * card_rate;
+        if (queued < 0) {
+            underrun = true;
+            break;
+        }
+        ctrl.update_rate(uint64_t(t * card_rate), uint64_t(t * 1e9) + 1);
+        auto wait = ctrl.wait_time(size_t(queued));
+        if (wait > 0) {
+            t += wait;
+            continue;
+        }
+        // Occasional slow chunks, e.g. from a cache miss storm or an interrupt.
+        auto g = gen_time + jitter(gen) + (spike(gen) < 0.001 ? gen_time * 5 : 0);
+        t += g;
+        if (written - t * card_rate < 0) {
+            underrun = true;
+            break;
+        }
+        written += double(chunk);
+        ctrl.chunk_done(size_t(queued), g);
+    }
+    return {ctrl.stats(), underrun};
+}
+
+int main()
+{
+    constexpr double rate = 625e6 * 2;
+    constexpr size_t buff_size = 64 * 1024 * 1024;
+    for (double target: {0.001, 0.002, 0.005, 0.02}) {
+        auto chunk = LeadController::pick_notify_size(rate, target, buff_size, 1024 * 1024);
+        assert(chunk % 4096 == 0 && buff_size % chunk == 0);
+        assert(chunk <= 1024 * 1024 && double(chunk) <= std::max(rate * target / 4, 4096.0));
+        // A quarter of the real-time budget to generate each chunk.
+        auto gen_time = double(chunk) / rate / 4;
+        for (double rate_error: {0.0, -0.01, 0.01}) {
+            auto res = simulate(rate, rate_error, chunk, buff_size, target, gen_time, 2);
+            std::cout << "target: " << target * 1e3 << " ms, chunk: " << chunk
+                      << ", rate error: " << rate_error << ": latency: "
+                      << res.stats.latency * 1e3 << " ms (max "
+                      << res.stats.max_latency * 1e3 << " ms), lead: " << res.stats.lead
+                      << ", low: " << res.stats.nlow << std::endl;
+            assert(!res.underrun);
+            assert(res.stats.nchunks > 0);
+            // The safety lead is `margin (2 ms) + 2 * peak generation time + chunk`,
+            // which may exceed a short target.
+            auto safety = (0.002 + 2 * 6.5 * gen_time) * rate + double(chunk) * 2;
+            auto expected = std::max(target * rate, safety) / rate;
+            assert(res.stats.max_latency <= expected * 1.1);
+            assert(fabs(res.stats.rate - rate * (1 + rate_error)) < rate * 0.005);
+        }
+    }
+    // The whole buffer without a target.
+    LeadController full(rate, 1024 * 1024, buff_size, 0);
+    assert(full.lead() == buff_size);
+    assert(full.wait_time(0) == 0);
+    assert(full.wait_time(buff_size) > 0);
+    assert(LeadController::pick_notify_size(rate, 0, buff_size, 1024 * 1024) == 1024 * 1024);
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/seq_file.h>
+
+#include <nacs-utils/timer.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr double sample_rate = 625e6;
+
+static CompiledTimeline compile_test(int nchns, size_t nsteps)
+{
+    std::vector<ToneTimeline> tones(nchns);
+    auto len = double(nsteps * step_size) / sample_rate;
+    for (int c = 0; c < nchns; c++) {
+        tones[c].phase = c;
+        tones[c].ramps.push_back({0, len / 2, 10e6 + c * 1e6, 20e6, 0.1, 0.2,
+                                  RampShape::Cubic});
+    }
+    return compile_timeline(tones, sample_rate, nsteps);
+}
+
+static void test_roundtrip(const std::string &path)
+{
+    auto res = compile_test(3, 10000);
+    write_seq_file(path, res, sample_rate);
+    SeqFile file(path);
+    assert(file.nchns() == 3);
+    assert(file.nsteps() == 10000);
+    assert(file.sample_rate() == sample_rate);
+    assert(file.header().step_size == step_size);
+    assert(file.has_dfreq() == res.has_dfreq());
+    assert(file.has_damp() == res.has_damp());
+    for (int c = 0; c < 3; c++) {
+        for (auto p: {file.phase(c), file.freq(c), file.dfreq(c), file.amp(c), file.damp(c)})
+            assert((uintptr_t)p % 64 == 0);
+        auto size = res.nsteps() * sizeof(float);
+        assert(memcmp(file.phase(c), res.phase(c), size) == 0);
+        assert(memcmp(file.freq(c), res.freq(c), size) == 0);
+        assert(memcmp(file.dfreq(c), res.dfreq(c), size) == 0);
+        assert(memcmp(file.amp(c), res.amp(c), size) == 0);
+        assert(memcmp(file.damp(c), res.damp(c), size) == 0);
+    }
+    // The kernels use the mapping directly.
+    channel_param param{file.phase(1), file.freq(1), file.dfreq(1), file.amp(1), file.damp(1)};
+    auto v = scalar::calc_single_chn(3, param.phase[100], param.freq[100], param.amp[100],
+                                     param.dfreq[100], param.damp[100]);
+    auto expected = scalar::calc_single_chn(3, res.phase(1)[100], res.freq(1)[100],
+                                            res.amp(1)[100], res.dfreq(1)[100],
+                                            res.damp(1)[100]);
+    assert(v == expected);
+    SeqFile moved(std::move(file));
+    assert(moved.nchns() == 3);
+}
+
+static void expect_error(const std::string &path)
+{
+    try {
+        SeqFile file(path);
+    }
+    catch (const std::runtime_error &err) {
+        std::cout << "Expected error: " << err.what() << std::endl;
+        return;
+    }
+    abort();
+}
+
+static void modify_file(const std::string &path, size_t offset, const void *data, size_t size)
+{
+    std::fstream stm(path, std::ios::in | std::ios::out | std::ios::binary);
+    stm.seekp(offset);
+    stm.write((const char*)data, size);
+}
+
+static void test_invalid(const std::string &path)
+{
+    auto res = compile_test(2, 1000);
+    expect_error(path + ".missing");
+
+    write_seq_file(path, res, sample_rate);
+    modify_file(path, 0, "NotASeq", 8);
+    expect_error(path);
+
+    write_seq_file(path, res, sample_rate);
+    uint32_t version = SeqFileHeader::current_version + 1;
+    modify_file(path, offsetof(SeqFileHeader, version), &version, sizeof(version));
+    expect_error(path);
+
+    write_seq_file(path, res, sample_rate);
+    uint32_t nchns = 3;
+    modify_file(path, offsetof(SeqFileHeader, nchns), &nchns, sizeof(nchns));
+    expect_error(path);
+
+    write_seq_file(path, res, sample_rate);
+    assert(truncate(path.c_str(), 4096 + 100) == 0);
+    expect_error(path);
+}
+
+// Mapping a large file takes (almost) no time since nothing is read.
+static void test_load_speed(const std::string &path)
+{
+    auto res = compile_test(16, 4 * 1024 * 1024);
+    write_seq_file(path, res, sample_rate);
+    auto size = double(res.stride() * 5 * 16 * sizeof(float)) / 1024 / 1024;
+    auto t0 = getTime();
+    SeqFile file(path);
+    auto elapsed = double(getElapse(t0)) * 1e-6;
+    std::cout << "Mapped " << size << " MiB in " << elapsed << " ms" << std::endl;
+    assert(elapsed < 10);
+    assert(memcmp(file.amp(15), res.amp(15), res.nsteps() * sizeof(float)) == 0);
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/nacs-seq-XXXXXX";
+    auto fd = mkstemp(tmpl);
+    assert(fd >= 0);
+    close(fd);
+    std::string path(tmpl);
+    test_roundtrip(path);
+    test_invalid(path);
+    test_load_speed(path);
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/seq_stream.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr double sample_rate = 625e6;
+
+static void write_test(const std::string &path, int nchns, size_t nsteps)
+{
+    std::vector<ToneTimeline> tones(nchns);
+    auto len = double(nsteps * step_size) / sample_rate;
+    for (int c = 0; c < nchns; c++) {
+        tones[c].ramps.push_back({0, len, 10e6 + c * 1e6, 20e6, 0.1, 0.2 + c * 0.01,
+                                  RampShape::Cubic, RampShape::Cubic});
+    }
+    write_seq_file(path, compile_timeline(tones, sample_rate, nsteps), sample_rate);
+}
+
+// The chunks must have the same content as the mapped file.
+static void test_content(const std::string &path, size_t chunk_steps, int nbuffs, bool slow)
+{
+    SeqFile file(path);
+    SeqStream stream(path, chunk_steps, nbuffs);
+    assert(stream.nchns() == file.nchns());
+    assert(stream.nsteps() == file.nsteps());
+    size_t next = 0;
+    while (auto chunk = stream.get()) {
+        assert(chunk->first == next);
+        assert(chunk->nsteps == std::min(chunk_steps, file.nsteps() - next));
+        for (int c = 0; c < file.nchns(); c++) {
+            auto size = chunk->nsteps * sizeof(float);
+            assert(memcmp(chunk->phase(c), file.phase(c) + next, size) == 0);
+            assert(memcmp(chunk->freq(c), file.freq(c) + next, size) == 0);
+            assert(memcmp(chunk->dfreq(c), file.dfreq(c) + next, size) == 0);
+            assert(memcmp(chunk->amp(c), file.amp(c) + next, size) == 0);
+            assert(memcmp(chunk->damp(c), file.damp(c) + next, size) == 0);
+        }
+        next += chunk->nsteps;
+        if (slow) {
+            // The reader must not get more than `nbuffs` chunks ahead.
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            auto read = stream.stats().bytes_read / (sizeof(float) * 5 * file.nchns());
+            assert(read <= next + chunk_steps * (nbuffs - 1));
+        }
+        stream.release();
+    }
+    assert(next == file.nsteps());
+    assert(!stream.get());
+    auto stats = stream.stats();
+    std::cout << "Chunk " << chunk_steps << ", buffers " << nbuffs
+              << ": stalls: " << stats.nstalls << std::endl;
+}
+
+// The stream can be destroyed before reaching the end.
+static void test_early_stop(const std::string &path)
+{
+    SeqStream stream(path, 1000, 2);
+    auto chunk = stream.get();
+    assert(chunk && chunk->first == 0);
+    stream.release();
+}
+
+static void test_invalid(const std::string &path)
+{
+    try {
+        SeqStream stream(path + ".missing");
+    }
+    catch (const std::runtime_error &err) {
+        std::cout << "Expected error: " << err.what() << std::endl;
+        return;
+    }
+    abort();
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/nacs-seq-XXXXXX";
+    auto fd = mkstemp(tmpl);
+    assert(fd >= 0);
+    close(fd);
+    std::string path(tmpl);
+    write_test(path, 5, 100000);
+    test_content(path, 65536, 4, false);
+    test_content(path, 1000, 2, false);
+    test_content(path, 4096, 3, true);
+    test_content(path, 1000000, 1, false);
+    test_early_stop(path);
+    test_invalid(path);
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+// Check the shadow register file against a card.
+//
+//     test-shadow <device>
+//
+// Registers derived from the ones written (the channel count from the enabled
+// channels) must not be served from a stale cache.
+// Needs a card with at least two channels.
+
+#include <nacs-spcm/spcm.h>
+
+#include <assert.h>
+
+#include <iostream>
+
+using namespace NaCs;
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <device>" << std::endl;
+        return 1;
+    }
+    Spcm::Spcm hdl(argv[1]);
+    hdl.enable_shadow();
+    auto type = hdl.card_type();
+    assert(hdl.card_type() == type);
+    for (int32_t chns: {1, 3, 1}) {
+        hdl.ch_enable(chns);
+        assert(hdl.ch_enable() == chns);
+        assert(hdl.ch_count() == __builtin_popcount(chns));
+    }
+    std::cout << "Passed" << std::endl;
+    return 0;
+}
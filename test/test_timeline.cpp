@@ -0,0 +1,198 @@
+/*************************************************************************
+ *   Copyright (c) 2019 - 2019 Yichao Yu <yyc1992@gmail.com>             *
+ *                                                                       *
+ *   This library is free software; you can redistribute it and/or       *
+ *   modify it under the terms of the GNU Lesser General Public          *
+ *   License as published by the Free Software Foundation; either        *
+ *   version 3.0 of the License, or (at your option) any later version.  *
+ *                                                                       *
+ *   This library is distributed in the hope that it will be useful,     *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU    *
+ *   Lesser General Public License for more details.                     *
+ *                                                                       *
+ *   You should have received a copy of the GNU Lesser General Public    *
+ *   License along with this library. If not,                            *
+ *   see <http://www.gnu.org/licenses/>.                                 *
+ *************************************************************************/
+
+#include "../nacs-spcm/data_stream_p.h"
+
+#include <nacs-spcm/data_stream.h>
+#include <nacs-spcm/timeline.h>
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace NaCs;
+using namespace NaCs::Spcm;
+
+static constexpr double sample_rate = 625e6;
+static constexpr double step_time = step_size / sample_rate;
+
+static double wrap(double phase)
+{
+    return phase - 2 * nearbyint(phase / 2);
+}
+
+// The phase at the start of each step must be where the previous step ended.
+static void check_continuity(const CompiledTimeline &res)
+{
+    for (int c = 0; c < res.nchns(); c++) {
+        for (size_t k = 0; k + 1 < res.nsteps(); k++) {
+            auto next = wrap(double(res.phase(c)[k]) + 2 * double(res.freq(c)[k]) +
+                             2 * double(res.dfreq(c)[k]));
+            assert(fabs(wrap(next - res.phase(c)[k + 1])) < 1e-5);
+        }
+    }
+}
+
+// Compare the samples from the kernel with a chirp computed in double precision.
+static void test_chirp()
+{
+    double f0 = 10e6;
+    double f1 = 30e6;
+    double len = 1e-3;
+    ToneTimeline tone;
+    tone.phase = 0.3;
+    tone.ramps.push_back({0, len, f0, f1, 0.5, 0.5});
+    size_t nsteps = size_t(len / step_time) + 100;
+    auto res = compile_timeline({tone}, sample_rate, nsteps);
+    assert(res.has_dfreq() && !res.has_damp());
+    check_continuity(res);
+    double max_err = 0;
+    for (size_t k = 0; k < nsteps; k += 97) {
+        for (int i = 0; i < step_size; i++) {
+            auto t = (double(k) * step_size + i) / sample_rate;
+            auto te = std::min(t, len);
+            auto phase = tone.phase + 2 * M_PI * (f0 * te + (f1 - f0) / len * te * te / 2 +
+                                                  f1 * (t - te));
+            auto expected = 0.5 * sin(phase);
+            // The kernel output is scaled by `1 / pi`.
+            auto v = M_PI * scalar::calc_single_chn(i, res.phase(0)[k], res.freq(0)[k],
+                                             res.amp(0)[k], res.dfreq(0)[k], res.damp(0)[k]);
+            max_err = std::max(max_err, fabs(v - expected));
+        }
+    }
+    std::cout << "Chirp max error: " << max_err << std::endl;
+    assert(max_err < 1e-3);
+}
+
+static void test_shapes()
+{
+    ToneTimeline tone;
+    // Held at the start values before the first ramp and between the ramps.
+    tone.ramps.push_back({1e-4, 2e-4, 10e6, 20e6, 0.1, 0.9, RampShape::Cubic,
+                          RampShape::Linear});
+    tone.ramps.push_back({5e-4, 1e-4, 20e6, 5e6, 0.9, 0, RampShape::Linear,
+                          RampShape::Cubic});
+    size_t nsteps = size_t(8e-4 / step_time);
+    auto res = compile_timeline({tone, ToneTimeline()}, sample_rate, nsteps);
+    check_continuity(res);
+    auto freq = [&] (double t) {
+        return double(res.freq(0)[size_t(t / step_time)]) / step_time;
+    };
+    auto amp = [&] (double t) {
+        return double(res.amp(0)[size_t(t / step_time)]);
+    };
+    assert(fabs(freq(0) - 10e6) < 1);
+    assert(fabs(amp(0) - 0.1) < 1e-6);
+    // The middle of the cubic ramp and the linear amplitude ramp.
+    assert(fabs(freq(2e-4) - 15e6) < 1e4);
+    assert(fabs(amp(2e-4) - 0.5) < 1e-3);
+    assert(fabs(freq(4e-4) - 20e6) < 1);
+    assert(fabs(amp(4e-4) - 0.9) < 1e-6);
+    assert(fabs(freq(5.5e-4) - 12.5e6) < 1e4);
+    assert(fabs(freq(7e-4) - 5e6) < 1);
+    assert(amp(7e-4) == 0);
+    // The cubic ramp has no slope at the ends.
+    auto k = size_t(1e-4 / step_time) + 1;
+    assert(fabs(res.dfreq(0)[k]) < fabs(res.dfreq(0)[k + 1000]) / 100);
+    // A tone without ramps is off.
+    for (size_t k = 0; k < nsteps; k++) {
+        assert(res.amp(1)[k] == 0 && res.damp(1)[k] == 0);
+    }
+}
+
+static void test_threads()
+{
+    std::vector<ToneTimeline> tones(3);
+    for (int c = 0; c < 3; c++) {
+        tones[c].phase = c;
+        for (int i = 0; i < 20; i++) {
+            tones[c].ramps.push_back({i * 1e-4, 0.8e-4, (10 + i + c) * 1e6,
+                                      (11 + i + c) * 1e6, 0.1 * c, 0.2,
+                                      RampShape(i % 2), RampShape((i / 2) % 2)});
+        }
+    }
+    size_t nsteps = size_t(2.1e-3 / step_time);
+    auto res1 = compile_timeline(tones, sample_rate, nsteps, 1);
+    auto res4 = compile_timeline(tones, sample_rate, nsteps, 4);
+    check_continuity(res1);
+    for (int c = 0; c < 3; c++) {
+        for (auto get: {&CompiledTimeline::phase, &CompiledTimeline::freq,
+                    &CompiledTimeline::dfreq, &CompiledTimeline::amp,
+                    &CompiledTimeline::damp}) {
+            assert(memcmp((res1.*get)(c), (res4.*get)(c), nsteps * sizeof(float)) == 0);
+        }
+    }
+}
+
+static void test_invalid()
+{
+    ToneTimeline tone;
+    tone.ramps.push_back({0, 2e-4, 10e6, 20e6, 0.1, 0.9});
+    tone.ramps.push_back({1e-4, 2e-4, 10e6, 20e6, 0.1, 0.9});
+    bool thrown = false;
+    try {
+        compile_timeline({tone}, sample_rate, 100);
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// Recompiling a shot without slopes into the memory of a shot with slopes
+// must clear the slope arrays, which are then skipped.
+static void test_reuse()
+{
+    std::vector<ToneTimeline> tones(2);
+    for (int c = 0; c < 2; c++)
+        tones[c].ramps.push_back({0, 1e-4, 10e6, 20e6, 0.1, 0.9, RampShape::Cubic});
+    size_t nsteps = size_t(2e-4 / step_time);
+    auto res = compile_timeline(tones, sample_rate, nsteps);
+    assert(res.has_dfreq() && res.has_damp());
+    auto check_zero = [&] {
+        assert(!res.has_dfreq() && !res.has_damp());
+        check_continuity(res);
+        for (int c = 0; c < 2; c++) {
+            for (size_t k = 0; k < nsteps; k++) {
+                assert(res.dfreq(c)[k] == 0 && res.damp(c)[k] == 0);
+                assert(fabs(double(res.freq(c)[k]) / step_time - 15e6) < 1);
+            }
+        }
+    };
+    for (int c = 0; c < 2; c++)
+        tones[c].ramps[0] = {0, 1e-4, 15e6, 15e6, 0.5, 0.5};
+    compile_timeline(res, tones, sample_rate);
+    check_zero();
+    compile_timeline(res, tones, sample_rate);
+    check_zero();
+}
+
+int main()
+{
+    test_chirp();
+    test_shapes();
+    test_threads();
+    test_invalid();
+    test_reuse();
+    return 0;
+}